@@ -0,0 +1,533 @@
+// times the operations of wadutil32 on generated wads, printing one json
+// line for each; the list edits and the save are the ones wadutil32.c runs
+#include "gen.h"
+#include "dir.h"
+#include "wad.h"
+#include "layout.h"
+#include "parallel.h"
+#include "save.h"
+#include "stats.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define EXTRACT_CHUNK (64 * 1024)
+
+struct config {
+	struct gen_options gen;
+	const char *dir;
+	int queries; // name lookups
+	int selected; // lumps deleted and moved
+	int extracted;
+	int keep;
+	int stats; // what wad.c counted, as a last line
+};
+
+struct key {
+	dir_name name;
+	int index;
+};
+
+struct extract_job {
+	const char *dir;
+	const struct wad_span *spans;
+	const int *lumps;
+	struct wad_reader readers[PARALLEL_MAX_WORKERS];
+	char *bufs[PARALLEL_MAX_WORKERS];
+	volatile long error;
+};
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void
+report(const struct config *c, const char *bench, int ops, long long bytes, double seconds)
+{
+	printf(
+		"{\"bench\":\"%s\",\"lumps\":%d,\"dist\":\"%s\",\"mean\":%d,\"dup\":%d,\"ns\":%d,\"seed\":%llu,"
+		"\"ops\":%d,\"bytes\":%lld,\"seconds\":%.6f,\"ns_per_op\":%.1f}\n",
+		bench, c->gen.lumps, gen_dist_name(c->gen.dist), c->gen.mean_size, c->gen.duplicates, c->gen.namespaces, c->gen.seed,
+		ops, bytes, seconds, ops ? seconds * 1e9 / ops : 0.0
+	);
+	fflush(stdout);
+}
+
+// evenly spread, the same every run
+static int *
+spread(int count, int n)
+{
+	int *sels = (int *)malloc(sizeof(int) * (n + 1));
+	int i;
+
+	for (i = 0; sels && (i < n); ++i) {
+		sels[i] = (int)((long long)i * count / n);
+	}
+	return sels;
+}
+
+static int
+load_directory(const char *path, struct dir *dir)
+{
+	struct wad wad;
+	struct wad_dentry d;
+	long long start = stats_begin();
+	int ret = -1;
+	int i;
+
+	if (wad_open(&wad, path)) return -1;
+	if (!dir_reserve(dir, wad.hd.lump_count) && !wad_seek_first_dentry(&wad)) {
+		for (i = 0; i < wad.hd.lump_count; ++i) {
+			if (wad_read_next_dentry(&wad, &d)) break;
+			dir_append(dir, &d, 0, i);
+		}
+		ret = 0;
+	}
+	wad_close(&wad);
+	stats_end(STATS_DIRECTORY_READ, start);
+	return ret;
+}
+
+static int
+copy_dir(struct dir *copy, const struct dir *dir)
+{
+	struct wad_dentry d;
+	int i;
+
+	if (dir_reserve(copy, dir->count)) return -1;
+	for (i = 0; i < dir->count; ++i) {
+		dir_dentry(dir, i, &d);
+		dir_append(copy, &d, dir->sources[i], dir->lumps[i]);
+	}
+	return 0;
+}
+
+// the last lump of a name wins, like with the cache
+static int
+find_linear(const struct dir *dir, dir_name name)
+{
+	int i;
+
+	for (i = dir->count - 1; i >= 0; --i) {
+		if (dir_fold_name(dir->names[i]) == name) return i;
+	}
+	return -1;
+}
+
+static int
+compare_keys(const void *a, const void *b)
+{
+	const struct key *ka = (const struct key *)a;
+	const struct key *kb = (const struct key *)b;
+
+	if (ka->name != kb->name) return (ka->name < kb->name) ? -1 : 1;
+	return ka->index - kb->index;
+}
+
+static int
+find_sorted(const struct key *keys, int count, dir_name name)
+{
+	int lo = 0, hi = count;
+	int found = -1;
+
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (keys[mid].name <= name) lo = mid + 1; else hi = mid;
+		if (keys[mid].name == name) found = keys[mid].index;
+	}
+	return found;
+}
+
+static void
+bench_lookup(const struct config *c, const struct dir *dir)
+{
+	int count = dir->count;
+	struct key *keys = (struct key *)malloc(sizeof(struct key) * (count + 1));
+	int *queries = spread(count, c->queries);
+	long long found = 0;
+	double t;
+	int i;
+
+	if (!keys || !queries) goto cleanup;
+	// spread over the list, but not in order
+	for (i = 0; i < c->queries; ++i) {
+		queries[i] = (int)((queries[i] * 2654435761ull) % count);
+	}
+
+	t = now();
+	for (i = 0; i < c->queries; ++i) {
+		found += find_linear(dir, dir_fold_name(dir->names[queries[i]]));
+	}
+	report(c, "lookup_linear", c->queries, 0, now() - t);
+
+	t = now();
+	for (i = 0; i < count; ++i) {
+		keys[i].name = dir_fold_name(dir->names[i]);
+		keys[i].index = i;
+	}
+	qsort(keys, count, sizeof(struct key), compare_keys);
+	report(c, "index_build", count, 0, now() - t);
+
+	t = now();
+	for (i = 0; i < c->queries; ++i) {
+		found -= find_sorted(keys, count, dir_fold_name(dir->names[queries[i]]));
+	}
+	report(c, "lookup_index", c->queries, 0, now() - t);
+	if (found) fprintf(stderr, "lookups disagree\n");
+
+cleanup:
+	free(keys);
+	free(queries);
+}
+
+// list_delete marks the selection and drops it in one pass
+static void
+bench_delete(const struct config *c, const struct dir *dir)
+{
+	struct dir copy;
+	int count = dir->count;
+	char *marked = (char *)calloc(count + 1, 1);
+	int n = (c->selected < count) ? c->selected : count;
+	int *sels = spread(count, n);
+	double t;
+	int i;
+
+	dir_init(&copy);
+	if (marked && sels && !copy_dir(&copy, dir)) {
+		t = now();
+		for (i = 0; i < n; ++i) {
+			marked[sels[i]] = 1;
+		}
+		dir_remove(&copy, marked);
+		report(c, "delete", n, 0, now() - t);
+	}
+	dir_free(&copy);
+	free(marked);
+	free(sels);
+}
+
+// ten places down and back up; dir_move stops at the ends of the list, so
+// the selection keeps ten lumps clear of both
+static void
+bench_move(const struct config *c, const struct dir *dir)
+{
+	struct dir copy;
+	int count = dir->count;
+	char *selected = (char *)calloc(count + 1, 1);
+	int room = count - 20;
+	int n = (c->selected < room) ? c->selected : room;
+	int *sels = (n > 0) ? spread(room, n) : 0;
+	int moved = 0;
+	double t;
+	int i;
+
+	dir_init(&copy);
+	if (selected && sels && !copy_dir(&copy, dir)) {
+		for (i = 0; i < n; ++i) {
+			selected[10 + sels[i]] = 1;
+		}
+		t = now();
+		for (i = 0; i < 10; ++i) {
+			moved += dir_move(&copy, selected, 1);
+		}
+		for (i = 0; i < 10; ++i) {
+			moved += dir_move(&copy, selected, 0);
+		}
+		report(c, "move", moved, 0, now() - t);
+	}
+	dir_free(&copy);
+	free(selected);
+	free(sels);
+}
+
+static void
+bench_match(const struct config *c, struct dir *dir, const char *bench, const char *text)
+{
+	struct dir_pattern pattern;
+	char *matched = (char *)malloc(dir->count + 1);
+	double t;
+
+	if (matched && !dir_compile(&pattern, text)) {
+		t = now();
+		dir_match(dir, 0, dir->count, &pattern, matched);
+		report(c, bench, dir->count, (long long)sizeof(dir_name) * dir->count, now() - t);
+	}
+	free(matched);
+}
+
+// the columns filled the way openWad fills them
+static void
+bench_dir(const struct config *c, const struct dir *dir)
+{
+	struct dir copy;
+	double t;
+
+	dir_init(&copy);
+	t = now();
+	if (copy_dir(&copy, dir)) goto cleanup;
+	report(c, "dir_build", dir->count, 0, now() - t);
+
+	bench_match(c, &copy, "match_prefix", "L0*");
+	bench_match(c, &copy, "match_wildcard", "?0??1*");
+	bench_match(c, &copy, "match_glob", "*1*2");
+
+cleanup:
+	dir_free(&copy);
+}
+
+// save_wad, but without a cache: seek, copy, then a write for each dentry;
+// aligned the way Save Aligned lays out 4 KiB pages
+static void
+bench_save(const struct config *c, const char *src_path, const struct dir *dir, int aligned)
+{
+	struct save_options options;
+	struct layout_options layout;
+	struct layout_stats stats;
+	char path[4096];
+	int *saved = (int *)malloc(sizeof(int) * (dir->count + 1));
+	struct stat st;
+	double t;
+	int fd;
+
+	if (!saved) return;
+	snprintf(path, sizeof(path), "%s/bench-save%s-%d.wad", c->dir, aligned ? "-aligned" : "", (int)getpid());
+	layout.alignment = 4096;
+	layout.threshold = layout.alignment;
+	options.wad_path = src_path;
+	options.layout = aligned ? &layout : 0;
+	options.skip = 0;
+	options.copy = 0;
+	options.ctx = 0;
+
+	t = now();
+	if (save_dir(path, dir, &options, saved, &stats)) goto cleanup;
+	fd = open(path, O_RDONLY);
+	if ((fd < 0) || fsync(fd) || fstat(fd, &st)) {
+		if (fd >= 0) close(fd);
+		goto cleanup;
+	}
+	close(fd);
+	t = now() - t;
+	report(c, aligned ? "save_aligned" : "save", dir->count, (long long)st.st_size, t);
+
+cleanup:
+	if (!c->keep) unlink(path);
+	free(saved);
+}
+
+static int
+extract_one(struct extract_job *job, int worker, int index)
+{
+	const struct wad_span *span = job->spans + job->lumps[index];
+	char path[4096];
+	int pos = 0;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/%07d.lmp", job->dir, index);
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) return -1;
+	while (pos < span->size) {
+		int rd = wad_reader_read(&job->readers[worker], span, pos, job->bufs[worker], EXTRACT_CHUNK);
+		if ((rd <= 0) || (write(fd, job->bufs[worker], rd) != rd)) break;
+		pos += rd;
+	}
+	close(fd);
+	return (pos == span->size) ? 0 : -1;
+}
+
+static void
+extract_worker(void *ctx, int worker, int index)
+{
+	struct extract_job *job = (struct extract_job *)ctx;
+
+	if (extract_one(job, worker, index)) job->error = -1;
+}
+
+static void
+bench_extract(const struct config *c, const char *wad_path, const struct dir *wad_dir)
+{
+	int count = wad_dir->count;
+	struct extract_job job;
+	struct wad_span *spans = (struct wad_span *)malloc(sizeof(struct wad_span) * (count + 1));
+	char dir[4096];
+	char path[sizeof(dir) + 16];
+	int n = (c->extracted < count) ? c->extracted : count;
+	int *lumps = spread(count, n);
+	long long bytes = 0;
+	int pass, i;
+	double t;
+
+	memset(&job, 0, sizeof(job));
+	snprintf(dir, sizeof(dir), "%s/bench-extract-%d", c->dir, (int)getpid());
+	if (!spans || !lumps || mkdir(dir, 0755)) goto cleanup;
+	for (i = 0; i < count; ++i) {
+		spans[i].path = wad_path;
+		spans[i].offset = wad_dir->offsets[i];
+		spans[i].size = wad_dir->sizes[i];
+	}
+	for (i = 0; i < n; ++i) {
+		bytes += spans[lumps[i]].size;
+	}
+	for (i = 0; i < PARALLEL_MAX_WORKERS; ++i) {
+		wad_reader_init(&job.readers[i]);
+		job.bufs[i] = (char *)malloc(EXTRACT_CHUNK);
+		if (!job.bufs[i]) goto cleanup;
+	}
+	job.dir = dir;
+	job.spans = spans;
+	job.lumps = lumps;
+
+	// once a lump after the other, then the way the parallel modules would
+	for (pass = 0; pass < 2; ++pass) {
+		t = now();
+		if (pass) {
+			parallel_for(n, extract_worker, &job);
+		} else {
+			for (i = 0; (i < n) && !job.error; ++i) {
+				extract_worker(&job, 0, i);
+			}
+		}
+		if (job.error) break;
+		report(c, pass ? "extract_parallel" : "extract", n, bytes, now() - t);
+
+		for (i = 0; i < n; ++i) {
+			snprintf(path, sizeof(path), "%s/%07d.lmp", dir, i);
+			unlink(path);
+		}
+		for (i = 0; i < PARALLEL_MAX_WORKERS; ++i) {
+			wad_reader_close(&job.readers[i]);
+		}
+	}
+	if (job.error) fprintf(stderr, "extract failed\n");
+	rmdir(dir);
+
+cleanup:
+	for (i = 0; i < PARALLEL_MAX_WORKERS; ++i) {
+		wad_reader_close(&job.readers[i]);
+		free(job.bufs[i]);
+	}
+	free(spans);
+	free(lumps);
+}
+
+static void
+usage(void)
+{
+	fprintf(
+		stderr,
+		"usage: bench [options]\n"
+		"  -n lumps      10 to 1000000, markers included (10000)\n"
+		"  -d dist       fixed, uniform or pareto (pareto)\n"
+		"  -m size       mean lump size in bytes (4096)\n"
+		"  -u percent    lumps repeating an earlier one (5)\n"
+		"  -s count      namespaces to fill, up to 3 (3)\n"
+		"  -r seed       of the generator (1)\n"
+		"  -q count      name lookups (1000)\n"
+		"  -k count      lumps deleted and moved (1000)\n"
+		"  -x count      lumps extracted (10000)\n"
+		"  -w dir        where the files go ($TMPDIR or /tmp)\n"
+		"  -g path       only generate the wad to path\n"
+		"  -K            keep the generated files\n"
+		"  -S            print the i/o statistics of wad.c at the end\n"
+	);
+	exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct config c;
+	struct dir dir;
+	const char *only = 0;
+	char path[4096];
+	long long bytes = 0;
+	int opt;
+	double t;
+
+	memset(&c, 0, sizeof(c));
+	c.gen.lumps = 10000;
+	c.gen.dist = GEN_PARETO;
+	c.gen.mean_size = 4096;
+	c.gen.duplicates = 5;
+	c.gen.namespaces = 3;
+	c.gen.seed = 1;
+	c.dir = getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+	c.queries = 1000;
+	c.selected = 1000;
+	c.extracted = 10000;
+
+	while ((opt = getopt(argc, argv, "n:d:m:u:s:r:q:k:x:w:g:KS")) != -1) {
+		switch (opt) {
+		case 'n': c.gen.lumps = atoi(optarg); break;
+		case 'd': if (gen_dist_of_name(optarg, &c.gen.dist)) usage(); break;
+		case 'm': c.gen.mean_size = atoi(optarg); break;
+		case 'u': c.gen.duplicates = atoi(optarg); break;
+		case 's': c.gen.namespaces = atoi(optarg); break;
+		case 'r': c.gen.seed = strtoull(optarg, 0, 0); break;
+		case 'q': c.queries = atoi(optarg); break;
+		case 'k': c.selected = atoi(optarg); break;
+		case 'x': c.extracted = atoi(optarg); break;
+		case 'w': c.dir = optarg; break;
+		case 'g': only = optarg; break;
+		case 'K': c.keep = 1; break;
+		case 'S': c.stats = 1; break;
+		default: usage();
+		}
+	}
+	if ((c.gen.lumps < 1) || (c.gen.mean_size < 0) || (c.queries < 0) || (c.selected < 0) || (c.extracted < 0)) usage();
+
+	if (only) {
+		if (gen_write(only, &c.gen, &bytes)) {
+			fprintf(stderr, "failed to write %s\n", only);
+			return 1;
+		}
+		return 0;
+	}
+
+	// the generator writes through stdio, so it is left out
+	snprintf(path, sizeof(path), "%s/bench-%d.wad", c.dir, (int)getpid());
+	t = now();
+	if (gen_write(path, &c.gen, &bytes)) {
+		fprintf(stderr, "failed to write %s\n", path);
+		return 1;
+	}
+	report(&c, "generate", c.gen.lumps, bytes, now() - t);
+	if (c.stats) stats_enable(1);
+
+	dir_init(&dir);
+	t = now();
+	if (load_directory(path, &dir) || (dir.count != c.gen.lumps)) {
+		fprintf(stderr, "failed to read %s\n", path);
+		return 1;
+	}
+	report(&c, "open", dir.count, (long long)WAD_DENTRY_SIZE * dir.count, now() - t);
+
+	if (c.queries) bench_lookup(&c, &dir);
+	if (c.selected) {
+		bench_delete(&c, &dir);
+		bench_move(&c, &dir);
+	}
+	bench_dir(&c, &dir);
+	bench_save(&c, path, &dir, 0);
+	bench_save(&c, path, &dir, 1);
+	if (c.extracted) bench_extract(&c, path, &dir);
+
+	if (c.stats) {
+		char buf[STATS_DUMP_SIZE];
+
+		if (stats_dump(buf, sizeof(buf)) >= 0) printf("%s\n", buf);
+	}
+	dir_free(&dir);
+	if (!c.keep) unlink(path);
+	return 0;
+}
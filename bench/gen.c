@@ -0,0 +1,193 @@
+#include "gen.h"
+#include "wad.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define GEN_MAX_SIZE (64 * 1024 * 1024)
+
+static const char *dist_names[] = { "fixed", "uniform", "pareto" };
+static const char prefixes[] = { 'L', 'F', 'S', 'P' };
+
+struct gen_lump {
+	unsigned long long seed; // of the payload, shared by duplicates
+	int size;
+	char name[8];
+};
+
+// splitmix64, good enough and the same everywhere
+static unsigned long long
+next(unsigned long long *state)
+{
+	unsigned long long z = (*state += 0x9e3779b97f4a7c15ull);
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+	return z ^ (z >> 31);
+}
+
+static int
+pick_size(unsigned long long *state, const struct gen_options *options)
+{
+	double u, size;
+
+	switch (options->dist) {
+	case GEN_UNIFORM:
+		return (int)(next(state) % (2ull * options->mean_size + 1));
+	case GEN_PARETO:
+		// alpha 1.5 has a mean of three times the minimum
+		u = ((next(state) >> 11) + 1) * (1.0 / 9007199254740992.0);
+		size = options->mean_size / 3.0 / pow(u, 1 / 1.5);
+		if (size > 64.0 * options->mean_size) size = 64.0 * options->mean_size;
+		return (size > GEN_MAX_SIZE) ? GEN_MAX_SIZE : (int)size;
+	default:
+		return options->mean_size;
+	}
+}
+
+static void
+make_name(char name[8], char prefix, int counter)
+{
+	static const char digits[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+	int i;
+
+	name[0] = prefix;
+	for (i = 7; i > 0; --i) {
+		name[i] = digits[counter % 36];
+		counter /= 36;
+	}
+}
+
+static void
+add_marker(struct gen_lump *lump, int ns, int end)
+{
+	const char *name = wad_namespace_marker(ns, end);
+
+	memcpy(lump->name, name, strlen(name));
+}
+
+// six bits of noise in every byte, so the data compresses a little
+static void
+fill_payload(unsigned long long seed, char *buf, int size)
+{
+	unsigned long long state = seed;
+	int i;
+
+	for (i = 0; i + 8 <= size; i += 8) {
+		unsigned long long w = next(&state) & 0x3f3f3f3f3f3f3f3full;
+		memcpy(buf + i, &w, 8);
+	}
+	for (; i < size; ++i) {
+		buf[i] = (char)(next(&state) & 0x3f);
+	}
+}
+
+static int
+write_lumps(FILE *f, const struct gen_lump *lumps, int count, long long *bytes)
+{
+	struct wad_header hd;
+	char entry[WAD_DENTRY_SIZE];
+	long long pos = WAD_HEADER_SIZE;
+	char *buf;
+	int i;
+
+	for (i = 0; i < count; ++i) {
+		pos += lumps[i].size;
+	}
+	if (pos + (long long)WAD_DENTRY_SIZE * count > 0x7fffffff) return -1;
+	buf = (char *)malloc(GEN_MAX_SIZE);
+	if (!buf) return -1;
+
+	hd.type = WAD_TYPE_PWAD;
+	hd.lump_count = count;
+	hd.directory_offset = (int)pos;
+	fwrite(&hd, WAD_HEADER_SIZE, 1, f);
+	for (i = 0; i < count; ++i) {
+		fill_payload(lumps[i].seed, buf, lumps[i].size);
+		fwrite(buf, 1, lumps[i].size, f);
+	}
+	free(buf);
+
+	pos = WAD_HEADER_SIZE;
+	for (i = 0; i < count; ++i) {
+		int offset = lumps[i].size ? (int)pos : 0;
+
+		memcpy(entry, &offset, 4);
+		memcpy(entry + 4, &lumps[i].size, 4);
+		memcpy(entry + 8, lumps[i].name, 8);
+		fwrite(entry, WAD_DENTRY_SIZE, 1, f);
+		pos += lumps[i].size;
+	}
+	*bytes = pos + (long long)WAD_DENTRY_SIZE * count;
+	return ferror(f) ? -1 : 0;
+}
+
+int
+gen_write(const char *path, const struct gen_options *options, long long *bytes)
+{
+	unsigned long long state = options->seed;
+	struct gen_lump *lumps;
+	FILE *f = 0;
+	int namespaces = options->namespaces;
+	int counters[4] = { 0, 0, 0, 0 };
+	int part_size, part;
+	int i = 0;
+	int ret = -1;
+
+	if (options->lumps < 1) return -1;
+	if (namespaces > 3) namespaces = 3;
+	while ((namespaces > 0) && (options->lumps < 3 * namespaces + 1)) --namespaces;
+	lumps = (struct gen_lump *)calloc(options->lumps, sizeof(struct gen_lump));
+	if (!lumps) return -1;
+
+	// the first part is outside of all namespaces and takes the remainder
+	part_size = (options->lumps - 2 * namespaces) / (namespaces + 1);
+	for (part = 0; part <= namespaces; ++part) {
+		int count = part ? part_size : options->lumps - 2 * namespaces - namespaces * part_size;
+		int first;
+
+		if (part) add_marker(lumps + i++, part, 0);
+		for (first = i; i < first + count; ++i) {
+			if ((i > first) && ((int)(next(&state) % 100) < options->duplicates)) {
+				lumps[i] = lumps[first + (int)(next(&state) % (i - first))];
+			} else {
+				lumps[i].seed = next(&state);
+				lumps[i].size = pick_size(&state, options);
+				make_name(lumps[i].name, prefixes[part], counters[part]++);
+			}
+		}
+		if (part) add_marker(lumps + i++, part, 1);
+	}
+
+	f = fopen(path, "wb");
+	if (!f) goto cleanup;
+	setvbuf(f, 0, _IOFBF, 1 << 20);
+	ret = write_lumps(f, lumps, options->lumps, bytes);
+
+cleanup:
+	if (f && fclose(f)) ret = -1;
+	free(lumps);
+	return ret;
+}
+
+const char *
+gen_dist_name(enum gen_dist dist)
+{
+	return dist_names[dist];
+}
+
+int
+gen_dist_of_name(const char *name, enum gen_dist *dist)
+{
+	int i;
+
+	for (i = 0; i < 3; ++i) {
+		if (!strcmp(name, dist_names[i])) {
+			*dist = (enum gen_dist)i;
+			return 0;
+		}
+	}
+	return -1;
+}
@@ -0,0 +1,25 @@
+#ifndef GEN_HEADER
+#define GEN_HEADER
+
+enum gen_dist {
+	GEN_FIXED, // every lump is mean_size long
+	GEN_UNIFORM, // between 0 and twice mean_size
+	GEN_PARETO // mostly small with a long tail, like real resource wads
+};
+
+struct gen_options {
+	int lumps; // markers included
+	enum gen_dist dist;
+	int mean_size;
+	int duplicates; // percent of lumps repeating an earlier name and payload
+	int namespaces; // how many of flats, sprites and patches to fill
+	unsigned long long seed;
+};
+
+// the same options always give the same bytes
+int gen_write(const char *path, const struct gen_options *options, long long *bytes);
+
+const char *gen_dist_name(enum gen_dist dist);
+int gen_dist_of_name(const char *name, enum gen_dist *dist);
+
+#endif // GEN_HEADER
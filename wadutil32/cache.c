@@ -0,0 +1,268 @@
+#include "cache.h"
+#include "hash.h"
+#include "stats.h"
+
+#define WIN32_LEAN_AND_MEAN
+#undef UNICODE
+#include <windows.h>
+#include <stdio.h> // sprintf_s
+#include <stdlib.h> // qsort
+
+// names are compared as 8 bytes regardless of case, the way the engine does
+static int
+compare_names(const char *a, const char *b)
+{
+	int i;
+
+	for (i = 0; i < 8; ++i) {
+		unsigned char ca = a[i], cb = b[i];
+
+		if ((ca >= 'a') && (ca <= 'z')) ca -= 'a' - 'A';
+		if ((cb >= 'a') && (cb <= 'z')) cb -= 'a' - 'A';
+		if (ca != cb) return ca - cb;
+		if (!ca) break;
+	}
+	return 0;
+}
+
+struct cache_key {
+	const struct cache_entry *entry;
+	int index;
+};
+
+static int
+compare_keys(const void *a, const void *b)
+{
+	const struct cache_key *ka = (const struct cache_key *)a;
+	const struct cache_key *kb = (const struct cache_key *)b;
+	int ret = compare_names(ka->entry->name, kb->entry->name);
+
+	return ret ? ret : (ka->index - kb->index);
+}
+
+// the section name changes with the path, size and write time of the file
+static void
+section_name(char name[64], HANDLE file, const char *path)
+{
+	char full[MAX_PATH];
+	FILETIME ft;
+	DWORD size = GetFileSize(file, 0);
+	hash64 h;
+
+	if (!GetFullPathName(path, sizeof(full), full, 0)) lstrcpyn(full, path, sizeof(full));
+	CharLower(full);
+	h = hash_xxh64(full, lstrlen(full), 0);
+	ZeroMemory(&ft, sizeof(ft));
+	GetFileTime(file, 0, 0, &ft);
+	sprintf_s(
+		name, 64, "Local\\wadutil32-%08x%08x-%08x-%08x%08x",
+		(unsigned)(h >> 32), (unsigned)h, (unsigned)size,
+		(unsigned)ft.dwHighDateTime, (unsigned)ft.dwLowDateTime
+	);
+}
+
+static int
+build_section(struct cache *cache, const char *path)
+{
+	struct cache_header *hd = (struct cache_header *)cache->hd;
+	struct cache_entry *dir = (struct cache_entry *)cache->dir;
+	int *index = (int *)cache->index;
+	struct cache_key *keys;
+	struct wad w;
+	int ret;
+	int i;
+
+	ret = wad_open(&w, path);
+	if (ret != WAD_SUCCESS) return ret;
+	if (w.hd.lump_count != hd->lump_count) {
+		wad_close(&w);
+		return CACHE_ERROR_FORMAT;
+	}
+	keys = (struct cache_key *)HeapAlloc(GetProcessHeap(), 0, sizeof(struct cache_key) * (hd->lump_count + 1));
+	if (!keys) {
+		wad_close(&w);
+		return CACHE_ERROR_MAP;
+	}
+
+	ret = wad_seek_first_dentry(&w);
+	for (i = 0; (ret == WAD_SUCCESS) && (i < hd->lump_count); ++i) {
+		struct wad_dentry d;
+
+		ret = wad_read_next_dentry(&w, &d);
+		dir[i].offset = d.offset;
+		dir[i].size = d.size;
+		CopyMemory(dir[i].name, d.name, 8);
+		keys[i].entry = dir + i;
+		keys[i].index = i;
+	}
+	wad_close(&w);
+
+	if (ret == WAD_SUCCESS) {
+		qsort(keys, hd->lump_count, sizeof(struct cache_key), compare_keys);
+		for (i = 0; i < hd->lump_count; ++i) {
+			index[i] = keys[i].index;
+		}
+	}
+	HeapFree(GetProcessHeap(), 0, keys);
+	return ret;
+}
+
+int
+cache_open(struct cache *cache, const char *path)
+{
+	struct wad_header whd;
+	SYSTEM_INFO si;
+	char name[64];
+	DWORD rd;
+	int size;
+	int created = 0;
+	int ret;
+	long long start = stats_begin();
+
+	ZeroMemory(cache, sizeof(*cache));
+	// others may still replace the file, the watch picks that up
+	cache->file = CreateFile(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, 0, OPEN_EXISTING, 0, 0);
+	if (cache->file == INVALID_HANDLE_VALUE) {
+		cache->file = 0;
+		return WAD_ERROR_FILE_OPEN;
+	}
+	STATS_ADD(STATS_OPENS, 1);
+	if (!ReadFile(cache->file, &whd, WAD_HEADER_SIZE, &rd, 0) || (rd != WAD_HEADER_SIZE) || (whd.lump_count < 0)) {
+		ret = WAD_ERROR_FILE_READ;
+		goto fail;
+	}
+	STATS_ADD(STATS_READS, 1);
+	STATS_ADD(STATS_BYTES_READ, rd);
+
+	GetSystemInfo(&si);
+	cache->granularity = si.dwAllocationGranularity;
+	if (cache_map_file(cache)) {
+		ret = CACHE_ERROR_MAP;
+		goto fail;
+	}
+
+	section_name(name, cache->file, path);
+	size = sizeof(struct cache_header) + (sizeof(struct cache_entry) + sizeof(int)) * whd.lump_count;
+	cache->section = CreateFileMapping(INVALID_HANDLE_VALUE, 0, PAGE_READWRITE, 0, size, name);
+	created = GetLastError() != ERROR_ALREADY_EXISTS;
+	if (cache->section) cache->hd = (const struct cache_header *)MapViewOfFile(cache->section, FILE_MAP_WRITE, 0, 0, 0);
+	if (!cache->hd) {
+		ret = CACHE_ERROR_MAP;
+		goto fail;
+	}
+	cache->dir = (const struct cache_entry *)(cache->hd + 1);
+	cache->index = (const int *)(cache->dir + whd.lump_count);
+
+	if (created) {
+		struct cache_header *hd = (struct cache_header *)cache->hd;
+
+		hd->magic = CACHE_MAGIC;
+		hd->type = whd.type;
+		hd->lump_count = whd.lump_count;
+		ret = build_section(cache, path);
+		if (ret) goto fail;
+		InterlockedExchange(&hd->ready, 1);
+		STATS_ADD(STATS_CACHE_MISSES, 1);
+	} else {
+		DWORD began = GetTickCount();
+
+		while (!cache->hd->ready && (GetTickCount() - began < CACHE_WAIT_MS)) {
+			Sleep(1);
+		}
+		if ((cache->hd->ready != 1) || (cache->hd->magic != CACHE_MAGIC) || (cache->hd->lump_count != whd.lump_count)) {
+			ret = CACHE_ERROR_FORMAT;
+			goto fail;
+		}
+		STATS_ADD(STATS_CACHE_HITS, 1);
+	}
+	stats_end(STATS_DIRECTORY_READ, start);
+	return 0;
+
+fail:
+	// the others waiting on it give up rather than time out
+	if (created && cache->hd) InterlockedExchange((volatile long *)&cache->hd->ready, -1);
+	cache_close(cache);
+	return ret;
+}
+
+void
+cache_close(struct cache *cache)
+{
+	if (cache->hd) UnmapViewOfFile(cache->hd);
+	if (cache->section) CloseHandle(cache->section);
+	cache_unmap_file(cache);
+	if (cache->file) CloseHandle(cache->file);
+	ZeroMemory(cache, sizeof(*cache));
+}
+
+// the last lump with the name, the one that wins in the engine
+int
+cache_find(const struct cache *cache, const char *name)
+{
+	char key[8 + 1];
+	int lo = 0, hi = cache->hd->lump_count;
+	int found = -1;
+
+	ZeroMemory(key, sizeof(key));
+	lstrcpyn(key, name, sizeof(key));
+
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		int ret = compare_names(cache->dir[cache->index[mid]].name, key);
+		if (ret <= 0) lo = mid + 1; else hi = mid;
+		if (!ret) found = cache->index[mid];
+	}
+	return found;
+}
+
+void
+cache_dentry(const struct cache *cache, int lump, struct wad_dentry *dentry)
+{
+	const struct cache_entry *e = cache->dir + lump;
+
+	dentry->offset = e->offset;
+	dentry->size = e->size;
+	CopyMemory(dentry->name, e->name, 8);
+	dentry->name[8] = '\0';
+}
+
+// takes a range rather than a lump so that edited directories can use it too
+int
+cache_map(const struct cache *cache, int offset, int size, struct cache_view *view)
+{
+	unsigned start, skew;
+
+	view->data = 0;
+	view->base = 0;
+	if (!size) return 0;
+	if (!cache->lumps || (offset < 0) || (size < 0)) return CACHE_ERROR_MAP;
+
+	start = offset - offset % cache->granularity;
+	skew = offset - start;
+	view->base = MapViewOfFile(cache->lumps, FILE_MAP_READ, 0, start, skew + size);
+	if (!view->base) return CACHE_ERROR_MAP;
+	view->data = (const char *)view->base + skew;
+	return 0;
+}
+
+void
+cache_unmap(struct cache_view *view)
+{
+	if (view->base) UnmapViewOfFile(view->base);
+	view->base = 0;
+	view->data = 0;
+}
+
+int
+cache_map_file(struct cache *cache)
+{
+	if (!cache->lumps && cache->file) cache->lumps = CreateFileMapping(cache->file, 0, PAGE_READONLY, 0, 0, 0);
+	return cache->lumps ? 0 : CACHE_ERROR_MAP;
+}
+
+void
+cache_unmap_file(struct cache *cache)
+{
+	if (cache->lumps) CloseHandle(cache->lumps);
+	cache->lumps = 0;
+}
@@ -0,0 +1,60 @@
+#ifndef CACHE_HEADER
+#define CACHE_HEADER
+
+#include "wad.h"
+
+// how long to wait for another process building the same directory
+#define CACHE_WAIT_MS 5000
+
+enum cache_error {
+	CACHE_ERROR_MAP = -80,
+	CACHE_ERROR_FORMAT = -81
+};
+
+enum cache_magic {
+	CACHE_MAGIC = LE_FOURCC('W', 'D', 'C', '3')
+};
+
+struct cache_header {
+	unsigned magic;
+	enum wad_type type;
+	int lump_count;
+	volatile long ready; // -1 when the process building it failed
+};
+
+struct cache_entry {
+	int offset;
+	int size;
+	char name[8];
+};
+
+// the directory and a by-name index live in a named section shared by every
+// process that has the same version of the wad open, the lumps are mapped
+// straight from the file so their pages are shared through the page cache
+struct cache {
+	void *file;
+	void *lumps;
+	void *section;
+	const struct cache_header *hd;
+	const struct cache_entry *dir;
+	const int *index;
+	unsigned granularity;
+};
+
+struct cache_view {
+	const char *data;
+	void *base;
+};
+
+int cache_open(struct cache *cache, const char *path);
+void cache_close(struct cache *cache);
+int cache_find(const struct cache *cache, const char *name);
+void cache_dentry(const struct cache *cache, int lump, struct wad_dentry *dentry);
+int cache_map(const struct cache *cache, int offset, int size, struct cache_view *view);
+void cache_unmap(struct cache_view *view);
+// while the lumps are mapped nobody else may truncate or rewrite the file
+// (ERROR_USER_MAPPED_FILE), so the mapping is let go of when it changes
+int cache_map_file(struct cache *cache);
+void cache_unmap_file(struct cache *cache);
+
+#endif // CACHE_HEADER
@@ -0,0 +1,800 @@
+#include "deflate.h"
+
+#define WIN32_LEAN_AND_MEAN
+#undef UNICODE
+#include <windows.h>
+#include <stdlib.h> // qsort
+
+#define WINDOW_SIZE 32768
+#define HASH_BITS 15
+#define MIN_MATCH 3
+#define MAX_MATCH 258
+#define MAX_CHAIN 64 // candidates tried per position
+#define LAZY_LIMIT 32 // matches this long are taken without looking one byte ahead
+#define BLOCK_SYMBOLS 16384
+#define STORED_MAX 65535
+#define FAST_BITS 9
+
+static const unsigned short length_base[29] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+	35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const unsigned char length_extra[29] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+	3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const unsigned short dist_base[30] = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+	257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const unsigned char dist_extra[30] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+	7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+static const unsigned char code_length_order[19] = {
+	16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+static unsigned
+reverse_bits(unsigned v, int n)
+{
+	unsigned r = 0;
+
+	while (n--) {
+		r = (r << 1) | (v & 1);
+		v >>= 1;
+	}
+	return r;
+}
+
+static int
+log2_floor(unsigned v)
+{
+	int n = 0;
+
+	while (v >>= 1) ++n;
+	return n;
+}
+
+static int
+length_code(int length)
+{
+	unsigned x = length - MIN_MATCH;
+	int n;
+
+	if (length == MAX_MATCH) return 28;
+	if (x < 8) return x;
+	n = log2_floor(x);
+	return 4 * (n - 1) + ((x >> (n - 2)) & 3);
+}
+
+static int
+dist_code(int dist)
+{
+	unsigned x = dist - 1;
+	int n;
+
+	if (x < 4) return x;
+	n = log2_floor(x);
+	return 2 * n + ((x >> (n - 1)) & 1);
+}
+
+static void
+fixed_lengths(unsigned char *lit, unsigned char *dist)
+{
+	int i;
+
+	for (i = 0; i < 288; ++i) {
+		lit[i] = (i < 144) ? 8 : (i < 256) ? 9 : (i < 280) ? 7 : 8;
+	}
+	for (i = 0; i < 30; ++i) {
+		dist[i] = 5;
+	}
+}
+
+// compression
+
+struct bit_writer {
+	unsigned char *out;
+	unsigned char *end;
+	unsigned long long bits;
+	int count;
+	int full;
+};
+
+static void
+put_bits(struct bit_writer *w, unsigned value, int n)
+{
+	w->bits |= (unsigned long long)value << w->count;
+	w->count += n;
+	while (w->count >= 8) {
+		if (w->out == w->end) {
+			w->full = 1;
+			w->bits = 0;
+			w->count = 0;
+			return;
+		}
+		*w->out++ = (unsigned char)w->bits;
+		w->bits >>= 8;
+		w->count -= 8;
+	}
+}
+
+static void
+align_bits(struct bit_writer *w)
+{
+	put_bits(w, 0, (8 - w->count) & 7);
+}
+
+struct symbol_freq {
+	unsigned key;
+	int symbol;
+};
+
+static int
+compare_freqs(const void *a, const void *b)
+{
+	const struct symbol_freq *fa = (const struct symbol_freq *)a;
+	const struct symbol_freq *fb = (const struct symbol_freq *)b;
+
+	if (fa->key != fb->key) return (fa->key < fb->key) ? -1 : 1;
+	return fa->symbol - fb->symbol;
+}
+
+// Moffat and Katajainen, in place on frequencies sorted ascending;
+// leaves the code length of each symbol in its key
+static void
+minimum_redundancy(struct symbol_freq *a, int n)
+{
+	int root, leaf, next, avail, used, depth;
+
+	a[0].key += a[1].key;
+	root = 0;
+	leaf = 2;
+	for (next = 1; next < n - 1; ++next) {
+		if ((leaf >= n) || (a[root].key < a[leaf].key)) {
+			a[next].key = a[root].key;
+			a[root++].key = next;
+		} else {
+			a[next].key = a[leaf++].key;
+		}
+		if ((leaf >= n) || ((root < next) && (a[root].key < a[leaf].key))) {
+			a[next].key += a[root].key;
+			a[root++].key = next;
+		} else {
+			a[next].key += a[leaf++].key;
+		}
+	}
+	a[n - 2].key = 0;
+	for (next = n - 3; next >= 0; --next) {
+		a[next].key = a[a[next].key].key + 1;
+	}
+	avail = 1;
+	used = depth = 0;
+	root = n - 2;
+	next = n - 1;
+	while (avail > 0) {
+		while ((root >= 0) && ((int)a[root].key == depth)) {
+			++used;
+			--root;
+		}
+		while (avail > used) {
+			a[next--].key = depth;
+			--avail;
+		}
+		avail = 2 * used;
+		++depth;
+		used = 0;
+	}
+}
+
+static void
+build_lengths(const unsigned *freq, int n, int max, unsigned char *lengths)
+{
+	struct symbol_freq syms[288];
+	int counts[32];
+	int m = 0;
+	int i, j, k;
+
+	for (i = 0; i < n; ++i) {
+		lengths[i] = 0;
+		if (freq[i]) {
+			syms[m].key = freq[i];
+			syms[m++].symbol = i;
+		}
+	}
+	if (!m) return;
+	if (m == 1) {
+		lengths[syms[0].symbol] = 1;
+		return;
+	}
+	qsort(syms, m, sizeof(struct symbol_freq), compare_freqs);
+	minimum_redundancy(syms, m);
+
+	ZeroMemory(counts, sizeof(counts));
+	for (i = 0; i < m; ++i) {
+		++counts[syms[i].key < 31 ? syms[i].key : 31];
+	}
+	// too long codes get folded into the longest allowed one, then
+	// shorter codes are split until the code is complete again
+	for (i = max + 1; i < 32; ++i) {
+		counts[max] += counts[i];
+		counts[i] = 0;
+	}
+	k = 0;
+	for (i = max; i > 0; --i) {
+		k += counts[i] << (max - i);
+	}
+	while (k != (1 << max)) {
+		--counts[max];
+		for (i = max - 1; i > 0; --i) {
+			if (counts[i]) {
+				--counts[i];
+				counts[i + 1] += 2;
+				break;
+			}
+		}
+		--k;
+	}
+
+	k = 0;
+	for (i = max; i > 0; --i) {
+		for (j = counts[i]; j > 0; --j) {
+			lengths[syms[k++].symbol] = i;
+		}
+	}
+}
+
+static void
+make_codes(const unsigned char *lengths, int n, unsigned short *codes)
+{
+	int counts[16];
+	int next[16];
+	int code = 0;
+	int i;
+
+	ZeroMemory(counts, sizeof(counts));
+	for (i = 0; i < n; ++i) {
+		++counts[lengths[i]];
+	}
+	counts[0] = 0;
+	for (i = 1; i < 16; ++i) {
+		code = (code + counts[i - 1]) << 1;
+		next[i] = code;
+	}
+	for (i = 0; i < n; ++i) {
+		codes[i] = lengths[i] ? reverse_bits(next[lengths[i]]++, lengths[i]) : 0;
+	}
+}
+
+struct deflater {
+	const unsigned char *src;
+	int length;
+	int *head;
+	int *prev;
+	unsigned short *lits; // a literal byte or a match length
+	unsigned short *dists; // 0 for literals
+	int symbols;
+	int block_start;
+	struct bit_writer w;
+};
+
+#define HASH(p) (((((unsigned)(p)[0]) << 10) ^ (((unsigned)(p)[1]) << 5) ^ (p)[2]) & ((1 << HASH_BITS) - 1))
+
+static void
+insert(struct deflater *d, int pos)
+{
+	int h;
+
+	if (pos + MIN_MATCH > d->length) return;
+	h = HASH(d->src + pos);
+	d->prev[pos & (WINDOW_SIZE - 1)] = d->head[h];
+	d->head[h] = pos;
+}
+
+static int
+longest_match(const struct deflater *d, int pos, int *dist)
+{
+	const unsigned char *s = d->src;
+	int limit = d->length - pos;
+	int chain = MAX_CHAIN;
+	int best = 0;
+	int cand;
+
+	if (limit > MAX_MATCH) limit = MAX_MATCH;
+	if (limit < MIN_MATCH) return 0;
+
+	for (cand = d->head[HASH(s + pos)]; (cand >= 0) && (pos - cand <= WINDOW_SIZE) && chain--; cand = d->prev[cand & (WINDOW_SIZE - 1)]) {
+		if (s[cand + best] == s[pos + best]) {
+			int len = 0;
+
+			while ((len < limit) && (s[cand + len] == s[pos + len])) ++len;
+			if (len > best) {
+				best = len;
+				*dist = pos - cand;
+				if (len == limit) break;
+			}
+		}
+	}
+	return (best >= MIN_MATCH) ? best : 0;
+}
+
+static void
+put_symbols(struct deflater *d, const unsigned short *lit_codes, const unsigned char *lit_lengths, const unsigned short *dist_codes, const unsigned char *dist_lengths)
+{
+	int i;
+
+	for (i = 0; i < d->symbols; ++i) {
+		int dist = d->dists[i];
+
+		if (!dist) {
+			put_bits(&d->w, lit_codes[d->lits[i]], lit_lengths[d->lits[i]]);
+		} else {
+			int lc = length_code(d->lits[i]);
+			int dc = dist_code(dist);
+
+			put_bits(&d->w, lit_codes[257 + lc], lit_lengths[257 + lc]);
+			put_bits(&d->w, d->lits[i] - length_base[lc], length_extra[lc]);
+			put_bits(&d->w, dist_codes[dc], dist_lengths[dc]);
+			put_bits(&d->w, dist - dist_base[dc], dist_extra[dc]);
+		}
+	}
+	put_bits(&d->w, lit_codes[256], lit_lengths[256]);
+}
+
+// picks the cheapest of a stored, a fixed and a dynamic block
+static void
+write_block(struct deflater *d, int end, int final)
+{
+	unsigned lit_freq[286], dist_freq[30], cl_freq[19];
+	unsigned char lit_lengths[288], dist_lengths[30], cl_lengths[19];
+	unsigned char fixed_lit[288], fixed_dist[30];
+	unsigned short lit_codes[288], dist_codes[30], cl_codes[19];
+	unsigned char lengths[286 + 30];
+	unsigned char rle[286 + 30], rle_extra[286 + 30];
+	int rle_count = 0;
+	int hlit, hdist, hclen;
+	unsigned long long dynamic_bits, fixed_bits, stored_bits;
+	int raw = end - d->block_start;
+	int used = 0;
+	int i, j;
+
+	ZeroMemory(lit_freq, sizeof(lit_freq));
+	ZeroMemory(dist_freq, sizeof(dist_freq));
+	ZeroMemory(cl_freq, sizeof(cl_freq));
+	for (i = 0; i < d->symbols; ++i) {
+		if (d->dists[i]) {
+			++lit_freq[257 + length_code(d->lits[i])];
+			++dist_freq[dist_code(d->dists[i])];
+		} else {
+			++lit_freq[d->lits[i]];
+		}
+	}
+	lit_freq[256] = 1;
+	// some decoders refuse a distance code with less than two symbols
+	for (i = 0; i < 30; ++i) {
+		if (dist_freq[i]) ++used;
+	}
+	for (i = 0; (i < 2) && (used < 2); ++i) {
+		if (!dist_freq[i]) {
+			dist_freq[i] = 1;
+			++used;
+		}
+	}
+
+	build_lengths(lit_freq, 286, 15, lit_lengths);
+	build_lengths(dist_freq, 30, 15, dist_lengths);
+	for (hlit = 286; (hlit > 257) && !lit_lengths[hlit - 1]; --hlit);
+	for (hdist = 30; (hdist > 1) && !dist_lengths[hdist - 1]; --hdist);
+
+	CopyMemory(lengths, lit_lengths, hlit);
+	CopyMemory(lengths + hlit, dist_lengths, hdist);
+	for (i = 0; i < hlit + hdist; i = j) {
+		int run;
+
+		for (j = i + 1; (j < hlit + hdist) && (lengths[j] == lengths[i]); ++j);
+		run = j - i;
+		if (!lengths[i]) {
+			while (run >= 11) {
+				int n = (run > 138) ? 138 : run;
+				rle[rle_count] = 18;
+				rle_extra[rle_count++] = n - 11;
+				run -= n;
+			}
+			if (run >= 3) {
+				rle[rle_count] = 17;
+				rle_extra[rle_count++] = run - 3;
+				run = 0;
+			}
+		} else {
+			rle[rle_count] = lengths[i];
+			rle_extra[rle_count++] = 0;
+			--run;
+			while (run >= 3) {
+				int n = (run > 6) ? 6 : run;
+				rle[rle_count] = 16;
+				rle_extra[rle_count++] = n - 3;
+				run -= n;
+			}
+		}
+		while (run--) {
+			rle[rle_count] = lengths[i];
+			rle_extra[rle_count++] = 0;
+		}
+	}
+	for (i = 0; i < rle_count; ++i) {
+		++cl_freq[rle[i]];
+	}
+	build_lengths(cl_freq, 19, 7, cl_lengths);
+	for (hclen = 19; (hclen > 4) && !cl_lengths[code_length_order[hclen - 1]]; --hclen);
+
+	fixed_lengths(fixed_lit, fixed_dist);
+	dynamic_bits = 3 + 5 + 5 + 4 + 3 * hclen;
+	for (i = 0; i < rle_count; ++i) {
+		dynamic_bits += cl_lengths[rle[i]] + ((rle[i] == 16) ? 2 : (rle[i] == 17) ? 3 : (rle[i] == 18) ? 7 : 0);
+	}
+	fixed_bits = 3;
+	for (i = 0; i < 286; ++i) {
+		int extra = (i > 256) ? length_extra[i - 257] : 0;
+		dynamic_bits += (unsigned long long)lit_freq[i] * (lit_lengths[i] + extra);
+		fixed_bits += (unsigned long long)lit_freq[i] * (fixed_lit[i] + extra);
+	}
+	for (i = 0; i < 30; ++i) {
+		// the padding above only costs in the dynamic block
+		unsigned n = dist_freq[i];
+		dynamic_bits += (unsigned long long)n * (dist_lengths[i] + dist_extra[i]);
+		fixed_bits += (unsigned long long)n * (fixed_dist[i] + dist_extra[i]);
+	}
+	stored_bits = (unsigned long long)(raw + 5 * (raw / STORED_MAX + 1)) * 8 + 7;
+
+	if ((stored_bits <= fixed_bits) && (stored_bits <= dynamic_bits)) {
+		const unsigned char *p = d->src + d->block_start;
+
+		do {
+			int n = (raw > STORED_MAX) ? STORED_MAX : raw;
+
+			raw -= n;
+			put_bits(&d->w, (final && !raw) ? 1 : 0, 1);
+			put_bits(&d->w, 0, 2);
+			align_bits(&d->w);
+			put_bits(&d->w, n, 16);
+			put_bits(&d->w, n ^ 0xffff, 16);
+			if (d->w.end - d->w.out < n) {
+				d->w.full = 1;
+				break;
+			}
+			CopyMemory(d->w.out, p, n);
+			d->w.out += n;
+			p += n;
+		} while (raw);
+	} else if (fixed_bits <= dynamic_bits) {
+		make_codes(fixed_lit, 288, lit_codes);
+		make_codes(fixed_dist, 30, dist_codes);
+		put_bits(&d->w, final, 1);
+		put_bits(&d->w, 1, 2);
+		put_symbols(d, lit_codes, fixed_lit, dist_codes, fixed_dist);
+	} else {
+		make_codes(lit_lengths, 286, lit_codes);
+		make_codes(dist_lengths, 30, dist_codes);
+		make_codes(cl_lengths, 19, cl_codes);
+		put_bits(&d->w, final, 1);
+		put_bits(&d->w, 2, 2);
+		put_bits(&d->w, hlit - 257, 5);
+		put_bits(&d->w, hdist - 1, 5);
+		put_bits(&d->w, hclen - 4, 4);
+		for (i = 0; i < hclen; ++i) {
+			put_bits(&d->w, cl_lengths[code_length_order[i]], 3);
+		}
+		for (i = 0; i < rle_count; ++i) {
+			put_bits(&d->w, cl_codes[rle[i]], cl_lengths[rle[i]]);
+			if (rle[i] >= 16) put_bits(&d->w, rle_extra[i], (rle[i] == 16) ? 2 : (rle[i] == 17) ? 3 : 7);
+		}
+		put_symbols(d, lit_codes, lit_lengths, dist_codes, dist_lengths);
+	}
+
+	d->symbols = 0;
+	d->block_start = end;
+}
+
+int
+deflate_compress(const void *src, int length, void *dst, int capacity)
+{
+	struct deflater d;
+	int pos = 0;
+	int ret;
+	int i;
+
+	ZeroMemory(&d, sizeof(d));
+	d.src = (const unsigned char *)src;
+	d.length = length;
+	d.w.out = (unsigned char *)dst;
+	d.w.end = d.w.out + capacity;
+	d.head = (int *)HeapAlloc(GetProcessHeap(), 0, sizeof(int) << HASH_BITS);
+	d.prev = (int *)HeapAlloc(GetProcessHeap(), 0, sizeof(int) * WINDOW_SIZE);
+	d.lits = (unsigned short *)HeapAlloc(GetProcessHeap(), 0, sizeof(unsigned short) * BLOCK_SYMBOLS);
+	d.dists = (unsigned short *)HeapAlloc(GetProcessHeap(), 0, sizeof(unsigned short) * BLOCK_SYMBOLS);
+	if (!d.head || !d.prev || !d.lits || !d.dists) {
+		ret = DEFLATE_ERROR_ALLOC;
+		goto cleanup;
+	}
+	for (i = 0; i < (1 << HASH_BITS); ++i) {
+		d.head[i] = -1;
+	}
+
+	while ((pos < length) && !d.w.full) {
+		int dist = 0;
+		int len = longest_match(&d, pos, &dist);
+
+		insert(&d, pos);
+		if (len && (len < LAZY_LIMIT)) {
+			int dist2;
+
+			// a longer match one byte later is worth a literal
+			if (longest_match(&d, pos + 1, &dist2) > len) len = 0;
+		}
+		if (len) {
+			d.lits[d.symbols] = len;
+			d.dists[d.symbols++] = dist;
+			for (i = 1; i < len; ++i) {
+				insert(&d, pos + i);
+			}
+			pos += len;
+		} else {
+			d.lits[d.symbols] = d.src[pos];
+			d.dists[d.symbols++] = 0;
+			++pos;
+		}
+		if (d.symbols == BLOCK_SYMBOLS) write_block(&d, pos, 0);
+	}
+	write_block(&d, pos, !0);
+	align_bits(&d.w);
+
+	ret = d.w.full ? DEFLATE_ERROR_FULL : (int)(d.w.out - (unsigned char *)dst);
+cleanup:
+	if (d.head) HeapFree(GetProcessHeap(), 0, d.head);
+	if (d.prev) HeapFree(GetProcessHeap(), 0, d.prev);
+	if (d.lits) HeapFree(GetProcessHeap(), 0, d.lits);
+	if (d.dists) HeapFree(GetProcessHeap(), 0, d.dists);
+	return ret;
+}
+
+// decompression
+
+struct huffman {
+	unsigned short fast[1 << FAST_BITS]; // length << 9 | symbol, 0 if the code is longer
+	unsigned short first_code[16];
+	int max_code[17];
+	unsigned short first_symbol[16];
+	unsigned char size[288];
+	unsigned short value[288];
+};
+
+struct bit_reader {
+	const unsigned char *in;
+	const unsigned char *end;
+	unsigned long long bits;
+	int count;
+	int overrun; // zero bytes fed past the end
+};
+
+static int
+build_huffman(struct huffman *h, const unsigned char *lengths, int n)
+{
+	int sizes[17];
+	int next_code[16];
+	int code = 0, k = 0;
+	int i;
+
+	ZeroMemory(sizes, sizeof(sizes));
+	ZeroMemory(h->fast, sizeof(h->fast));
+	for (i = 0; i < n; ++i) {
+		++sizes[lengths[i]];
+	}
+	sizes[0] = 0;
+	for (i = 1; i < 16; ++i) {
+		next_code[i] = code;
+		h->first_code[i] = code;
+		h->first_symbol[i] = k;
+		code += sizes[i];
+		if (sizes[i] && (code - 1 >= (1 << i))) return DEFLATE_ERROR_DATA;
+		h->max_code[i] = code << (16 - i);
+		code <<= 1;
+		k += sizes[i];
+	}
+	h->max_code[16] = 0x10000;
+	for (i = 0; i < n; ++i) {
+		int s = lengths[i];
+
+		if (s) {
+			int c = next_code[s] - h->first_code[s] + h->first_symbol[s];
+
+			h->size[c] = s;
+			h->value[c] = i;
+			if (s <= FAST_BITS) {
+				unsigned j;
+
+				for (j = reverse_bits(next_code[s], s); j < (1 << FAST_BITS); j += 1 << s) {
+					h->fast[j] = (s << 9) | i;
+				}
+			}
+			++next_code[s];
+		}
+	}
+	return 0;
+}
+
+static void
+fill_bits(struct bit_reader *r)
+{
+	while (r->count <= 56) {
+		unsigned b = 0;
+
+		if (r->in < r->end) {
+			b = *r->in++;
+		} else {
+			++r->overrun;
+		}
+		r->bits |= (unsigned long long)b << r->count;
+		r->count += 8;
+	}
+}
+
+static unsigned
+get_bits(struct bit_reader *r, int n)
+{
+	unsigned v;
+
+	if (r->count < n) fill_bits(r);
+	v = (unsigned)r->bits & ((1u << n) - 1);
+	r->bits >>= n;
+	r->count -= n;
+	return v;
+}
+
+static int
+decode(struct bit_reader *r, const struct huffman *h)
+{
+	unsigned k;
+	int b, s;
+
+	if (r->count < 16) fill_bits(r);
+	b = h->fast[r->bits & ((1 << FAST_BITS) - 1)];
+	if (b) {
+		s = b >> 9;
+		r->bits >>= s;
+		r->count -= s;
+		return b & 511;
+	}
+	k = reverse_bits((unsigned)r->bits & 0xffff, 16);
+	for (s = FAST_BITS + 1; (s < 16) && (k >= (unsigned)h->max_code[s]); ++s);
+	if (s >= 16) return DEFLATE_ERROR_DATA;
+	b = (k >> (16 - s)) - h->first_code[s] + h->first_symbol[s];
+	if ((b >= 288) || (h->size[b] != s)) return DEFLATE_ERROR_DATA;
+	r->bits >>= s;
+	r->count -= s;
+	return h->value[b];
+}
+
+static int
+read_dynamic(struct bit_reader *r, struct huffman *lit, struct huffman *dist)
+{
+	struct huffman cl;
+	unsigned char cl_lengths[19];
+	unsigned char lengths[286 + 30];
+	int hlit = get_bits(r, 5) + 257;
+	int hdist = get_bits(r, 5) + 1;
+	int hclen = get_bits(r, 4) + 4;
+	int i, n;
+
+	if ((hlit > 286) || (hdist > 30)) return DEFLATE_ERROR_DATA;
+	ZeroMemory(cl_lengths, sizeof(cl_lengths));
+	for (i = 0; i < hclen; ++i) {
+		cl_lengths[code_length_order[i]] = get_bits(r, 3);
+	}
+	if (build_huffman(&cl, cl_lengths, 19)) return DEFLATE_ERROR_DATA;
+
+	for (n = 0; n < hlit + hdist; ) {
+		int c = decode(r, &cl);
+		int repeat, fill = 0;
+
+		if (c < 0) return DEFLATE_ERROR_DATA;
+		if (c < 16) {
+			lengths[n++] = c;
+			continue;
+		}
+		if (c == 16) {
+			if (!n) return DEFLATE_ERROR_DATA;
+			fill = lengths[n - 1];
+			repeat = 3 + get_bits(r, 2);
+		} else if (c == 17) {
+			repeat = 3 + get_bits(r, 3);
+		} else {
+			repeat = 11 + get_bits(r, 7);
+		}
+		if (n + repeat > hlit + hdist) return DEFLATE_ERROR_DATA;
+		while (repeat--) lengths[n++] = fill;
+	}
+	if (!lengths[256]) return DEFLATE_ERROR_DATA;
+	if (build_huffman(lit, lengths, hlit)) return DEFLATE_ERROR_DATA;
+	if (build_huffman(dist, lengths + hlit, hdist)) return DEFLATE_ERROR_DATA;
+	return 0;
+}
+
+int
+deflate_inflate(const void *src, int length, void *dst, int capacity)
+{
+	struct huffman lit, dist;
+	struct bit_reader r;
+	unsigned char *out = (unsigned char *)dst;
+	int pos = 0;
+	int final;
+
+	ZeroMemory(&r, sizeof(r));
+	r.in = (const unsigned char *)src;
+	r.end = r.in + length;
+
+	do {
+		int type;
+
+		final = get_bits(&r, 1);
+		type = get_bits(&r, 2);
+		if (type == 0) {
+			int n, check;
+
+			get_bits(&r, r.count & 7);
+			n = get_bits(&r, 16);
+			check = get_bits(&r, 16);
+			if ((n ^ 0xffff) != check) return DEFLATE_ERROR_DATA;
+			if (n > capacity - pos) return DEFLATE_ERROR_FULL;
+			// whole bytes still in the bit buffer come first
+			while (n && r.count) {
+				out[pos++] = get_bits(&r, 8);
+				--n;
+			}
+			if ((r.overrun * 8 > r.count) || (n > r.end - r.in)) return DEFLATE_ERROR_DATA;
+			CopyMemory(out + pos, r.in, n);
+			r.in += n;
+			pos += n;
+			continue;
+		}
+		if (type == 1) {
+			unsigned char lit_lengths[288], dist_lengths[30];
+
+			fixed_lengths(lit_lengths, dist_lengths);
+			build_huffman(&lit, lit_lengths, 288);
+			build_huffman(&dist, dist_lengths, 30);
+		} else if ((type != 2) || read_dynamic(&r, &lit, &dist)) {
+			return DEFLATE_ERROR_DATA;
+		}
+
+		for (;;) {
+			int sym = decode(&r, &lit);
+
+			if (sym < 0) return DEFLATE_ERROR_DATA;
+			if (sym < 256) {
+				if (pos == capacity) return DEFLATE_ERROR_FULL;
+				out[pos++] = sym;
+			} else if (sym == 256) {
+				break;
+			} else {
+				int len, d;
+
+				sym -= 257;
+				if (sym >= 29) return DEFLATE_ERROR_DATA;
+				len = length_base[sym] + get_bits(&r, length_extra[sym]);
+				sym = decode(&r, &dist);
+				if ((sym < 0) || (sym >= 30)) return DEFLATE_ERROR_DATA;
+				d = dist_base[sym] + get_bits(&r, dist_extra[sym]);
+				if (d > pos) return DEFLATE_ERROR_DATA;
+				if (len > capacity - pos) return DEFLATE_ERROR_FULL;
+				while (len--) {
+					out[pos] = out[pos - d];
+					++pos;
+				}
+			}
+		}
+		if (r.overrun * 8 > r.count) return DEFLATE_ERROR_DATA;
+	} while (!final);
+
+	return pos;
+}
@@ -0,0 +1,15 @@
+#ifndef DEFLATE_HEADER
+#define DEFLATE_HEADER
+
+enum deflate_error {
+	DEFLATE_ERROR_ALLOC = -144,
+	DEFLATE_ERROR_FULL = -145, // the output did not fit
+	DEFLATE_ERROR_DATA = -146
+};
+
+// raw deflate streams, the way zip stores them, without zlib framing;
+// both return the number of bytes written to dst or an error
+int deflate_compress(const void *src, int length, void *dst, int capacity);
+int deflate_inflate(const void *src, int length, void *dst, int capacity);
+
+#endif // DEFLATE_HEADER
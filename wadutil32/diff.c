@@ -0,0 +1,888 @@
+#include "diff.h"
+
+#define WIN32_LEAN_AND_MEAN
+#undef UNICODE
+#include <windows.h>
+#include <stdlib.h> // qsort
+
+#define DIFF_BUFFER_SIZE (64 * 1024)
+
+struct diff_wad {
+	struct wad w;
+	const char *path;
+	struct wad_dentry *dir;
+	hash64 *hashes;
+	hash64 directory_hash;
+};
+
+struct diff_key {
+	char name[8 + 1];
+	int index;
+};
+
+struct diff_out {
+	HANDLE fd;
+	int pos;
+	int used;
+	int error;
+	char buf[DIFF_BUFFER_SIZE];
+};
+
+struct diff_in {
+	HANDLE fd;
+	int pos;
+	int end;
+	char buf[DIFF_BUFFER_SIZE];
+};
+
+static void *
+diff_alloc(int size)
+{
+	return HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, size ? size : 1);
+}
+
+static void
+diff_free(void *p)
+{
+	if (p) HeapFree(GetProcessHeap(), 0, p);
+}
+
+static void
+diff_wad_close(struct diff_wad *dw)
+{
+	if (dw->dir) {
+		wad_close(&dw->w);
+		diff_free(dw->dir);
+		dw->dir = 0;
+	}
+	diff_free(dw->hashes);
+	dw->hashes = 0;
+}
+
+static int
+diff_wad_load(struct diff_wad *dw, const char *path)
+{
+	int ret;
+	int i;
+
+	ZeroMemory(dw, sizeof(*dw));
+	ret = wad_open(&dw->w, path);
+	if (ret != WAD_SUCCESS) return ret;
+	dw->path = path;
+	dw->dir = (struct wad_dentry *)diff_alloc(sizeof(struct wad_dentry) * dw->w.hd.lump_count);
+	dw->hashes = (hash64 *)diff_alloc(sizeof(hash64) * dw->w.hd.lump_count);
+	if (!dw->dir || !dw->hashes) {
+		wad_close(&dw->w);
+		diff_free(dw->dir);
+		diff_free(dw->hashes);
+		dw->dir = 0;
+		dw->hashes = 0;
+		return DIFF_ERROR_ALLOC;
+	}
+
+	ret = wad_seek_first_dentry(&dw->w);
+	{
+		struct hash_xxh64 h;
+
+		hash_xxh64_init(&h, 0);
+		for (i = 0; (ret == WAD_SUCCESS) && (i < dw->w.hd.lump_count); ++i) {
+			ret = wad_read_next_dentry(&dw->w, dw->dir + i);
+			hash_xxh64_update(&h, dw->dir + i, WAD_DENTRY_SIZE);
+		}
+		dw->directory_hash = hash_xxh64_final(&h);
+	}
+	if (ret != WAD_SUCCESS) diff_wad_close(dw);
+	return ret;
+}
+
+static void
+diff_span(const struct diff_wad *dw, int i, struct wad_span *span)
+{
+	span->path = dw->path;
+	span->offset = dw->dir[i].offset;
+	span->size = dw->dir[i].size;
+}
+
+static int
+compare_keys(const void *a, const void *b)
+{
+	const struct diff_key *ka = (const struct diff_key *)a;
+	const struct diff_key *kb = (const struct diff_key *)b;
+	int ret = lstrcmp(ka->name, kb->name);
+	return ret ? ret : (ka->index - kb->index);
+}
+
+static struct diff_key *
+sorted_keys(const struct diff_wad *dw)
+{
+	int n = dw->w.hd.lump_count;
+	struct diff_key *keys = (struct diff_key *)diff_alloc(sizeof(struct diff_key) * n);
+	int i;
+
+	if (!keys) return 0;
+	for (i = 0; i < n; ++i) {
+		lstrcpy(keys[i].name, dw->dir[i].name);
+		keys[i].index = i;
+	}
+	qsort(keys, n, sizeof(struct diff_key), compare_keys);
+	return keys;
+}
+
+// pairs the k-th lump of a name in the new wad with the k-th one of the old wad
+static int
+match_lumps(const struct diff_wad *old_wad, const struct diff_wad *new_wad, int *match, struct diff_stats *stats)
+{
+	struct diff_key *ok = sorted_keys(old_wad);
+	struct diff_key *nk = sorted_keys(new_wad);
+	int on = old_wad->w.hd.lump_count;
+	int nn = new_wad->w.hd.lump_count;
+	int i = 0, j = 0;
+
+	if (!ok || !nk) {
+		diff_free(ok);
+		diff_free(nk);
+		return DIFF_ERROR_ALLOC;
+	}
+
+	while (j < nn) {
+		int ret = (i < on) ? lstrcmp(ok[i].name, nk[j].name) : 1;
+
+		if (!ret) {
+			match[nk[j].index] = ok[i].index;
+			++i;
+			++j;
+		} else if (ret < 0) {
+			++stats->removed;
+			++i;
+		} else {
+			match[nk[j].index] = -1;
+			++j;
+		}
+	}
+	stats->removed += on - i;
+
+	diff_free(ok);
+	diff_free(nk);
+	return 0;
+}
+
+// hashes the lump pairs that have the same size, the others differ anyway
+static int
+hash_candidates(struct diff_wad *old_wad, struct diff_wad *new_wad, const int *match)
+{
+	struct wad_span *spans;
+	struct hash_lump *hashes;
+	int nn = new_wad->w.hd.lump_count;
+	int count = 0;
+	int ret;
+	int i;
+
+	spans = (struct wad_span *)diff_alloc(sizeof(struct wad_span) * nn * 2);
+	hashes = (struct hash_lump *)diff_alloc(sizeof(struct hash_lump) * nn * 2);
+	if (!spans || !hashes) {
+		diff_free(spans);
+		diff_free(hashes);
+		return DIFF_ERROR_ALLOC;
+	}
+
+	for (i = 0; i < nn; ++i) {
+		if ((match[i] >= 0) && (old_wad->dir[match[i]].size == new_wad->dir[i].size)) {
+			diff_span(old_wad, match[i], spans + count++);
+			diff_span(new_wad, i, spans + count++);
+		}
+	}
+
+	ret = hash_spans(spans, count, HASH_XXH64, hashes);
+
+	for (i = 0, count = 0; i < nn; ++i) {
+		if ((match[i] >= 0) && (old_wad->dir[match[i]].size == new_wad->dir[i].size)) {
+			old_wad->hashes[match[i]] = hashes[count++].xxh64;
+			new_wad->hashes[i] = hashes[count++].xxh64;
+		}
+	}
+
+	diff_free(spans);
+	diff_free(hashes);
+	return ret;
+}
+
+static int
+unchanged(const struct diff_wad *old_wad, const struct diff_wad *new_wad, const int *match, int i)
+{
+	int k = match[i];
+	return (k >= 0) &&
+		(old_wad->dir[k].size == new_wad->dir[i].size) &&
+		(old_wad->hashes[k] == new_wad->hashes[i]);
+}
+
+static void
+out_flush(struct diff_out *out)
+{
+	DWORD wr;
+
+	if (out->used && !out->error) {
+		if (!WriteFile(out->fd, out->buf, out->used, &wr, 0) || (wr != (DWORD)out->used)) {
+			out->error = DIFF_ERROR_WRITE;
+		}
+	}
+	out->used = 0;
+}
+
+static void
+out_write(struct diff_out *out, const void *data, int length)
+{
+	const char *p = (const char *)data;
+
+	out->pos += length;
+	while (length) {
+		int chunk = DIFF_BUFFER_SIZE - out->used;
+		if (chunk > length) chunk = length;
+		CopyMemory(out->buf + out->used, p, chunk);
+		out->used += chunk;
+		p += chunk;
+		length -= chunk;
+		if (out->used == DIFF_BUFFER_SIZE) out_flush(out);
+	}
+}
+
+static int
+out_open(struct diff_out *out, const char *path)
+{
+	out->fd = CreateFile(path, GENERIC_WRITE, 0, 0, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, 0);
+	out->pos = 0;
+	out->used = 0;
+	out->error = 0;
+	return (out->fd == INVALID_HANDLE_VALUE) ? WAD_ERROR_FILE_OPEN : 0;
+}
+
+// flushes and rewrites the header at the start of the file
+static int
+out_close(struct diff_out *out, const void *header, int length)
+{
+	DWORD wr;
+
+	out_flush(out);
+	if (header && !out->error) {
+		SetFilePointer(out->fd, 0, 0, FILE_BEGIN);
+		if (!WriteFile(out->fd, header, length, &wr, 0) || (wr != (DWORD)length)) {
+			out->error = DIFF_ERROR_WRITE;
+		}
+	}
+	CloseHandle(out->fd);
+	return out->error;
+}
+
+static int
+out_copy_span(struct diff_out *out, struct wad_reader *reader, const struct wad_span *span, int pos, int length)
+{
+	while (length > 0) {
+		int chunk = DIFF_BUFFER_SIZE - out->used;
+		int rd;
+
+		if (chunk > length) chunk = length;
+		rd = wad_reader_read(reader, span, pos, out->buf + out->used, chunk);
+		if (rd <= 0) return rd ? rd : WAD_ERROR_FILE_READ;
+		out->used += rd;
+		out->pos += rd;
+		pos += rd;
+		length -= rd;
+		if (out->used == DIFF_BUFFER_SIZE) out_flush(out);
+	}
+	return out->error;
+}
+
+static int
+in_read(struct diff_in *in, void *data, int length)
+{
+	char *p = (char *)data;
+
+	while (length) {
+		int chunk = in->end - in->pos;
+
+		if (!chunk) {
+			DWORD rd;
+			if (!ReadFile(in->fd, in->buf, DIFF_BUFFER_SIZE, &rd, 0) || !rd) return WAD_ERROR_FILE_READ;
+			in->pos = 0;
+			in->end = rd;
+			continue;
+		}
+		if (chunk > length) chunk = length;
+		CopyMemory(p, in->buf + in->pos, chunk);
+		in->pos += chunk;
+		p += chunk;
+		length -= chunk;
+	}
+	return 0;
+}
+
+struct delta {
+	struct diff_out *out;
+	struct diff_stats *stats;
+	int copy_offset;
+	int copy_length;
+};
+
+static void
+delta_flush_copy(struct delta *d)
+{
+	if (d->copy_length) {
+		struct diff_cmd c;
+		c.cmd = DIFF_CMD_COPY;
+		c.offset = d->copy_offset;
+		c.length = d->copy_length;
+		out_write(d->out, &c, sizeof(c));
+		d->copy_length = 0;
+	}
+}
+
+static void
+delta_copy(struct delta *d, int offset, int length)
+{
+	if (d->copy_length && (d->copy_offset + d->copy_length == offset)) {
+		d->copy_length += length;
+		return;
+	}
+	delta_flush_copy(d);
+	d->copy_offset = offset;
+	d->copy_length = length;
+}
+
+static void
+delta_data(struct delta *d, const char *data, int length)
+{
+	struct diff_cmd c;
+
+	if (!length) return;
+	delta_flush_copy(d);
+	c.cmd = DIFF_CMD_DATA;
+	c.offset = 0;
+	c.length = length;
+	out_write(d->out, &c, sizeof(c));
+	out_write(d->out, data, length);
+	d->stats->literal_bytes += length;
+}
+
+#define WEAK(a, b) (((a) & 0xffff) | ((b) << 16))
+
+// rsync: weak rolling checksums of the old blocks, slid over the new lump byte by byte
+static int
+diff_delta(struct diff_out *out, struct wad_reader *reader, const struct wad_span *old_span, const struct wad_span *new_span, struct diff_stats *stats)
+{
+	const int block = DIFF_BLOCK_SIZE;
+	const int buf_size = DIFF_BUFFER_SIZE + block;
+	int n = old_span->size / block;
+	int table_size = 1;
+	unsigned *weak = 0;
+	hash64 *strong = 0;
+	int *head = 0, *next = 0;
+	unsigned char *buf = 0;
+	struct delta d;
+	struct diff_cmd end_cmd;
+	int pos = 0, end = 0, start = 0, lit = 0;
+	int rolling = 0;
+	unsigned a = 0, b = 0;
+	int ret = DIFF_ERROR_ALLOC;
+	int i;
+
+	d.out = out;
+	d.stats = stats;
+	d.copy_length = 0;
+
+	while (table_size < 2 * n) table_size <<= 1;
+	weak = (unsigned *)diff_alloc(sizeof(unsigned) * (n + 1));
+	strong = (hash64 *)diff_alloc(sizeof(hash64) * (n + 1));
+	head = (int *)diff_alloc(sizeof(int) * table_size);
+	next = (int *)diff_alloc(sizeof(int) * (n + 1));
+	buf = (unsigned char *)diff_alloc(buf_size);
+	if (!weak || !strong || !head || !next || !buf) goto cleanup;
+
+	for (i = 0; i < table_size; ++i) {
+		head[i] = -1;
+	}
+	for (i = 0; i < n; ++i) {
+		int k;
+
+		ret = wad_reader_read(reader, old_span, i * block, buf, block);
+		if (ret != block) {
+			if (ret >= 0) ret = WAD_ERROR_FILE_READ;
+			goto cleanup;
+		}
+		for (a = 0, b = 0, k = 0; k < block; ++k) {
+			a += buf[k];
+			b += (block - k) * buf[k];
+		}
+		weak[i] = WEAK(a, b);
+		strong[i] = hash_xxh64(buf, block, 0);
+		next[i] = head[weak[i] & (table_size - 1)];
+		head[weak[i] & (table_size - 1)] = i;
+	}
+
+	for (;;) {
+		int found = -1;
+
+		if (end - start < block) {
+			if (pos + end >= new_span->size) break;
+			delta_data(&d, (const char *)buf + lit, start - lit);
+			MoveMemory(buf, buf + start, end - start);
+			pos += start;
+			end -= start;
+			start = 0;
+			lit = 0;
+			ret = wad_reader_read(reader, new_span, pos + end, buf + end, buf_size - end);
+			if (ret <= 0) {
+				if (!ret) ret = WAD_ERROR_FILE_READ;
+				goto cleanup;
+			}
+			end += ret;
+			continue;
+		}
+
+		if (!rolling) {
+			int k;
+			for (a = 0, b = 0, k = 0; k < block; ++k) {
+				a += buf[start + k];
+				b += (block - k) * buf[start + k];
+			}
+			rolling = 1;
+		}
+
+		if (n) {
+			unsigned w = WEAK(a, b);
+			hash64 s = 0;
+			int have_strong = 0;
+
+			for (i = head[w & (table_size - 1)]; i >= 0; i = next[i]) {
+				if (weak[i] != w) continue;
+				if (!have_strong) {
+					s = hash_xxh64(buf + start, block, 0);
+					have_strong = 1;
+				}
+				if (strong[i] == s) {
+					found = i;
+					break;
+				}
+			}
+		}
+
+		if (found >= 0) {
+			delta_data(&d, (const char *)buf + lit, start - lit);
+			delta_copy(&d, found * block, block);
+			start += block;
+			lit = start;
+			rolling = 0;
+		} else if (start + block < end) {
+			unsigned char o = buf[start], in = buf[start + block];
+			a += in - o;
+			b += a - block * o;
+			++start;
+		} else {
+			++start;
+			rolling = 0;
+		}
+	}
+
+	delta_data(&d, (const char *)buf + lit, end - lit);
+	delta_flush_copy(&d);
+	end_cmd.cmd = DIFF_CMD_END;
+	end_cmd.offset = 0;
+	end_cmd.length = 0;
+	out_write(out, &end_cmd, sizeof(end_cmd));
+	ret = out->error;
+
+cleanup:
+	diff_free(weak);
+	diff_free(strong);
+	diff_free(head);
+	diff_free(next);
+	diff_free(buf);
+	return ret;
+}
+
+static int
+diff_prepare(struct diff_wad *old_wad, struct diff_wad *new_wad, const char *old_path, const char *new_path, int **match, struct diff_stats *stats)
+{
+	int ret;
+
+	ZeroMemory(stats, sizeof(*stats));
+	*match = 0;
+	ret = diff_wad_load(old_wad, old_path);
+	if (ret) return ret;
+	ret = diff_wad_load(new_wad, new_path);
+	if (ret) {
+		diff_wad_close(old_wad);
+		return ret;
+	}
+
+	*match = (int *)diff_alloc(sizeof(int) * new_wad->w.hd.lump_count);
+	if (!*match) ret = DIFF_ERROR_ALLOC;
+	if (!ret) ret = match_lumps(old_wad, new_wad, *match, stats);
+	if (!ret) ret = hash_candidates(old_wad, new_wad, *match);
+	if (ret) {
+		diff_free(*match);
+		*match = 0;
+		diff_wad_close(old_wad);
+		diff_wad_close(new_wad);
+	}
+	return ret;
+}
+
+int
+diff_make_patch(const char *old_path, const char *new_path, const char *patch_path, struct diff_stats *stats)
+{
+	struct diff_wad old_wad, new_wad;
+	struct diff_header hd;
+	struct diff_out *out;
+	struct wad_reader reader;
+	int *match;
+	int ret;
+	int i;
+
+	ret = diff_prepare(&old_wad, &new_wad, old_path, new_path, &match, stats);
+	if (ret) return ret;
+
+	out = (struct diff_out *)diff_alloc(sizeof(struct diff_out));
+	if (!out) {
+		ret = DIFF_ERROR_ALLOC;
+		goto cleanup;
+	}
+	ret = out_open(out, patch_path);
+	if (ret) goto cleanup;
+	wad_reader_init(&reader);
+
+	hd.magic = DIFF_MAGIC;
+	hd.block_size = DIFF_BLOCK_SIZE;
+	hd.type = new_wad.w.hd.type;
+	hd.lump_count = new_wad.w.hd.lump_count;
+	hd.old_lump_count = old_wad.w.hd.lump_count;
+	hd.reserved = 0;
+	hd.old_directory = old_wad.directory_hash;
+	out_write(out, &hd, sizeof(hd));
+
+	for (i = 0; !ret && (i < new_wad.w.hd.lump_count); ++i) {
+		struct diff_lump rec;
+		struct wad_span new_span;
+
+		CopyMemory(rec.name, new_wad.dir[i].name, sizeof(rec.name));
+		rec.size = new_wad.dir[i].size;
+		rec.old_index = match[i];
+		diff_span(&new_wad, i, &new_span);
+
+		if (unchanged(&old_wad, &new_wad, match, i)) {
+			rec.op = DIFF_LUMP_SAME;
+			out_write(out, &rec, sizeof(rec));
+			++stats->same;
+		} else if ((match[i] >= 0) && (old_wad.dir[match[i]].size >= DIFF_BLOCK_SIZE)) {
+			struct wad_span old_span;
+
+			diff_span(&old_wad, match[i], &old_span);
+			rec.op = DIFF_LUMP_DELTA;
+			out_write(out, &rec, sizeof(rec));
+			ret = diff_delta(out, &reader, &old_span, &new_span, stats);
+			++stats->delta;
+		} else {
+			rec.op = DIFF_LUMP_NEW;
+			out_write(out, &rec, sizeof(rec));
+			ret = out_copy_span(out, &reader, &new_span, 0, new_span.size);
+			stats->literal_bytes += new_span.size;
+			if (match[i] >= 0) ++stats->delta; else ++stats->added;
+		}
+	}
+
+	wad_reader_close(&reader);
+	if (out_close(out, 0, 0) && !ret) ret = DIFF_ERROR_WRITE;
+
+cleanup:
+	diff_free(out);
+	diff_free(match);
+	diff_wad_close(&old_wad);
+	diff_wad_close(&new_wad);
+	return ret;
+}
+
+static int
+is_map_lump(const char *name)
+{
+	static const char *names[] = {
+		"THINGS", "LINEDEFS", "SIDEDEFS", "VERTEXES", "SEGS", "SSECTORS", "NODES", "SECTORS",
+		"REJECT", "BLOCKMAP", "BEHAVIOR", "SCRIPTS", "TEXTMAP", "ZNODES", "DIALOGUE", "ENDMAP"
+	};
+	int i;
+
+	for (i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+		if (!lstrcmp(name, names[i])) return !0;
+	}
+	return 0;
+}
+
+static int
+name_ends_with(const char *name, const char *suffix)
+{
+	int n = lstrlen(name), m = lstrlen(suffix);
+	return (n > m) && !lstrcmp(name + n - m, suffix);
+}
+
+static void
+add_marker(struct wad_dentry *dir, int *count, const char *name)
+{
+	struct wad_dentry *d = dir + (*count)++;
+	d->offset = 0;
+	d->size = 0;
+	ZeroMemory(d->name, sizeof(d->name));
+	lstrcpy(d->name, name);
+}
+
+// pwads cannot delete, so removed lumps stay visible in the base wad
+int
+diff_make_pwad(const char *old_path, const char *new_path, const char *pwad_path, struct diff_stats *stats)
+{
+	struct diff_wad old_wad, new_wad;
+	struct wad_header hd;
+	struct diff_out *out = 0;
+	struct wad_reader reader;
+	struct wad_dentry *dir = 0;
+	int *match;
+	int *ns = 0; // outermost namespace start marker of each lump, or -1
+	char *keep = 0;
+	int count = 0;
+	int open_ns = -1;
+	int nn;
+	int ret;
+	int i;
+
+	ret = diff_prepare(&old_wad, &new_wad, old_path, new_path, &match, stats);
+	if (ret) return ret;
+	nn = new_wad.w.hd.lump_count;
+	wad_reader_init(&reader);
+
+	out = (struct diff_out *)diff_alloc(sizeof(struct diff_out));
+	dir = (struct wad_dentry *)diff_alloc(sizeof(struct wad_dentry) * nn * 3);
+	ns = (int *)diff_alloc(sizeof(int) * (nn + 1));
+	keep = (char *)diff_alloc(nn);
+	if (!out || !dir || !ns || !keep) {
+		ret = DIFF_ERROR_ALLOC;
+		goto cleanup;
+	}
+
+	{
+		int depth = 0, outer = -1;
+
+		for (i = 0; i < nn; ++i) {
+			const char *name = new_wad.dir[i].name;
+
+			if (name_ends_with(name, "_START")) {
+				if (!depth++) outer = i;
+				ns[i] = -1;
+				continue;
+			}
+			if (name_ends_with(name, "_END")) {
+				if (depth && !--depth) {
+					ns[outer] = i; // remember the end marker on the start marker
+					outer = -1;
+				}
+				ns[i] = -1;
+				continue;
+			}
+			ns[i] = depth ? outer : -1;
+			if (unchanged(&old_wad, &new_wad, match, i)) {
+				++stats->same;
+			} else {
+				keep[i] = 1;
+				if (match[i] < 0) ++stats->added; else ++stats->delta;
+			}
+		}
+	}
+
+	// a map is loaded from the last wad having its header, so keep changed maps whole
+	for (i = 0; i + 1 < nn; ++i) {
+		int j, changed = keep[i];
+
+		if (!is_map_lump(new_wad.dir[i + 1].name) || is_map_lump(new_wad.dir[i].name)) continue;
+		for (j = i + 1; (j < nn) && is_map_lump(new_wad.dir[j].name); ++j) {
+			changed |= keep[j];
+		}
+		if (changed) {
+			for (j = i; (j < nn) && ((j == i) || is_map_lump(new_wad.dir[j].name)); ++j) {
+				keep[j] = 1;
+			}
+		}
+		i = j - 1;
+	}
+
+	ret = out_open(out, pwad_path);
+	if (ret) goto cleanup;
+
+	hd.type = WAD_TYPE_PWAD;
+	hd.lump_count = 0;
+	hd.directory_offset = 0;
+	out_write(out, &hd, WAD_HEADER_SIZE);
+
+	for (i = 0; !ret && (i < nn); ++i) {
+		struct wad_span span;
+
+		if (!keep[i]) continue;
+		if (open_ns != ns[i]) {
+			if ((open_ns >= 0) && (ns[open_ns] >= 0)) add_marker(dir, &count, new_wad.dir[ns[open_ns]].name);
+			if (ns[i] >= 0) add_marker(dir, &count, new_wad.dir[ns[i]].name);
+			open_ns = ns[i];
+		}
+		diff_span(&new_wad, i, &span);
+		dir[count] = new_wad.dir[i];
+		dir[count].offset = span.size ? out->pos : 0;
+		++count;
+		ret = out_copy_span(out, &reader, &span, 0, span.size);
+		if (match[i] < 0 || !unchanged(&old_wad, &new_wad, match, i)) stats->literal_bytes += span.size;
+	}
+	if ((open_ns >= 0) && (ns[open_ns] >= 0)) add_marker(dir, &count, new_wad.dir[ns[open_ns]].name);
+
+	hd.lump_count = count;
+	hd.directory_offset = out->pos;
+	for (i = 0; i < count; ++i) {
+		out_write(out, dir + i, WAD_DENTRY_SIZE);
+	}
+	if (out_close(out, &hd, WAD_HEADER_SIZE) && !ret) ret = DIFF_ERROR_WRITE;
+
+cleanup:
+	wad_reader_close(&reader);
+	diff_free(out);
+	diff_free(dir);
+	diff_free(ns);
+	diff_free(keep);
+	diff_free(match);
+	diff_wad_close(&old_wad);
+	diff_wad_close(&new_wad);
+	return ret;
+}
+
+static int
+copy_from_patch(struct diff_out *out, struct diff_in *in, int length)
+{
+	while (length > 0) {
+		int chunk = DIFF_BUFFER_SIZE - out->used;
+		if (chunk > length) chunk = length;
+		if (in_read(in, out->buf + out->used, chunk)) return DIFF_ERROR_FORMAT;
+		out->used += chunk;
+		out->pos += chunk;
+		length -= chunk;
+		if (out->used == DIFF_BUFFER_SIZE) out_flush(out);
+	}
+	return out->error;
+}
+
+int
+diff_apply(const char *old_path, const char *patch_path, const char *out_path)
+{
+	struct diff_wad old_wad;
+	struct diff_header hd;
+	struct wad_header whd;
+	struct diff_in *in = 0;
+	struct diff_out *out = 0;
+	struct wad_dentry *dir = 0;
+	struct wad_reader reader;
+	int ret;
+	int i;
+
+	ret = diff_wad_load(&old_wad, old_path);
+	if (ret) return ret;
+	wad_reader_init(&reader);
+
+	in = (struct diff_in *)diff_alloc(sizeof(struct diff_in));
+	out = (struct diff_out *)diff_alloc(sizeof(struct diff_out));
+	if (!in || !out) {
+		ret = DIFF_ERROR_ALLOC;
+		goto cleanup;
+	}
+	in->fd = CreateFile(patch_path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, 0, 0);
+	if (in->fd == INVALID_HANDLE_VALUE) {
+		ret = WAD_ERROR_FILE_OPEN;
+		goto cleanup;
+	}
+
+	if (in_read(in, &hd, sizeof(hd)) || (hd.magic != DIFF_MAGIC) || (hd.lump_count < 0)) {
+		ret = DIFF_ERROR_FORMAT;
+		goto cleanup;
+	}
+	if ((hd.old_lump_count != old_wad.w.hd.lump_count) || (hd.old_directory != old_wad.directory_hash)) {
+		ret = DIFF_ERROR_BASE;
+		goto cleanup;
+	}
+
+	dir = (struct wad_dentry *)diff_alloc(sizeof(struct wad_dentry) * hd.lump_count);
+	if (!dir) {
+		ret = DIFF_ERROR_ALLOC;
+		goto cleanup;
+	}
+	ret = out_open(out, out_path);
+	if (ret) goto cleanup;
+
+	whd.type = hd.type;
+	whd.lump_count = hd.lump_count;
+	whd.directory_offset = 0;
+	out_write(out, &whd, WAD_HEADER_SIZE);
+
+	for (i = 0; !ret && (i < hd.lump_count); ++i) {
+		struct diff_lump rec;
+		struct wad_span old_span;
+		int start = out->pos;
+
+		if (in_read(in, &rec, sizeof(rec))) {
+			ret = DIFF_ERROR_FORMAT;
+			break;
+		}
+		if ((rec.op != DIFF_LUMP_NEW) && ((unsigned)rec.old_index >= (unsigned)old_wad.w.hd.lump_count)) {
+			ret = DIFF_ERROR_FORMAT;
+			break;
+		}
+		if (rec.op != DIFF_LUMP_NEW) diff_span(&old_wad, rec.old_index, &old_span);
+
+		switch (rec.op) {
+		case DIFF_LUMP_SAME:
+			ret = out_copy_span(out, &reader, &old_span, 0, old_span.size);
+			break;
+		case DIFF_LUMP_DELTA:
+			for (;;) {
+				struct diff_cmd c;
+
+				if (in_read(in, &c, sizeof(c))) {
+					ret = DIFF_ERROR_FORMAT;
+					break;
+				}
+				if (c.cmd == DIFF_CMD_END) break;
+				if (c.cmd == DIFF_CMD_COPY) {
+					ret = out_copy_span(out, &reader, &old_span, c.offset, c.length);
+				} else if (c.cmd == DIFF_CMD_DATA) {
+					ret = copy_from_patch(out, in, c.length);
+				} else {
+					ret = DIFF_ERROR_FORMAT;
+				}
+				if (ret) break;
+			}
+			break;
+		case DIFF_LUMP_NEW:
+			ret = copy_from_patch(out, in, rec.size);
+			break;
+		default:
+			ret = DIFF_ERROR_FORMAT;
+		}
+
+		if (!ret && (out->pos - start != rec.size)) ret = DIFF_ERROR_FORMAT;
+		dir[i].offset = rec.size ? start : 0;
+		dir[i].size = rec.size;
+		ZeroMemory(dir[i].name, sizeof(dir[i].name));
+		CopyMemory(dir[i].name, rec.name, sizeof(rec.name));
+	}
+
+	whd.directory_offset = out->pos;
+	for (i = 0; !ret && (i < hd.lump_count); ++i) {
+		out_write(out, dir + i, WAD_DENTRY_SIZE);
+	}
+	if (out_close(out, &whd, WAD_HEADER_SIZE) && !ret) ret = DIFF_ERROR_WRITE;
+
+cleanup:
+	if (in && in->fd && (in->fd != INVALID_HANDLE_VALUE)) CloseHandle(in->fd);
+	wad_reader_close(&reader);
+	diff_free(in);
+	diff_free(out);
+	diff_free(dir);
+	diff_wad_close(&old_wad);
+	return ret;
+}
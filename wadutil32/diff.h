@@ -0,0 +1,67 @@
+#ifndef DIFF_HEADER
+#define DIFF_HEADER
+
+#include "wad.h"
+#include "hash.h"
+
+#define DIFF_BLOCK_SIZE 1024
+
+enum diff_error {
+	DIFF_ERROR_ALLOC = -32,
+	DIFF_ERROR_FORMAT = -33,
+	DIFF_ERROR_BASE = -34,
+	DIFF_ERROR_WRITE = -35
+};
+
+enum diff_magic {
+	DIFF_MAGIC = LE_FOURCC('W', 'D', 'I', 'F')
+};
+
+enum diff_lump_op {
+	DIFF_LUMP_SAME, // the matching lump of the old wad
+	DIFF_LUMP_DELTA, // the matching lump patched by commands
+	DIFF_LUMP_NEW // literal bytes
+};
+
+enum diff_command {
+	DIFF_CMD_END,
+	DIFF_CMD_COPY, // offset and length within the matching old lump
+	DIFF_CMD_DATA // length, followed by literal bytes
+};
+
+struct diff_header {
+	unsigned magic;
+	int block_size;
+	enum wad_type type;
+	int lump_count;
+	int old_lump_count;
+	int reserved;
+	hash64 old_directory;
+};
+
+struct diff_lump {
+	char name[8];
+	int size;
+	enum diff_lump_op op;
+	int old_index;
+};
+
+struct diff_cmd {
+	enum diff_command cmd;
+	int offset;
+	int length;
+};
+
+struct diff_stats {
+	int same;
+	int delta;
+	int added;
+	int removed;
+	int literal_bytes;
+};
+
+int diff_make_patch(const char *old_path, const char *new_path, const char *patch_path, struct diff_stats *stats);
+int diff_make_pwad(const char *old_path, const char *new_path, const char *pwad_path, struct diff_stats *stats);
+int diff_apply(const char *old_path, const char *patch_path, const char *out_path);
+
+#endif // DIFF_HEADER
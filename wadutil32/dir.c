@@ -0,0 +1,366 @@
+#include "dir.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#undef UNICODE
+#include <windows.h>
+#else
+// the benchmarks filter with it on linux
+#include <stdlib.h>
+#endif
+#include <emmintrin.h> // SSE2
+
+#define BYTES(x) ((x) * 0x0101010101010101ULL)
+
+static void *
+grow(void *p, int size)
+{
+#ifdef _WIN32
+	return p ? HeapReAlloc(GetProcessHeap(), 0, p, size) : HeapAlloc(GetProcessHeap(), 0, size);
+#else
+	return realloc(p, size);
+#endif
+}
+
+static void
+release(void *p)
+{
+#ifdef _WIN32
+	if (p) HeapFree(GetProcessHeap(), 0, p);
+#else
+	free(p);
+#endif
+}
+
+// a-z to A-Z in all eight bytes at once, the rest left alone
+static dir_name
+fold(dir_name x)
+{
+	dir_name t = x & BYTES(0x7f);
+	dir_name from_a = t + BYTES(0x80 - 'a');
+	dir_name past_z = t + BYTES(0x80 - 'z' - 1);
+
+	return x ^ ((from_a & ~past_z & ~x & BYTES(0x80)) >> 2);
+}
+
+static dir_name
+pack(const char *name)
+{
+	dir_name packed = 0;
+	int i;
+
+	for (i = 0; (i < 8) && name[i]; ++i) {
+		packed |= (dir_name)(unsigned char)name[i] << (8 * i);
+	}
+	return packed;
+}
+
+dir_name
+dir_pack_name(const char *name)
+{
+	return fold(pack(name));
+}
+
+dir_name
+dir_fold_name(dir_name name)
+{
+	return fold(name);
+}
+
+void
+dir_unpack_name(dir_name packed, char name[8 + 1])
+{
+	int i;
+
+	for (i = 0; i < 8; ++i) {
+		name[i] = (char)(packed >> (8 * i));
+	}
+	name[8] = '\0';
+}
+
+void
+dir_init(struct dir *dir)
+{
+	dir->count = 0;
+	dir->capacity = 0;
+	dir->offsets = 0;
+	dir->sizes = 0;
+	dir->names = 0;
+	dir->sources = 0;
+	dir->lumps = 0;
+}
+
+void
+dir_free(struct dir *dir)
+{
+	release(dir->offsets);
+	release(dir->sizes);
+	release(dir->names);
+	release(dir->sources);
+	release(dir->lumps);
+	dir_init(dir);
+}
+
+int
+dir_reserve(struct dir *dir, int capacity)
+{
+	void *p;
+
+	if (capacity <= dir->capacity) return 0;
+	p = grow(dir->names, sizeof(dir_name) * capacity);
+	if (!p) return DIR_ERROR_ALLOC;
+	dir->names = (dir_name *)p;
+	p = grow(dir->offsets, sizeof(int) * capacity);
+	if (!p) return DIR_ERROR_ALLOC;
+	dir->offsets = (int *)p;
+	p = grow(dir->sizes, sizeof(int) * capacity);
+	if (!p) return DIR_ERROR_ALLOC;
+	dir->sizes = (int *)p;
+	p = grow(dir->sources, sizeof(char *) * capacity);
+	if (!p) return DIR_ERROR_ALLOC;
+	dir->sources = (char **)p;
+	p = grow(dir->lumps, sizeof(int) * capacity);
+	if (!p) return DIR_ERROR_ALLOC;
+	dir->lumps = (int *)p;
+	dir->capacity = capacity;
+	return 0;
+}
+
+int
+dir_append(struct dir *dir, const struct wad_dentry *dentry, char *source, int lump)
+{
+	if (dir->count >= dir->capacity) {
+		int ret = dir_reserve(dir, dir->capacity ? 2 * dir->capacity : 64);
+		if (ret) return ret;
+	}
+	dir->offsets[dir->count] = dentry->offset;
+	dir->sizes[dir->count] = dentry->size;
+	dir->names[dir->count] = pack(dentry->name);
+	dir->sources[dir->count] = source;
+	dir->lumps[dir->count] = lump;
+	return dir->count++;
+}
+
+void
+dir_dentry(const struct dir *dir, int i, struct wad_dentry *dentry)
+{
+	dentry->offset = dir->offsets[i];
+	dentry->size = dir->sizes[i];
+	dir_unpack_name(dir->names[i], dentry->name);
+}
+
+void
+dir_rename(struct dir *dir, int i, const char *name)
+{
+	dir->names[i] = pack(name);
+}
+
+int
+dir_remove(struct dir *dir, const char *marked)
+{
+	int i, j = 0;
+	int removed;
+
+	for (i = 0; i < dir->count; ++i) {
+		if (marked[i]) continue;
+		dir->offsets[j] = dir->offsets[i];
+		dir->sizes[j] = dir->sizes[i];
+		dir->names[j] = dir->names[i];
+		dir->sources[j] = dir->sources[i];
+		dir->lumps[j] = dir->lumps[i];
+		++j;
+	}
+	removed = dir->count - j;
+	dir->count = j;
+	return removed;
+}
+
+static void
+swap(struct dir *dir, int a, int b)
+{
+	int offset = dir->offsets[a], size = dir->sizes[a], lump = dir->lumps[a];
+	dir_name name = dir->names[a];
+	char *source = dir->sources[a];
+
+	dir->offsets[a] = dir->offsets[b];
+	dir->sizes[a] = dir->sizes[b];
+	dir->names[a] = dir->names[b];
+	dir->sources[a] = dir->sources[b];
+	dir->lumps[a] = dir->lumps[b];
+	dir->offsets[b] = offset;
+	dir->sizes[b] = size;
+	dir->names[b] = name;
+	dir->sources[b] = source;
+	dir->lumps[b] = lump;
+}
+
+// the one nearest the end goes first, so a run of them moves as a block
+int
+dir_move(struct dir *dir, char *selected, int down)
+{
+	int step = down ? 1 : -1;
+	int i = down ? dir->count - 1 : 0;
+	int moved = 0;
+
+	for (; (i >= 0) && (i < dir->count); i -= step) {
+		if (!selected[i]) continue;
+		if ((i + step < 0) || (i + step >= dir->count)) return 0;
+		swap(dir, i, i + step);
+		selected[i] = 0;
+		selected[i + step] = 1;
+		++moved;
+	}
+	return moved;
+}
+
+int
+dir_compile(struct dir_pattern *pattern, const char *text)
+{
+	int length = 0;
+	int star = 0;
+	int i;
+
+	pattern->value = 0;
+	pattern->mask = 0;
+	pattern->simple = 1;
+	for (i = 0; text[i]; ++i) {
+		char ch = text[i];
+
+		if (i >= (int)sizeof(pattern->text) - 1) return DIR_ERROR_PATTERN;
+		if ((ch >= 'a') && (ch <= 'z')) ch -= 'a' - 'A';
+		pattern->text[i] = ch;
+		if (star) {
+			pattern->simple = 0;
+		} else if (ch == '*') {
+			star = 1;
+		} else {
+			if (length >= 8) return DIR_ERROR_PATTERN;
+			if (ch != '?') {
+				pattern->value |= (dir_name)(unsigned char)ch << (8 * length);
+				pattern->mask |= (dir_name)0xff << (8 * length);
+			}
+			++length;
+		}
+	}
+	pattern->text[i] = '\0';
+
+	// without a star the name has to end where the pattern does
+	if (!star && (length < 8)) pattern->mask |= ~(dir_name)0 << (8 * length);
+	pattern->required = length ? (dir_name)0xff << (8 * (length - 1)) : 0;
+	return 0;
+}
+
+static int
+glob(const char *pattern, const char *name)
+{
+	const char *star = 0, *resume = 0;
+
+	while (*name) {
+		if ((*pattern == '?') || (*pattern == *name)) {
+			++pattern;
+			++name;
+		} else if (*pattern == '*') {
+			star = pattern++;
+			resume = name;
+		} else if (star) {
+			pattern = star + 1;
+			name = ++resume;
+		} else {
+			return 0;
+		}
+	}
+	while (*pattern == '*') ++pattern;
+	return !*pattern;
+}
+
+static int
+match_one(const struct dir_pattern *pattern, dir_name name)
+{
+	char text[8 + 1];
+
+	name = fold(name);
+	if ((name & pattern->mask) != pattern->value) return 0;
+	if (pattern->required && !(name & pattern->required)) return 0;
+	if (pattern->simple) return !0;
+	dir_unpack_name(name, text);
+	return glob(pattern->text, text);
+}
+
+// fold for two names at once
+static __m128i
+fold2(__m128i x)
+{
+	__m128i t = _mm_and_si128(x, _mm_set1_epi8(0x7f));
+	__m128i from_a = _mm_add_epi8(t, _mm_set1_epi8((char)(0x80 - 'a')));
+	__m128i past_z = _mm_add_epi8(t, _mm_set1_epi8((char)(0x80 - 'z' - 1)));
+	__m128i upper = _mm_andnot_si128(past_z, _mm_andnot_si128(x, from_a));
+
+	return _mm_xor_si128(x, _mm_srli_epi64(_mm_and_si128(upper, _mm_set1_epi8((char)0x80)), 2));
+}
+
+// two names at a time, 32 bit lanes paired up into 64 bit results
+int
+dir_match(const struct dir *dir, int first, int end, const struct dir_pattern *pattern, char *matched)
+{
+	__m128i value = _mm_set_epi32((int)(pattern->value >> 32), (int)pattern->value, (int)(pattern->value >> 32), (int)pattern->value);
+	__m128i mask = _mm_set_epi32((int)(pattern->mask >> 32), (int)pattern->mask, (int)(pattern->mask >> 32), (int)pattern->mask);
+	__m128i required = _mm_set_epi32((int)(pattern->required >> 32), (int)pattern->required, (int)(pattern->required >> 32), (int)pattern->required);
+	__m128i zero = _mm_setzero_si128();
+	int count = 0;
+	int i = first;
+
+	if (!pattern->simple) {
+		for (; i < end; ++i) {
+			matched[i] = (char)match_one(pattern, dir->names[i]);
+			count += matched[i];
+		}
+		return count;
+	}
+
+	for (; i + 2 <= end; i += 2) {
+		__m128i x = fold2(_mm_loadu_si128((const __m128i *)(dir->names + i)));
+		__m128i eq = _mm_cmpeq_epi32(_mm_and_si128(x, mask), value);
+		__m128i ok = _mm_and_si128(eq, _mm_shuffle_epi32(eq, _MM_SHUFFLE(2, 3, 0, 1)));
+		int bits;
+
+		if (pattern->required) {
+			__m128i missing = _mm_cmpeq_epi32(_mm_and_si128(x, required), zero);
+			missing = _mm_and_si128(missing, _mm_shuffle_epi32(missing, _MM_SHUFFLE(2, 3, 0, 1)));
+			ok = _mm_andnot_si128(missing, ok);
+		}
+		bits = _mm_movemask_pd(_mm_castsi128_pd(ok));
+		matched[i] = (char)(bits & 1);
+		matched[i + 1] = (char)(bits >> 1);
+		count += matched[i] + matched[i + 1];
+	}
+	for (; i < end; ++i) {
+		matched[i] = (char)match_one(pattern, dir->names[i]);
+		count += matched[i];
+	}
+	return count;
+}
+
+int
+dir_namespace_range(const struct dir *dir, int ns, int *first, int *end)
+{
+	char name[8 + 1];
+	int found = 0;
+	int is_end;
+	int i;
+
+	*first = *end = dir->count;
+	// markers are empty, so the names only need looking at for those
+	for (i = 0; i < dir->count; ++i) {
+		if (dir->sizes[i]) continue;
+		dir_unpack_name(fold(dir->names[i]), name);
+		if (wad_namespace_of_marker(name, &is_end) != ns) continue;
+		if (!is_end && !found) {
+			*first = i + 1;
+			found = 1;
+		} else if (is_end && found) {
+			*end = i;
+			break;
+		}
+	}
+	return found ? 0 : -1;
+}
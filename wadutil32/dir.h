@@ -0,0 +1,64 @@
+#ifndef DIR_HEADER
+#define DIR_HEADER
+
+#include "wad.h"
+
+// the 8 bytes of a lump name in one word, the first character lowest and
+// padded with zeros; folded to uppercase it makes a key, where equal names
+// are equal words
+typedef unsigned long long dir_name;
+
+enum dir_error {
+	DIR_ERROR_ALLOC = -176,
+	DIR_ERROR_PATTERN = -177
+};
+
+// the directory kept as columns, so a pass over the names reads 8 bytes
+// an entry instead of striding through whole dentries
+struct dir {
+	int count;
+	int capacity;
+	int *offsets;
+	int *sizes;
+	dir_name *names; // as they are in the wad, not folded
+	char **sources; // where the data comes from, 0 for the wad itself
+	int *lumps; // where it is in the wad as last loaded, -1 for added ones
+};
+
+// ? stands for any one character, * for whatever follows; anything that
+// is not just a prefix of those is matched a name at a time
+struct dir_pattern {
+	dir_name value;
+	dir_name mask;
+	dir_name required; // the last character the name must have
+	int simple;
+	char text[16];
+};
+
+// the key of a name, folded to uppercase
+dir_name dir_pack_name(const char *name);
+dir_name dir_fold_name(dir_name name);
+void dir_unpack_name(dir_name packed, char name[8 + 1]);
+
+void dir_init(struct dir *dir);
+void dir_free(struct dir *dir);
+int dir_reserve(struct dir *dir, int capacity);
+int dir_append(struct dir *dir, const struct wad_dentry *dentry, char *source, int lump);
+void dir_dentry(const struct dir *dir, int i, struct wad_dentry *dentry);
+void dir_rename(struct dir *dir, int i, const char *name);
+// drops the marked entries in one pass, keeping the order of the rest;
+// their sources are left to the caller
+int dir_remove(struct dir *dir, const char *marked);
+// moves the selected entries one place, the selection going along with
+// them; nothing moves when one of them is already at that end
+int dir_move(struct dir *dir, char *selected, int down);
+
+int dir_compile(struct dir_pattern *pattern, const char *text);
+// marks the matches among entries first to end - 1 regardless of case,
+// returns how many
+int dir_match(const struct dir *dir, int first, int end, const struct dir_pattern *pattern, char *matched);
+// finds the lumps between the markers of a namespace, end is the index of
+// the end marker or count if it is missing
+int dir_namespace_range(const struct dir *dir, int ns, int *first, int *end);
+
+#endif // DIR_HEADER
@@ -0,0 +1,286 @@
+#include "hash.h"
+#include "parallel.h"
+
+#define WIN32_LEAN_AND_MEAN
+#undef UNICODE
+#include <windows.h>
+#include <intrin.h> // __cpuid
+#include <nmmintrin.h> // SSE4.2 crc32
+
+#define HASH_BUFFER_SIZE (64 * 1024)
+
+// XXH64 by Yann Collet, see https://github.com/Cyan4973/xxHash
+
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+
+#define ROTL64(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+static hash64
+read64(const unsigned char *p)
+{
+	return (hash64)p[0] | ((hash64)p[1] << 8) | ((hash64)p[2] << 16) | ((hash64)p[3] << 24) |
+		((hash64)p[4] << 32) | ((hash64)p[5] << 40) | ((hash64)p[6] << 48) | ((hash64)p[7] << 56);
+}
+
+static unsigned
+read32(const unsigned char *p)
+{
+	return (unsigned)p[0] | ((unsigned)p[1] << 8) | ((unsigned)p[2] << 16) | ((unsigned)p[3] << 24);
+}
+
+static hash64
+xxh64_round(hash64 acc, hash64 input)
+{
+	acc += input * PRIME64_2;
+	acc = ROTL64(acc, 31);
+	return acc * PRIME64_1;
+}
+
+static hash64
+xxh64_merge(hash64 acc, hash64 val)
+{
+	acc ^= xxh64_round(0, val);
+	return acc * PRIME64_1 + PRIME64_4;
+}
+
+void
+hash_xxh64_init(struct hash_xxh64 *h, hash64 seed)
+{
+	h->v[0] = seed + PRIME64_1 + PRIME64_2;
+	h->v[1] = seed + PRIME64_2;
+	h->v[2] = seed;
+	h->v[3] = seed - PRIME64_1;
+	h->total = 0;
+	h->memsize = 0;
+}
+
+void
+hash_xxh64_update(struct hash_xxh64 *h, const void *data, int length)
+{
+	const unsigned char *p = (const unsigned char *)data;
+	const unsigned char *end = p + length;
+
+	h->total += length;
+
+	if (h->memsize + length < 32) {
+		while (p < end) h->mem[h->memsize++] = *p++;
+		return;
+	}
+
+	if (h->memsize) {
+		while (h->memsize < 32) h->mem[h->memsize++] = *p++;
+		h->v[0] = xxh64_round(h->v[0], read64(h->mem));
+		h->v[1] = xxh64_round(h->v[1], read64(h->mem + 8));
+		h->v[2] = xxh64_round(h->v[2], read64(h->mem + 16));
+		h->v[3] = xxh64_round(h->v[3], read64(h->mem + 24));
+		h->memsize = 0;
+	}
+
+	while (p + 32 <= end) {
+		h->v[0] = xxh64_round(h->v[0], read64(p));
+		h->v[1] = xxh64_round(h->v[1], read64(p + 8));
+		h->v[2] = xxh64_round(h->v[2], read64(p + 16));
+		h->v[3] = xxh64_round(h->v[3], read64(p + 24));
+		p += 32;
+	}
+
+	while (p < end) h->mem[h->memsize++] = *p++;
+}
+
+hash64
+hash_xxh64_final(const struct hash_xxh64 *h)
+{
+	const unsigned char *p = h->mem;
+	const unsigned char *end = p + h->memsize;
+	hash64 acc;
+
+	if (h->total >= 32) {
+		acc = ROTL64(h->v[0], 1) + ROTL64(h->v[1], 7) + ROTL64(h->v[2], 12) + ROTL64(h->v[3], 18);
+		acc = xxh64_merge(acc, h->v[0]);
+		acc = xxh64_merge(acc, h->v[1]);
+		acc = xxh64_merge(acc, h->v[2]);
+		acc = xxh64_merge(acc, h->v[3]);
+	} else {
+		acc = h->v[2] + PRIME64_5;
+	}
+	acc += h->total;
+
+	while (p + 8 <= end) {
+		acc ^= xxh64_round(0, read64(p));
+		acc = ROTL64(acc, 27) * PRIME64_1 + PRIME64_4;
+		p += 8;
+	}
+	if (p + 4 <= end) {
+		acc ^= (hash64)read32(p) * PRIME64_1;
+		acc = ROTL64(acc, 23) * PRIME64_2 + PRIME64_3;
+		p += 4;
+	}
+	while (p < end) {
+		acc ^= (*p++) * PRIME64_5;
+		acc = ROTL64(acc, 11) * PRIME64_1;
+	}
+
+	acc ^= acc >> 33;
+	acc *= PRIME64_2;
+	acc ^= acc >> 29;
+	acc *= PRIME64_3;
+	acc ^= acc >> 32;
+	return acc;
+}
+
+hash64
+hash_xxh64(const void *data, int length, hash64 seed)
+{
+	struct hash_xxh64 h;
+
+	hash_xxh64_init(&h, seed);
+	hash_xxh64_update(&h, data, length);
+	return hash_xxh64_final(&h);
+}
+
+static unsigned crc32c_table[256];
+static unsigned crc32_table[256];
+static int crc32c_mode; // 0: unknown, 1: table, 2: SSE4.2
+
+static void
+crc32c_init(void)
+{
+	int info[4];
+	unsigned i, j;
+
+	for (i = 0; i < 256; ++i) {
+		unsigned c = i;
+		unsigned d = i;
+		for (j = 0; j < 8; ++j) {
+			c = (c & 1) ? ((c >> 1) ^ 0x82F63B78) : (c >> 1);
+			d = (d & 1) ? ((d >> 1) ^ 0xEDB88320) : (d >> 1);
+		}
+		crc32c_table[i] = c;
+		crc32_table[i] = d;
+	}
+
+	__cpuid(info, 1);
+	crc32c_mode = (info[2] & (1 << 20)) ? 2 : 1;
+}
+
+static unsigned
+crc32c_hw(unsigned crc, const unsigned char *p, int length)
+{
+	while (length && ((unsigned)(size_t)p & 3)) {
+		crc = _mm_crc32_u8(crc, *p++);
+		--length;
+	}
+	while (length >= 4) {
+		crc = _mm_crc32_u32(crc, *(const unsigned *)p);
+		p += 4;
+		length -= 4;
+	}
+	while (length--) {
+		crc = _mm_crc32_u8(crc, *p++);
+	}
+	return crc;
+}
+
+unsigned
+hash_crc32c(unsigned crc, const void *data, int length)
+{
+	const unsigned char *p = (const unsigned char *)data;
+
+	if (!crc32c_mode) crc32c_init();
+
+	crc = ~crc;
+	if (crc32c_mode == 2) {
+		crc = crc32c_hw(crc, p, length);
+	} else {
+		while (length--) {
+			crc = crc32c_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+		}
+	}
+	return ~crc;
+}
+
+// no instruction for this polynomial, zip needs it anyway
+unsigned
+hash_crc32(unsigned crc, const void *data, int length)
+{
+	const unsigned char *p = (const unsigned char *)data;
+
+	if (!crc32c_mode) crc32c_init();
+
+	crc = ~crc;
+	while (length--) {
+		crc = crc32_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	}
+	return ~crc;
+}
+
+struct hash_job {
+	const struct wad_span *spans;
+	struct hash_lump *out;
+	int kinds;
+	struct wad_reader readers[PARALLEL_MAX_WORKERS];
+	char *bufs[PARALLEL_MAX_WORKERS];
+	volatile LONG error;
+};
+
+static void
+hash_one(void *ctx, int worker, int index)
+{
+	struct hash_job *job = (struct hash_job *)ctx;
+	const struct wad_span *span = job->spans + index;
+	struct hash_lump *out = job->out + index;
+	struct hash_xxh64 h;
+	int pos = 0;
+
+	if (job->error) return;
+	if (!job->bufs[worker]) {
+		job->bufs[worker] = (char *)HeapAlloc(GetProcessHeap(), 0, HASH_BUFFER_SIZE);
+		if (!job->bufs[worker]) {
+			job->error = HASH_ERROR_ALLOC;
+			return;
+		}
+	}
+
+	out->crc32c = 0;
+	hash_xxh64_init(&h, 0);
+	while (pos < span->size) {
+		int rd = wad_reader_read(&job->readers[worker], span, pos, job->bufs[worker], HASH_BUFFER_SIZE);
+		if (rd <= 0) {
+			job->error = rd ? rd : WAD_ERROR_FILE_READ;
+			return;
+		}
+		if (job->kinds & HASH_CRC32C) out->crc32c = hash_crc32c(out->crc32c, job->bufs[worker], rd);
+		if (job->kinds & HASH_XXH64) hash_xxh64_update(&h, job->bufs[worker], rd);
+		pos += rd;
+	}
+	out->xxh64 = (job->kinds & HASH_XXH64) ? hash_xxh64_final(&h) : 0;
+}
+
+// hashes every span on all CPUs, kinds selects the hashes to compute
+int
+hash_spans(const struct wad_span *spans, int count, int kinds, struct hash_lump *out)
+{
+	struct hash_job job;
+	int workers = parallel_workers(count);
+	int i;
+
+	if (!crc32c_mode) crc32c_init();
+
+	ZeroMemory(&job, sizeof(job));
+	job.spans = spans;
+	job.out = out;
+	job.kinds = kinds;
+	for (i = 0; i < workers; ++i) {
+		wad_reader_init(&job.readers[i]);
+	}
+	parallel_for(count, hash_one, &job);
+	for (i = 0; i < workers; ++i) {
+		wad_reader_close(&job.readers[i]);
+		if (job.bufs[i]) HeapFree(GetProcessHeap(), 0, job.bufs[i]);
+	}
+	return job.error;
+}
@@ -0,0 +1,39 @@
+#ifndef HASH_HEADER
+#define HASH_HEADER
+
+#include "wad.h"
+
+typedef unsigned long long hash64;
+
+enum hash_kind {
+	HASH_CRC32C = 1,
+	HASH_XXH64 = 2
+};
+
+enum hash_error {
+	HASH_ERROR_ALLOC = -64
+};
+
+struct hash_lump {
+	unsigned crc32c;
+	hash64 xxh64;
+};
+
+struct hash_xxh64 {
+	hash64 v[4];
+	hash64 total;
+	unsigned char mem[32];
+	int memsize;
+};
+
+void hash_xxh64_init(struct hash_xxh64 *h, hash64 seed);
+void hash_xxh64_update(struct hash_xxh64 *h, const void *data, int length);
+hash64 hash_xxh64_final(const struct hash_xxh64 *h);
+hash64 hash_xxh64(const void *data, int length, hash64 seed);
+
+unsigned hash_crc32c(unsigned crc, const void *data, int length);
+unsigned hash_crc32(unsigned crc, const void *data, int length);
+
+int hash_spans(const struct wad_span *spans, int count, int kinds, struct hash_lump *out);
+
+#endif // HASH_HEADER
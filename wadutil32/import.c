@@ -0,0 +1,202 @@
+#include "import.h"
+#include "hash.h"
+#include "parallel.h"
+#include "wad.h"
+
+#define WIN32_LEAN_AND_MEAN
+#undef UNICODE
+#include <windows.h>
+#include <stdio.h> // sprintf_s
+#include <stdlib.h> // qsort
+
+static int
+add_file(struct import_list *list, const char *folder, const WIN32_FIND_DATA *fd, int ns)
+{
+	struct import_file *f;
+	int length = lstrlen(folder) + 1 + lstrlen(fd->cFileName) + 1;
+
+	if (list->count == list->capacity) {
+		int capacity = list->capacity ? (list->capacity * 2) : 256;
+		struct import_file *p = list->files
+			? (struct import_file *)HeapReAlloc(GetProcessHeap(), 0, list->files, sizeof(struct import_file) * capacity)
+			: (struct import_file *)HeapAlloc(GetProcessHeap(), 0, sizeof(struct import_file) * capacity);
+		if (!p) return IMPORT_ERROR_ALLOC;
+		list->files = p;
+		list->capacity = capacity;
+	}
+	f = list->files + list->count;
+	f->path = (char *)HeapAlloc(GetProcessHeap(), 0, length);
+	if (!f->path) return IMPORT_ERROR_ALLOC;
+	sprintf_s(f->path, length, "%s\\%s", folder, fd->cFileName);
+	f->size = fd->nFileSizeLow;
+	f->ns = ns;
+	++list->count;
+	return 0;
+}
+
+// the directory listing already has the sizes, no file gets opened
+static int
+walk(struct import_list *list, const char *folder, int ns, int top)
+{
+	WIN32_FIND_DATA fd;
+	HANDLE h;
+	char pattern[MAX_PATH];
+	int ret = 0;
+
+	if (lstrlen(folder) + 3 > MAX_PATH) return IMPORT_ERROR_FOLDER;
+	sprintf_s(pattern, sizeof(pattern), "%s\\*", folder);
+	h = FindFirstFileEx(pattern, FindExInfoBasic, &fd, FindExSearchNameMatch, 0, FIND_FIRST_EX_LARGE_FETCH);
+	if (h == INVALID_HANDLE_VALUE) return top ? IMPORT_ERROR_FOLDER : 0;
+
+	do {
+		if (fd.dwFileAttributes & (FILE_ATTRIBUTE_HIDDEN | FILE_ATTRIBUTE_SYSTEM)) continue;
+		if (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+			char sub[MAX_PATH];
+			int sub_ns = ns;
+
+			if (!lstrcmp(fd.cFileName, ".") || !lstrcmp(fd.cFileName, "..")) continue;
+			// only the folders right below the imported one open namespaces
+			if (top) sub_ns = wad_namespace_of_folder(fd.cFileName);
+			if (lstrlen(folder) + 1 + lstrlen(fd.cFileName) >= MAX_PATH) continue;
+			sprintf_s(sub, sizeof(sub), "%s\\%s", folder, fd.cFileName);
+			ret = walk(list, sub, sub_ns, 0);
+		} else if (fd.nFileSizeHigh || (fd.nFileSizeLow > 0x7fffffff)) {
+			++list->skipped;
+		} else {
+			ret = add_file(list, folder, &fd, ns);
+		}
+	} while (!ret && FindNextFile(h, &fd));
+
+	FindClose(h);
+	return ret;
+}
+
+static int
+compare_files(const void *a, const void *b)
+{
+	const struct import_file *fa = (const struct import_file *)a;
+	const struct import_file *fb = (const struct import_file *)b;
+
+	if (fa->ns != fb->ns) return fa->ns - fb->ns;
+	return lstrcmpi(fa->path, fb->path);
+}
+
+static void
+name_file(void *ctx, int worker, int index)
+{
+	struct import_file *f = ((struct import_list *)ctx)->files + index;
+	const char *title = f->path;
+	const char *p;
+	char buf[MAX_PATH];
+	int length;
+
+	for (p = f->path; *p; ++p) {
+		if (*p == '\\') title = p + 1;
+	}
+	lstrcpyn(buf, title, sizeof(buf));
+	for (length = lstrlen(buf); length > 0; --length) {
+		if (buf[length - 1] == '.') {
+			buf[length - 1] = '\0';
+			break;
+		}
+	}
+	wad_short_name(f->name, buf);
+	if (!f->name[0]) lstrcpy(f->name, "LUMP");
+}
+
+// open addressing, returns the slot holding the name or the empty one it would go to
+static unsigned
+name_slot(const struct import_file *files, const int *table, unsigned mask, const char *name, int ns)
+{
+	unsigned i = (unsigned)hash_xxh64(name, 8, ns) & mask;
+
+	while (table[i] >= 0) {
+		const struct import_file *f = files + table[i];
+		if ((f->ns == ns) && !lstrcmp(f->name, name)) break;
+		i = (i + 1) & mask;
+	}
+	return i;
+}
+
+// the first file in path order keeps its name, later ones get a ~N suffix
+static int
+resolve_names(struct import_list *list)
+{
+	unsigned size = 2;
+	int *table, *suffixes;
+	int i;
+
+	while (size < (unsigned)list->count * 2) size *= 2;
+	table = (int *)HeapAlloc(GetProcessHeap(), 0, sizeof(int) * size);
+	// the last suffix handed out for each name, so long runs of one name stay linear
+	suffixes = (int *)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(int) * (list->count + 1));
+	if (!table || !suffixes) {
+		if (table) HeapFree(GetProcessHeap(), 0, table);
+		if (suffixes) HeapFree(GetProcessHeap(), 0, suffixes);
+		return IMPORT_ERROR_ALLOC;
+	}
+	for (i = 0; i < (int)size; ++i) {
+		table[i] = -1;
+	}
+
+	for (i = 0; i < list->count; ++i) {
+		struct import_file *f = list->files + i;
+		unsigned slot = name_slot(list->files, table, size - 1, f->name, f->ns);
+		int owner = table[slot];
+
+		// names made by wad_short_name never hold a ~, so the suffixed ones cannot clash with them
+		while (table[slot] >= 0) {
+			char suffix[16];
+			char name[8 + 1];
+
+			sprintf_s(suffix, sizeof(suffix), "~%d", ++suffixes[owner]);
+			ZeroMemory(name, sizeof(name));
+			lstrcpyn(name, f->name, 8 - lstrlen(suffix) + 1);
+			lstrcat(name, suffix);
+			slot = name_slot(list->files, table, size - 1, name, f->ns);
+			if (table[slot] < 0) CopyMemory(f->name, name, sizeof(name));
+		}
+		table[slot] = i;
+	}
+
+	HeapFree(GetProcessHeap(), 0, table);
+	HeapFree(GetProcessHeap(), 0, suffixes);
+	return 0;
+}
+
+int
+import_scan(const char *folder, struct import_list *list)
+{
+	int ret;
+	int i;
+
+	ZeroMemory(list, sizeof(*list));
+	ret = walk(list, folder, 0, !0);
+	if (ret) goto fail;
+
+	qsort(list->files, list->count, sizeof(struct import_file), compare_files);
+	parallel_for(list->count, name_file, list);
+	ret = resolve_names(list);
+	if (ret) goto fail;
+
+	for (i = 0; i < list->count; ++i) {
+		if (list->files[i].ns && (!i || (list->files[i - 1].ns != list->files[i].ns))) list->markers += 2;
+	}
+	return 0;
+
+fail:
+	import_free(list);
+	return ret;
+}
+
+void
+import_free(struct import_list *list)
+{
+	int i;
+
+	for (i = 0; i < list->count; ++i) {
+		if (list->files[i].path) HeapFree(GetProcessHeap(), 0, list->files[i].path);
+	}
+	if (list->files) HeapFree(GetProcessHeap(), 0, list->files);
+	ZeroMemory(list, sizeof(*list));
+}
@@ -0,0 +1,28 @@
+#ifndef IMPORT_HEADER
+#define IMPORT_HEADER
+
+enum import_error {
+	IMPORT_ERROR_ALLOC = -112,
+	IMPORT_ERROR_FOLDER = -113
+};
+
+struct import_file {
+	char *path; // heap allocated, whoever takes it sets this to 0
+	int size;
+	int ns; // 0 outside of any namespace
+	char name[8 + 1];
+};
+
+// files come sorted by namespace and then by path
+struct import_list {
+	struct import_file *files;
+	int count;
+	int capacity;
+	int markers; // lumps needed to open and close the namespaces used
+	int skipped; // too big for a wad
+};
+
+int import_scan(const char *folder, struct import_list *list);
+void import_free(struct import_list *list);
+
+#endif // IMPORT_HEADER
@@ -0,0 +1,177 @@
+#include "layout.h"
+#include "wad.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#undef UNICODE
+#include <windows.h>
+#else
+// the benchmarks plan with it on linux
+#include <string.h>
+
+#define HeapAlloc(heap, flags, size) malloc(size)
+#define HeapFree(heap, flags, p) free(p)
+#define ZeroMemory(p, size) memset((p), 0, (size))
+#endif
+#include <stdlib.h> // qsort
+
+struct gap {
+	int offset;
+	int size;
+	int next; // the next gap of the same size, -1 at the end
+};
+
+// the gaps are kept in a list per size, and a tree over the sizes below the
+// alignment counts them, so the smallest one that fits is found in log steps
+struct gap_sizes {
+	int *heads;
+	int *tree; // node i covers nodes 2i and 2i + 1, leaf alignment + size
+	int alignment;
+};
+
+struct layout_key {
+	int size;
+	int index;
+};
+
+// biggest first packs the gaps tightest
+static int
+compare_keys(const void *a, const void *b)
+{
+	const struct layout_key *ka = (const struct layout_key *)a;
+	const struct layout_key *kb = (const struct layout_key *)b;
+
+	if (ka->size != kb->size) return (ka->size < kb->size) ? 1 : -1;
+	return ka->index - kb->index;
+}
+
+static void
+put_gap(struct gap_sizes *sizes, struct gap *gaps, int g)
+{
+	int i;
+
+	gaps[g].next = sizes->heads[gaps[g].size];
+	sizes->heads[gaps[g].size] = g;
+	for (i = sizes->alignment + gaps[g].size; i; i >>= 1) {
+		++sizes->tree[i];
+	}
+}
+
+// the smallest gap that still fits wastes the least, -1 when none does
+static int
+take_gap(struct gap_sizes *sizes, struct gap *gaps, int size)
+{
+	int i = sizes->alignment + size;
+	int g;
+
+	if (size >= sizes->alignment) return -1;
+	// up until a right sibling has gaps, then down its leftmost path
+	while (!sizes->tree[i]) {
+		while ((i > 1) && ((i & 1) || !sizes->tree[i + 1])) i >>= 1;
+		if (i <= 1) return -1;
+		++i;
+	}
+	while (i < sizes->alignment) {
+		i <<= 1;
+		if (!sizes->tree[i]) ++i;
+	}
+	g = sizes->heads[i - sizes->alignment];
+	sizes->heads[gaps[g].size] = gaps[g].next;
+	for (; i; i >>= 1) {
+		--sizes->tree[i];
+	}
+	return g;
+}
+
+static int
+blocks(int offset, int size, int alignment)
+{
+	if (!size) return 0;
+	return ((offset & (alignment - 1)) + size + alignment - 1) / alignment;
+}
+
+int
+layout_plan(const int *sizes, int count, const struct layout_options *options, int *offsets, int *directory_offset, struct layout_stats *stats)
+{
+	int alignment = options->alignment;
+	struct gap *gaps = 0;
+	struct gap_sizes gap_sizes;
+	struct layout_key *keys = 0;
+	int gap_count = 0, key_count = 0;
+	int before = WAD_HEADER_SIZE;
+	int cursor = WAD_HEADER_SIZE + WAD_DENTRY_SIZE * count;
+	int payload = cursor;
+	int ret = LAYOUT_ERROR_ALLOC;
+	int i, g;
+
+	ZeroMemory(stats, sizeof(*stats));
+	if ((alignment <= 0) || (alignment & (alignment - 1))) return LAYOUT_ERROR_ALIGNMENT;
+
+	gap_sizes.alignment = alignment;
+	gap_sizes.heads = (int *)HeapAlloc(GetProcessHeap(), 0, sizeof(int) * alignment);
+	gap_sizes.tree = (int *)HeapAlloc(GetProcessHeap(), 0, sizeof(int) * 2 * alignment);
+	gaps = (struct gap *)HeapAlloc(GetProcessHeap(), 0, sizeof(struct gap) * (count + 1));
+	keys = (struct layout_key *)HeapAlloc(GetProcessHeap(), 0, sizeof(struct layout_key) * (count + 1));
+	if (!gap_sizes.heads || !gap_sizes.tree || !gaps || !keys) goto cleanup;
+	ZeroMemory(gap_sizes.tree, sizeof(int) * 2 * alignment);
+	for (i = 0; i < alignment; ++i) {
+		gap_sizes.heads[i] = -1;
+	}
+
+	*directory_offset = WAD_HEADER_SIZE;
+	for (i = 0; i < count; ++i) {
+		int size = sizes[i];
+
+		payload += size;
+		offsets[i] = 0;
+		if (size && (size >= options->threshold)) {
+			int start = (cursor + alignment - 1) & ~(alignment - 1);
+
+			if (start > cursor) {
+				gaps[gap_count].offset = cursor;
+				gaps[gap_count++].size = start - cursor;
+			}
+			offsets[i] = start;
+			cursor = start + size;
+			stats->pages_before += blocks(before, size, alignment);
+			stats->pages_after += blocks(start, size, alignment);
+			++stats->aligned;
+		} else if (size) {
+			keys[key_count].size = size;
+			keys[key_count++].index = i;
+		}
+		before += size;
+	}
+
+	// backwards, so of the gaps with the same size the first one goes first
+	for (i = gap_count - 1; i >= 0; --i) {
+		put_gap(&gap_sizes, gaps, i);
+	}
+	qsort(keys, key_count, sizeof(struct layout_key), compare_keys);
+	for (i = 0; i < key_count; ++i) {
+		g = take_gap(&gap_sizes, gaps, keys[i].size);
+		if (g < 0) continue;
+		offsets[keys[i].index] = gaps[g].offset;
+		gaps[g].offset += keys[i].size;
+		gaps[g].size -= keys[i].size;
+		if (gaps[g].size) put_gap(&gap_sizes, gaps, g);
+		++stats->packed;
+	}
+
+	// what did not fit goes to the end in directory order
+	for (i = 0; i < count; ++i) {
+		if (sizes[i] && !offsets[i]) {
+			offsets[i] = cursor;
+			cursor += sizes[i];
+		}
+	}
+
+	stats->padding = cursor - payload;
+	ret = cursor;
+cleanup:
+	if (gap_sizes.heads) HeapFree(GetProcessHeap(), 0, gap_sizes.heads);
+	if (gap_sizes.tree) HeapFree(GetProcessHeap(), 0, gap_sizes.tree);
+	if (gaps) HeapFree(GetProcessHeap(), 0, gaps);
+	if (keys) HeapFree(GetProcessHeap(), 0, keys);
+	return ret;
+}
@@ -0,0 +1,26 @@
+#ifndef LAYOUT_HEADER
+#define LAYOUT_HEADER
+
+enum layout_error {
+	LAYOUT_ERROR_ALLOC = -96,
+	LAYOUT_ERROR_ALIGNMENT = -97
+};
+
+struct layout_options {
+	int alignment; // a power of two
+	int threshold; // lumps at least this big start on a boundary
+};
+
+struct layout_stats {
+	int aligned;
+	int packed; // small lumps that went into padding
+	int padding; // bytes the file grew by
+	int pages_before; // blocks touched reading the big lumps back to back
+	int pages_after;
+};
+
+// places the directory right after the header and the lumps behind it,
+// offsets[i] is 0 for empty lumps, returns the file size or an error
+int layout_plan(const int *sizes, int count, const struct layout_options *options, int *offsets, int *directory_offset, struct layout_stats *stats);
+
+#endif // LAYOUT_HEADER
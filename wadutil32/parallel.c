@@ -0,0 +1,112 @@
+#include "parallel.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#undef UNICODE
+#include <windows.h>
+#else
+// the benchmarks run it on linux
+#include <pthread.h>
+#include <unistd.h>
+
+typedef long LONG;
+#endif
+
+struct parallel_job {
+	parallel_fn fn;
+	void *ctx;
+	int count;
+	volatile LONG next;
+};
+
+struct parallel_worker {
+	struct parallel_job *job;
+	int id;
+};
+
+int
+parallel_workers(int count)
+{
+	int n;
+#ifdef _WIN32
+	SYSTEM_INFO si;
+
+	GetSystemInfo(&si);
+	n = si.dwNumberOfProcessors;
+#else
+	n = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	if (n > PARALLEL_MAX_WORKERS) n = PARALLEL_MAX_WORKERS;
+	if (n > count) n = count;
+	if (n < 1) n = 1;
+	return n;
+}
+
+#ifdef _WIN32
+static DWORD WINAPI
+parallel_thread(LPVOID param)
+#else
+static void *
+parallel_thread(void *param)
+#endif
+{
+	struct parallel_worker *w = (struct parallel_worker *)param;
+	struct parallel_job *job = w->job;
+
+	for (;;) {
+#ifdef _WIN32
+		int i = InterlockedIncrement(&job->next) - 1;
+#else
+		int i = (int)__sync_fetch_and_add(&job->next, 1);
+#endif
+		if (i >= job->count) break;
+		job->fn(job->ctx, w->id, i);
+	}
+	return 0;
+}
+
+void
+parallel_for(int count, parallel_fn fn, void *ctx)
+{
+	struct parallel_job job;
+	struct parallel_worker workers[PARALLEL_MAX_WORKERS];
+#ifdef _WIN32
+	HANDLE threads[PARALLEL_MAX_WORKERS];
+#else
+	pthread_t threads[PARALLEL_MAX_WORKERS];
+#endif
+	int n = parallel_workers(count);
+	int started = 0;
+	int i;
+
+	job.fn = fn;
+	job.ctx = ctx;
+	job.count = count;
+	job.next = 0;
+
+	// worker 0 is the calling thread, so a failed CreateThread only costs speed
+	for (i = 0; i < n; ++i) {
+		workers[i].job = &job;
+		workers[i].id = i;
+	}
+	for (i = 1; i < n; ++i) {
+#ifdef _WIN32
+		HANDLE t = CreateThread(0, 0, parallel_thread, &workers[i], 0, 0);
+		if (t) threads[started++] = t;
+#else
+		if (!pthread_create(&threads[started], 0, parallel_thread, &workers[i])) ++started;
+#endif
+	}
+	parallel_thread(&workers[0]);
+
+#ifdef _WIN32
+	if (started) WaitForMultipleObjects(started, threads, TRUE, INFINITE);
+	for (i = 0; i < started; ++i) {
+		CloseHandle(threads[i]);
+	}
+#else
+	for (i = 0; i < started; ++i) {
+		pthread_join(threads[i], 0);
+	}
+#endif
+}
@@ -0,0 +1,12 @@
+#ifndef PARALLEL_HEADER
+#define PARALLEL_HEADER
+
+#define PARALLEL_MAX_WORKERS 32
+
+// called once for every index, worker tells which thread runs it
+typedef void (*parallel_fn)(void *ctx, int worker, int index);
+
+int parallel_workers(int count);
+void parallel_for(int count, parallel_fn fn, void *ctx);
+
+#endif // PARALLEL_HEADER
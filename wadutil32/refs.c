@@ -0,0 +1,674 @@
+#include "refs.h"
+#include "parallel.h"
+
+#define WIN32_LEAN_AND_MEAN
+#undef UNICODE
+#include <windows.h>
+
+#define SIDEDEF_SIZE 30
+#define SECTOR_SIZE 26
+#define ANIMATED_SIZE 23
+#define SWITCHES_SIZE 20
+
+enum namespace {
+	NS_FLATS = 1,
+	NS_PATCHES = 3
+};
+
+static const char *map_lumps[] = {
+	"THINGS", "LINEDEFS", "SIDEDEFS", "VERTEXES", "SEGS", "SSECTORS",
+	"NODES", "SECTORS", "REJECT", "BLOCKMAP", "BEHAVIOR", "SCRIPTS", 0
+};
+
+// every word of these that could be a lump name is taken for a use, which
+// keeps more than needed but never drops what a port looks up by name
+static const char *text_lumps[] = {
+	"TEXTMAP", "TEXTURES", "ANIMDEFS", "MAPINFO", "ZMAPINFO", "UMAPINFO",
+	"EMAPINFO", "DECORATE", "ZSCRIPT", "TERRAIN", "GLDEFS", "HIRESTEX", 0
+};
+
+// the engine looks these up itself: the sky, and the flats it animates
+// without an ANIMATED lump, of which a wad may replace single frames
+static const char *always_used[] = {
+	"F_SKY1", "SKY1", "SKY2", "SKY3", "SKY4",
+	"NUKAGE1", "NUKAGE2", "NUKAGE3",
+	"FWATER1", "FWATER2", "FWATER3", "FWATER4",
+	"SWATER1", "SWATER2", "SWATER3", "SWATER4",
+	"LAVA1", "LAVA2", "LAVA3", "LAVA4",
+	"BLOOD1", "BLOOD2", "BLOOD3",
+	"RROCK05", "RROCK06", "RROCK07", "RROCK08",
+	"SLIME01", "SLIME02", "SLIME03", "SLIME04", "SLIME05", "SLIME06",
+	"SLIME07", "SLIME08", "SLIME09", "SLIME10", "SLIME11", "SLIME12",
+	0
+};
+
+// first and last frame, everything defined between them cycles along
+static const char *animated_textures[] = {
+	"BLODGR1", "BLODGR4", "SLADRIP1", "SLADRIP3", "BLODRIP1", "BLODRIP4",
+	"FIREWALA", "FIREWALL", "GSTFONT1", "GSTFONT3", "FIRELAV3", "FIRELAVA",
+	"FIREMAG1", "FIREMAG3", "FIREBLU1", "FIREBLU2", "ROCKRED1", "ROCKRED3",
+	"BFALL1", "BFALL4", "SFALL1", "SFALL4", "WFALL1", "WFALL4",
+	"DBRAIN1", "DBRAIN4", 0
+};
+
+static unsigned
+get16(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static unsigned
+get32(const unsigned char *p)
+{
+	return get16(p) | (get16(p + 2) << 16);
+}
+
+// names to every index holding them, chained through next
+struct table {
+	const dir_name *names;
+	int *heads;
+	int *next;
+	unsigned mask;
+};
+
+static unsigned
+bucket(const struct table *table, dir_name name)
+{
+	return (unsigned)((name * 0x9E3779B97F4A7C15ULL) >> 40) & table->mask;
+}
+
+static int
+table_init(struct table *table, const dir_name *names, int first, int end)
+{
+	unsigned size = 16;
+	int i;
+
+	while (size < 2 * (unsigned)(end - first)) size *= 2;
+	table->names = names;
+	table->mask = size - 1;
+	table->heads = (int *)HeapAlloc(GetProcessHeap(), 0, sizeof(int) * size);
+	table->next = (int *)HeapAlloc(GetProcessHeap(), 0, sizeof(int) * (end + 1));
+	if (!table->heads || !table->next) return REFS_ERROR_ALLOC;
+	FillMemory(table->heads, sizeof(int) * size, 0xff);
+	// backwards, so that a chain runs in directory order
+	for (i = end - 1; i >= first; --i) {
+		unsigned b = bucket(table, names[i]);
+		table->next[i] = table->heads[b];
+		table->heads[b] = i;
+	}
+	return 0;
+}
+
+static void
+table_free(struct table *table)
+{
+	if (table->heads) HeapFree(GetProcessHeap(), 0, table->heads);
+	if (table->next) HeapFree(GetProcessHeap(), 0, table->next);
+}
+
+static int
+table_find(const struct table *table, dir_name name)
+{
+	int i = table->heads[bucket(table, name)];
+
+	while ((i >= 0) && (table->names[i] != name)) i = table->next[i];
+	return i;
+}
+
+static int
+table_next(const struct table *table, int i)
+{
+	dir_name name = table->names[i];
+
+	for (i = table->next[i]; (i >= 0) && (table->names[i] != name); i = table->next[i]);
+	return i;
+}
+
+struct refs_job {
+	const struct wad_span *spans;
+	const dir_name *names;
+	int count;
+	struct table flats;
+	struct table patches;
+	struct table textures;
+	int texture_count;
+	const int *units; // first and end lump of each map or text lump
+	char *lump_marks; // a row of count per worker, folded into the first
+	char *texture_marks;
+	struct wad_reader readers[PARALLEL_MAX_WORKERS];
+	volatile LONG error;
+};
+
+// a name is looked for among textures, flats and patches alike, as ports
+// let walls and floors use either
+static void
+mark(struct refs_job *job, int worker, dir_name name)
+{
+	char *lumps = job->lump_marks + worker * job->count;
+	char *textures = job->texture_marks + worker * job->texture_count;
+	int i;
+
+	for (i = table_find(&job->textures, name); i >= 0; i = table_next(&job->textures, i)) {
+		textures[i] = 1;
+	}
+	for (i = table_find(&job->flats, name); i >= 0; i = table_next(&job->flats, i)) {
+		lumps[i] = 1;
+	}
+	for (i = table_find(&job->patches, name); i >= 0; i = table_next(&job->patches, i)) {
+		lumps[i] = 1;
+	}
+}
+
+static int
+is_word(char ch)
+{
+	unsigned char c = (unsigned char)ch;
+
+	if ((c <= ' ') || (c >= 0x7f)) return 0;
+	switch (c) {
+	case '"': case '\'': case ',': case ';': case '=':
+	case '(': case ')': case '{': case '}':
+		return 0;
+	}
+	return !0;
+}
+
+static void
+scan_text(struct refs_job *job, int worker, const char *text, int size)
+{
+	char name[8 + 1];
+	int i = 0;
+
+	while (i < size) {
+		int start;
+
+		while ((i < size) && !is_word(text[i])) ++i;
+		start = i;
+		while ((i < size) && is_word(text[i])) ++i;
+		if ((i > start) && (i - start <= 8)) {
+			CopyMemory(name, text + start, i - start);
+			name[i - start] = '\0';
+			mark(job, worker, dir_pack_name(name));
+		}
+	}
+}
+
+// compiled scripts keep their strings zero terminated
+static void
+scan_strings(struct refs_job *job, int worker, const char *data, int size)
+{
+	int i = 0;
+
+	while (i < size) {
+		int start = i;
+
+		while ((i < size) && is_word(data[i])) ++i;
+		if ((i < size) && !data[i] && (i > start) && (i - start <= 8)) {
+			mark(job, worker, dir_pack_name(data + start));
+		}
+		++i;
+	}
+}
+
+static int
+is_name(dir_name name, const char *text)
+{
+	return name == dir_pack_name(text);
+}
+
+static int
+is_listed(dir_name name, const char **list)
+{
+	int i;
+
+	for (i = 0; list[i]; ++i) {
+		if (is_name(name, list[i])) return !0;
+	}
+	return 0;
+}
+
+// the whole lump and a zero after it
+static char *
+read_lump(struct wad_reader *reader, const struct wad_span *span, int *error)
+{
+	char *data = (char *)HeapAlloc(GetProcessHeap(), 0, span->size + 1);
+	int pos = 0;
+
+	if (!data) {
+		*error = REFS_ERROR_ALLOC;
+		return 0;
+	}
+	while (pos < span->size) {
+		int rd = wad_reader_read(reader, span, pos, data + pos, span->size - pos);
+		if (rd <= 0) {
+			*error = rd ? rd : WAD_ERROR_FILE_READ;
+			HeapFree(GetProcessHeap(), 0, data);
+			return 0;
+		}
+		pos += rd;
+	}
+	data[pos] = '\0';
+	return data;
+}
+
+static void
+scan_unit(void *ctx, int worker, int index)
+{
+	struct refs_job *job = (struct refs_job *)ctx;
+	int i;
+
+	for (i = job->units[2 * index]; i < job->units[2 * index + 1]; ++i) {
+		const struct wad_span *span = job->spans + i;
+		dir_name name = job->names[i];
+		char *data;
+		int error = 0;
+		int j;
+
+		if (job->error) return;
+		if (!span->size) continue;
+		if (!is_name(name, "SIDEDEFS") && !is_name(name, "SECTORS") && !is_name(name, "BEHAVIOR") && !is_listed(name, text_lumps)) continue;
+
+		data = read_lump(&job->readers[worker], span, &error);
+		if (!data) {
+			job->error = error;
+			return;
+		}
+		if (is_name(name, "SIDEDEFS")) {
+			// upper, lower and middle texture
+			for (j = 0; j + SIDEDEF_SIZE <= span->size; j += SIDEDEF_SIZE) {
+				mark(job, worker, dir_pack_name(data + j + 4));
+				mark(job, worker, dir_pack_name(data + j + 12));
+				mark(job, worker, dir_pack_name(data + j + 20));
+			}
+		} else if (is_name(name, "SECTORS")) {
+			// floor and ceiling flat
+			for (j = 0; j + SECTOR_SIZE <= span->size; j += SECTOR_SIZE) {
+				mark(job, worker, dir_pack_name(data + j + 4));
+				mark(job, worker, dir_pack_name(data + j + 12));
+			}
+		} else if (is_name(name, "BEHAVIOR")) {
+			scan_strings(job, worker, data, span->size);
+		} else {
+			scan_text(job, worker, data, span->size);
+		}
+		HeapFree(GetProcessHeap(), 0, data);
+	}
+}
+
+// how many patches the textures of a TEXTURE lump have, or -1 if they do
+// not fit in the doom layout or in strife's, which leaves out the column
+// directory and two fields of each patch
+static int
+textures_fit(const unsigned char *data, int size, int strife)
+{
+	int total = 0;
+	int count, i;
+
+	if (size < 4) return -1;
+	count = (int)get32(data);
+	if ((count < 0) || (count > (size - 4) / 4)) return -1;
+	for (i = 0; i < count; ++i) {
+		int offset = (int)get32(data + 4 + 4 * i);
+		int at = strife ? 16 : 20;
+		int patches;
+
+		if ((offset < 0) || (offset > size - at - 2)) return -1;
+		patches = (int)get16(data + offset + at);
+		if (patches * (strife ? 6 : 10) > size - offset - at - 2) return -1;
+		// textures may share their data, so this can outgrow the lump
+		if (total > 0x7fffffff - patches) return -1;
+		total += patches;
+	}
+	return total;
+}
+
+struct textures {
+	dir_name *names;
+	int *first; // into refs, the PNAMES indices of its patches
+	int *count;
+	int *refs;
+	int texture_count;
+	int ref_count;
+	int ref_capacity;
+};
+
+static int
+parse_textures(struct textures *out, const unsigned char *data, int size, int pname_count)
+{
+	int strife = 0;
+	int total, count, i, j;
+
+	if ((total = textures_fit(data, size, 0)) < 0) {
+		if ((total = textures_fit(data, size, !0)) < 0) return REFS_ERROR_FORMAT;
+		strife = !0;
+	}
+	if (out->ref_count + total + 1 > out->ref_capacity) {
+		int capacity = out->ref_count + total + 1;
+		int *p = out->refs
+			? (int *)HeapReAlloc(GetProcessHeap(), 0, out->refs, sizeof(int) * capacity)
+			: (int *)HeapAlloc(GetProcessHeap(), 0, sizeof(int) * capacity);
+		if (!p) return REFS_ERROR_ALLOC;
+		out->refs = p;
+		out->ref_capacity = capacity;
+	}
+	count = (int)get32(data);
+	for (i = 0; i < count; ++i) {
+		const unsigned char *t = data + get32(data + 4 + 4 * i);
+		const unsigned char *patch = t + (strife ? 18 : 22);
+		int patches = (int)get16(t + (strife ? 16 : 20));
+		int k = out->texture_count++;
+
+		out->names[k] = dir_pack_name((const char *)t);
+		out->first[k] = out->ref_count;
+		for (j = 0; j < patches; ++j, patch += strife ? 6 : 10) {
+			int index = (short)get16(patch + 4);
+			if ((index >= 0) && (index < pname_count)) out->refs[out->ref_count++] = index;
+		}
+		out->count[k] = out->ref_count - out->first[k];
+	}
+	return 0;
+}
+
+// a used frame makes the whole cycle used, in lump order for flats and in
+// definition order for textures
+static void
+animate(struct refs_job *job, dir_name first_name, dir_name last_name, int texture)
+{
+	const struct table *table = texture ? &job->textures : &job->flats;
+	char *marks = texture ? job->texture_marks : job->lump_marks;
+	int first = table_find(table, first_name);
+	int last = table_find(table, last_name);
+	int used = 0;
+	int i;
+
+	if ((first < 0) || (last < 0)) return;
+	if (first > last) {
+		i = first;
+		first = last;
+		last = i;
+	}
+	for (i = first; i <= last; ++i) used |= marks[i];
+	if (!used) return;
+	for (i = first; i <= last; ++i) marks[i] = 1;
+}
+
+// both sides of a switch are used when either is
+static void
+pair_switch(struct refs_job *job, dir_name a, dir_name b)
+{
+	int i = table_find(&job->textures, a);
+	int j = table_find(&job->textures, b);
+
+	if ((i >= 0) && (j >= 0) && (job->texture_marks[i] || job->texture_marks[j])) {
+		mark(job, 0, a);
+		mark(job, 0, b);
+	}
+}
+
+static int
+find_last(const dir_name *names, int count, const char *name)
+{
+	dir_name packed = dir_pack_name(name);
+	int i;
+
+	for (i = count - 1; i >= 0; --i) {
+		if (names[i] == packed) return i;
+	}
+	return -1;
+}
+
+int
+refs_build(struct refs *refs, enum wad_type type, const struct wad_dentry *dentries, const struct wad_span *spans, int count)
+{
+	struct refs_job job;
+	struct textures textures;
+	struct dir dir;
+	struct wad_reader reader;
+	unsigned char *data = 0;
+	dir_name *pnames = 0;
+	char *named = 0;
+	int *units = 0;
+	int unit_count = 0;
+	int pname_count = 0;
+	int flat_first, flat_end, patch_first, patch_end;
+	int lumps[3];
+	int workers;
+	int ret;
+	int i, j, w;
+
+	ZeroMemory(refs, sizeof(*refs));
+	ZeroMemory(&job, sizeof(job));
+	ZeroMemory(&textures, sizeof(textures));
+	dir_init(&dir);
+	wad_reader_init(&reader);
+
+	ret = REFS_ERROR_ALLOC;
+	if (dir_reserve(&dir, count + 1)) goto cleanup;
+	// compared as keys from here on
+	for (i = 0; i < count; ++i) {
+		dir_append(&dir, dentries + i, 0, i);
+		dir.names[i] = dir_fold_name(dir.names[i]);
+	}
+	if (dir_namespace_range(&dir, NS_FLATS, &flat_first, &flat_end)) flat_first = flat_end = 0;
+	if (dir_namespace_range(&dir, NS_PATCHES, &patch_first, &patch_end)) patch_first = patch_end = 0;
+
+	// the last of each wins, as it does in the engine
+	lumps[0] = find_last(dir.names, count, "PNAMES");
+	lumps[1] = find_last(dir.names, count, "TEXTURE1");
+	lumps[2] = find_last(dir.names, count, "TEXTURE2");
+	if (lumps[0] >= 0) {
+		data = (unsigned char *)read_lump(&reader, spans + lumps[0], &ret);
+		if (!data) goto cleanup;
+		ret = REFS_ERROR_FORMAT;
+		if (spans[lumps[0]].size < 4) goto cleanup;
+		pname_count = (int)get32(data);
+		if ((pname_count < 0) || (pname_count > (spans[lumps[0]].size - 4) / 8)) goto cleanup;
+		ret = REFS_ERROR_ALLOC;
+		pnames = (dir_name *)HeapAlloc(GetProcessHeap(), 0, sizeof(dir_name) * (pname_count + 1));
+		if (!pnames) goto cleanup;
+		for (i = 0; i < pname_count; ++i) {
+			pnames[i] = dir_pack_name((const char *)data + 4 + 8 * i);
+		}
+		HeapFree(GetProcessHeap(), 0, data);
+		data = 0;
+	}
+	// room for the most textures the lumps could hold
+	j = 1;
+	for (i = 1; i < 3; ++i) {
+		if (lumps[i] >= 0) j += spans[lumps[i]].size / 4;
+	}
+	textures.names = (dir_name *)HeapAlloc(GetProcessHeap(), 0, sizeof(dir_name) * j);
+	textures.first = (int *)HeapAlloc(GetProcessHeap(), 0, sizeof(int) * j);
+	textures.count = (int *)HeapAlloc(GetProcessHeap(), 0, sizeof(int) * j);
+	if (!textures.names || !textures.first || !textures.count) goto cleanup;
+	for (i = 1; i < 3; ++i) {
+		if (lumps[i] < 0) continue;
+		data = (unsigned char *)read_lump(&reader, spans + lumps[i], &ret);
+		if (!data) goto cleanup;
+		ret = parse_textures(&textures, data, spans[lumps[i]].size, pname_count);
+		if (ret) goto cleanup;
+		HeapFree(GetProcessHeap(), 0, data);
+		data = 0;
+	}
+
+	// a map is its header and the lumps after it, the text lumps go alone
+	ret = REFS_ERROR_ALLOC;
+	units = (int *)HeapAlloc(GetProcessHeap(), 0, sizeof(int) * 2 * (count + 1));
+	if (!units) goto cleanup;
+	for (i = 0; i < count; ++i) {
+		if ((i + 1 < count) && (is_name(dir.names[i + 1], "THINGS") || is_name(dir.names[i + 1], "TEXTMAP"))) {
+			j = i + 1;
+			if (is_name(dir.names[j], "TEXTMAP")) {
+				while ((j < count) && !is_name(dir.names[j], "ENDMAP")) ++j;
+			} else {
+				while ((j < count) && is_listed(dir.names[j], map_lumps)) ++j;
+			}
+			units[2 * unit_count] = i + 1;
+			units[2 * unit_count + 1] = j;
+			++unit_count;
+			++refs->maps;
+			i = j - 1;
+		} else if (is_listed(dir.names[i], text_lumps)) {
+			units[2 * unit_count] = i;
+			units[2 * unit_count + 1] = i + 1;
+			++unit_count;
+		}
+	}
+
+	workers = parallel_workers(unit_count);
+	job.spans = spans;
+	job.names = dir.names;
+	job.count = count;
+	job.texture_count = textures.texture_count;
+	job.units = units;
+	if (table_init(&job.flats, dir.names, flat_first, flat_end)) goto cleanup;
+	if (table_init(&job.patches, dir.names, patch_first, patch_end)) goto cleanup;
+	if (table_init(&job.textures, textures.names, 0, textures.texture_count)) goto cleanup;
+	job.lump_marks = (char *)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, workers * count + 1);
+	job.texture_marks = (char *)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, workers * textures.texture_count + 1);
+	if (!job.lump_marks || !job.texture_marks) goto cleanup;
+	for (i = 0; i < workers; ++i) {
+		wad_reader_init(&job.readers[i]);
+	}
+	parallel_for(unit_count, scan_unit, &job);
+	for (i = 0; i < workers; ++i) {
+		wad_reader_close(&job.readers[i]);
+	}
+	ret = job.error;
+	if (ret) goto cleanup;
+	for (w = 1; w < workers; ++w) {
+		for (i = 0; i < count; ++i) {
+			job.lump_marks[i] |= job.lump_marks[w * count + i];
+		}
+		for (i = 0; i < textures.texture_count; ++i) {
+			job.texture_marks[i] |= job.texture_marks[w * textures.texture_count + i];
+		}
+	}
+
+	for (i = 0; always_used[i]; ++i) {
+		mark(&job, 0, dir_pack_name(always_used[i]));
+	}
+	// texture 0 stands for no texture at all
+	if (textures.texture_count) job.texture_marks[0] = 1;
+	for (i = 0; animated_textures[i]; i += 2) {
+		animate(&job, dir_pack_name(animated_textures[i]), dir_pack_name(animated_textures[i + 1]), !0);
+	}
+	if ((j = find_last(dir.names, count, "ANIMATED")) >= 0) {
+		data = (unsigned char *)read_lump(&reader, spans + j, &ret);
+		if (!data) goto cleanup;
+		for (i = 0; (i + ANIMATED_SIZE <= spans[j].size) && (data[i] != 0xff); i += ANIMATED_SIZE) {
+			// the last frame comes first
+			char last[8 + 1], first[8 + 1];
+
+			CopyMemory(last, data + i + 1, 8);
+			CopyMemory(first, data + i + 10, 8);
+			last[8] = first[8] = '\0';
+			animate(&job, dir_pack_name(first), dir_pack_name(last), data[i] & 1);
+		}
+		HeapFree(GetProcessHeap(), 0, data);
+		data = 0;
+	}
+	for (i = 0; i < textures.texture_count; ++i) {
+		char name[8 + 1];
+
+		dir_unpack_name(textures.names[i], name);
+		if ((name[0] == 'S') && (name[1] == 'W') && (name[2] == '1')) {
+			name[2] = '2';
+			pair_switch(&job, textures.names[i], dir_pack_name(name));
+		}
+	}
+	if ((j = find_last(dir.names, count, "SWITCHES")) >= 0) {
+		data = (unsigned char *)read_lump(&reader, spans + j, &ret);
+		if (!data) goto cleanup;
+		for (i = 0; (i + SWITCHES_SIZE <= spans[j].size) && get16(data + i + 18); i += SWITCHES_SIZE) {
+			char off[8 + 1], on[8 + 1];
+
+			CopyMemory(off, data + i, 8);
+			CopyMemory(on, data + i + 9, 8);
+			off[8] = on[8] = '\0';
+			pair_switch(&job, dir_pack_name(off), dir_pack_name(on));
+		}
+		HeapFree(GetProcessHeap(), 0, data);
+		data = 0;
+	}
+
+	// patches named by a used texture get 1, by unused ones only 2
+	ret = REFS_ERROR_ALLOC;
+	named = (char *)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, pname_count + 1);
+	refs->unused = (char *)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, count + 1);
+	refs->unused_textures = (dir_name *)HeapAlloc(GetProcessHeap(), 0, sizeof(dir_name) * (textures.texture_count + 1));
+	if (!named || !refs->unused || !refs->unused_textures) goto cleanup;
+	for (i = 0; i < textures.texture_count; ++i) {
+		for (j = textures.first[i]; j < textures.first[i] + textures.count[i]; ++j) {
+			named[textures.refs[j]] |= job.texture_marks[i] ? 1 : 2;
+		}
+	}
+	for (i = 0; i < pname_count; ++i) {
+		if (!named[i]) continue;
+		for (j = table_find(&job.patches, pnames[i]); j >= 0; j = table_next(&job.patches, j)) {
+			job.lump_marks[j] |= (named[i] & 1) ? 1 : 2;
+		}
+	}
+
+	refs->textures = textures.texture_count;
+	if (type == WAD_TYPE_IWAD) {
+		if (pname_count && textures.texture_count && (patch_first < patch_end)) refs->checked |= REFS_PATCHES;
+		if (refs->maps) refs->checked |= REFS_FLATS;
+		if (refs->maps && textures.texture_count) refs->checked |= REFS_TEXTURES;
+	}
+	if (refs->checked & REFS_PATCHES) {
+		for (i = patch_first; i < patch_end; ++i) {
+			if (!dir.sizes[i]) continue;
+			if (job.lump_marks[i] & 1) continue;
+			if (job.lump_marks[i]) {
+				if (refs->checked & REFS_TEXTURES) ++refs->orphaned_patches;
+				continue;
+			}
+			refs->unused[i] = 1;
+			++refs->unused_patches;
+			refs->unused_size += dir.sizes[i];
+		}
+	}
+	if (refs->checked & REFS_FLATS) {
+		for (i = flat_first; i < flat_end; ++i) {
+			if (!dir.sizes[i] || job.lump_marks[i]) continue;
+			refs->unused[i] = 1;
+			++refs->unused_flats;
+			refs->unused_size += dir.sizes[i];
+		}
+	}
+	if (refs->checked & REFS_TEXTURES) {
+		for (i = 0; i < textures.texture_count; ++i) {
+			if (!job.texture_marks[i]) refs->unused_textures[refs->unused_texture_count++] = textures.names[i];
+		}
+	}
+
+	ret = 0;
+cleanup:
+	if (ret) refs_free(refs);
+	if (data) HeapFree(GetProcessHeap(), 0, data);
+	if (pnames) HeapFree(GetProcessHeap(), 0, pnames);
+	if (named) HeapFree(GetProcessHeap(), 0, named);
+	if (units) HeapFree(GetProcessHeap(), 0, units);
+	if (textures.names) HeapFree(GetProcessHeap(), 0, textures.names);
+	if (textures.first) HeapFree(GetProcessHeap(), 0, textures.first);
+	if (textures.count) HeapFree(GetProcessHeap(), 0, textures.count);
+	if (textures.refs) HeapFree(GetProcessHeap(), 0, textures.refs);
+	if (job.lump_marks) HeapFree(GetProcessHeap(), 0, job.lump_marks);
+	if (job.texture_marks) HeapFree(GetProcessHeap(), 0, job.texture_marks);
+	table_free(&job.flats);
+	table_free(&job.patches);
+	table_free(&job.textures);
+	wad_reader_close(&reader);
+	dir_free(&dir);
+	return ret;
+}
+
+void
+refs_free(struct refs *refs)
+{
+	if (refs->unused) HeapFree(GetProcessHeap(), 0, refs->unused);
+	if (refs->unused_textures) HeapFree(GetProcessHeap(), 0, refs->unused_textures);
+	refs->unused = 0;
+	refs->unused_textures = 0;
+}
@@ -0,0 +1,41 @@
+#ifndef REFS_HEADER
+#define REFS_HEADER
+
+#include "wad.h"
+#include "dir.h"
+
+enum refs_error {
+	REFS_ERROR_ALLOC = -192,
+	REFS_ERROR_FORMAT = -193
+};
+
+// what a wad holds enough of to tell used from unused: patches need PNAMES
+// and a TEXTURE lump, flats and textures need maps to use them
+enum refs_checked {
+	REFS_PATCHES = 1,
+	REFS_FLATS = 2,
+	REFS_TEXTURES = 4
+};
+
+// the maps of a wad followed through their sidedefs and sectors to the
+// textures and flats they use, and from TEXTURE1/2 through PNAMES to the
+// patches; a patch stays used while any texture names it, since the engine
+// loads every texture whether a map uses it or not. Only an IWAD is checked,
+// the maps and textures of the IWAD under a PWAD use its lumps as well
+struct refs {
+	char *unused; // per lump, the patches and flats nothing reaches
+	dir_name *unused_textures;
+	int unused_texture_count;
+	int maps;
+	int textures;
+	int unused_patches;
+	int unused_flats;
+	int unused_size;
+	int orphaned_patches; // only named by unused textures
+	int checked;
+};
+
+int refs_build(struct refs *refs, enum wad_type type, const struct wad_dentry *dentries, const struct wad_span *spans, int count);
+void refs_free(struct refs *refs);
+
+#endif // REFS_HEADER
@@ -0,0 +1,210 @@
+#include "save.h"
+#include "stats.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#undef UNICODE
+#include <windows.h>
+#else
+// just enough of win32 for the benchmarks to save with this on linux
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+typedef void *HANDLE;
+typedef unsigned DWORD;
+
+#define INVALID_HANDLE_VALUE ((HANDLE)-1)
+#define OPEN_EXISTING O_RDONLY
+#define CREATE_ALWAYS (O_WRONLY | O_CREAT | O_TRUNC)
+#define FILE_BEGIN SEEK_SET
+#define HeapAlloc(heap, flags, size) malloc(size)
+#define HeapFree(heap, flags, p) free(p)
+
+static HANDLE
+open_file(const char *path, int flags)
+{
+	int fd = open(path, flags, 0644);
+	return (fd < 0) ? INVALID_HANDLE_VALUE : (HANDLE)(intptr_t)fd;
+}
+
+static DWORD
+file_size(HANDLE fd)
+{
+	struct stat st;
+	return fstat((int)(intptr_t)fd, &st) ? (DWORD)-1 : (DWORD)st.st_size;
+}
+
+#define CreateFile(path, access, share, security, disposition, flags, temp) open_file((path), (disposition))
+#define CloseHandle(fd) close((int)(intptr_t)(fd))
+#define GetFileSize(fd, high) file_size(fd)
+#define SetFilePointer(fd, offset, high, method) ((DWORD)lseek((int)(intptr_t)(fd), (offset), (method)))
+#define ReadFile(fd, buf, length, rd, overlapped) ((int)(*(rd) = (DWORD)read((int)(intptr_t)(fd), (buf), (length))) >= 0)
+#define WriteFile(fd, buf, length, wr, overlapped) ((int)(*(wr) = (DWORD)write((int)(intptr_t)(fd), (buf), (length))) >= 0)
+#endif
+#include <stdio.h> // BUFSIZ
+
+int
+save_copy(void *dest, void *src, int length)
+{
+	char buf[BUFSIZ];
+	DWORD rd, wr;
+	int count = 0;
+
+	while (length > 0) {
+		DWORD chunk_size = sizeof(buf);
+		if (chunk_size > (DWORD)length) chunk_size = length;
+		if (!ReadFile(src, buf, chunk_size, &rd, 0) || !rd) break;
+		if (!WriteFile(dest, buf, rd, &wr, 0)) break;
+		STATS_ADD(STATS_READS, 1);
+		STATS_ADD(STATS_WRITES, 1);
+		STATS_ADD(STATS_BYTES_READ, rd);
+		STATS_ADD(STATS_BYTES_WRITTEN, wr);
+		count += wr;
+		length -= wr;
+		if (wr != rd) break;
+	}
+	return count;
+}
+
+// all of the file, which has to be as long as the directory says
+int
+save_copy_file(void *dest, const char *path)
+{
+	HANDLE src = CreateFile(path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, 0, 0);
+	DWORD size;
+	int ret;
+
+	if (src == INVALID_HANDLE_VALUE) return SAVE_ERROR_OPEN;
+	STATS_ADD(STATS_OPENS, 1);
+	size = GetFileSize(src, 0);
+	ret = save_copy(dest, src, (int)size);
+	CloseHandle(src);
+	return (ret == (int)size) ? ret : SAVE_ERROR_READ;
+}
+
+static int
+copy_lump(HANDLE dest, HANDLE wad, const struct dir *dir, int i, const struct save_options *options)
+{
+	int offset = dir->offsets[i], size = dir->sizes[i];
+	long long start;
+	int ret;
+
+	if (!size) return 0;
+	start = stats_begin();
+	if (dir->sources[i]) {
+		ret = save_copy_file(dest, dir->sources[i]);
+	} else if (options->copy) {
+		ret = options->copy(options->ctx, dest, offset, size);
+	} else if ((wad == INVALID_HANDLE_VALUE) || (SetFilePointer(wad, offset, 0, FILE_BEGIN) != (DWORD)offset)) {
+		return SAVE_ERROR_READ;
+	} else {
+		STATS_ADD(STATS_SEEKS, 1);
+		ret = save_copy(dest, wad, size);
+	}
+	stats_end(STATS_LUMP_COPY, start);
+	if ((ret >= 0) && (ret != size)) ret = SAVE_ERROR_READ;
+	return ret;
+}
+
+int
+save_dir(const char *path, const struct dir *dir, const struct save_options *options, int *saved, struct layout_stats *stats)
+{
+	const char *skip = options->skip;
+	HANDLE fd = CreateFile(path, GENERIC_WRITE, 0, 0, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, 0);
+	HANDLE wad = INVALID_HANDLE_VALUE;
+	DWORD wr;
+	struct wad_header hd;
+	int *sizes = 0, *offsets = 0;
+	long long start;
+	int kept = 0;
+	int ret;
+	int i, k;
+
+	if (fd == INVALID_HANDLE_VALUE) return SAVE_ERROR_OPEN;
+	STATS_ADD(STATS_OPENS, 1);
+	if (options->wad_path && !options->copy) {
+		wad = CreateFile(options->wad_path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, 0, 0);
+		if (wad != INVALID_HANDLE_VALUE) STATS_ADD(STATS_OPENS, 1);
+	}
+
+	for (i = 0; i < dir->count; ++i) {
+		saved[i] = 0;
+		if (!skip || !skip[i]) ++kept;
+	}
+	hd.type = WAD_TYPE_IWAD;
+	hd.lump_count = kept;
+	hd.directory_offset = 0; // we don't know yet
+
+	ret = SAVE_ERROR_WRITE;
+	if (options->layout) {
+		ret = SAVE_ERROR_ALLOC;
+		sizes = (int *)HeapAlloc(GetProcessHeap(), 0, sizeof(int) * (dir->count + 1));
+		offsets = (int *)HeapAlloc(GetProcessHeap(), 0, sizeof(int) * (dir->count + 1));
+		if (!sizes || !offsets) goto cleanup;
+		for (i = k = 0; i < dir->count; ++i) {
+			if (skip && skip[i]) continue;
+			sizes[k++] = dir->sizes[i];
+		}
+		ret = layout_plan(sizes, kept, options->layout, offsets, &hd.directory_offset, stats);
+		if (ret < 0) goto cleanup;
+
+		// the gaps left between the writes read back as zeros
+		for (i = k = 0; i < dir->count; ++i) {
+			if (skip && skip[i]) continue;
+			saved[i] = offsets[k];
+			if (!sizes[k++]) continue;
+			ret = SAVE_ERROR_WRITE;
+			if (SetFilePointer(fd, saved[i], 0, FILE_BEGIN) != (DWORD)saved[i]) goto cleanup;
+			STATS_ADD(STATS_SEEKS, 1);
+			ret = copy_lump(fd, wad, dir, i, options);
+			if (ret < 0) goto cleanup;
+		}
+		ret = SAVE_ERROR_WRITE;
+		if (SetFilePointer(fd, hd.directory_offset, 0, FILE_BEGIN) != (DWORD)hd.directory_offset) goto cleanup;
+	} else {
+		if (!WriteFile(fd, &hd, WAD_HEADER_SIZE, &wr, 0)) goto cleanup;
+		if (wr != WAD_HEADER_SIZE) goto cleanup;
+		STATS_ADD(STATS_WRITES, 1);
+		STATS_ADD(STATS_BYTES_WRITTEN, wr);
+
+		hd.directory_offset = WAD_HEADER_SIZE;
+		for (i = 0; i < dir->count; ++i) {
+			if (skip && skip[i]) continue;
+			ret = copy_lump(fd, wad, dir, i, options);
+			if (ret < 0) goto cleanup;
+			if (dir->sizes[i]) saved[i] = hd.directory_offset;
+			hd.directory_offset += dir->sizes[i];
+		}
+		ret = SAVE_ERROR_WRITE;
+	}
+	start = stats_begin();
+	for (i = 0; i < dir->count; ++i) {
+		struct wad_dentry d;
+
+		if (skip && skip[i]) continue;
+		dir_dentry(dir, i, &d);
+		d.offset = saved[i];
+		if (!WriteFile(fd, &d, WAD_DENTRY_SIZE, &wr, 0)) goto cleanup;
+		if (wr != WAD_DENTRY_SIZE) goto cleanup;
+	}
+	STATS_ADD(STATS_WRITES, kept);
+	STATS_ADD(STATS_BYTES_WRITTEN, WAD_DENTRY_SIZE * kept);
+	if (SetFilePointer(fd, 0, 0, FILE_BEGIN) != 0) goto cleanup;
+	if (!WriteFile(fd, &hd, WAD_HEADER_SIZE, &wr, 0)) goto cleanup;
+	if (wr != WAD_HEADER_SIZE) goto cleanup;
+	stats_end(STATS_DIRECTORY_WRITE, start);
+	STATS_ADD(STATS_SEEKS, 1);
+	STATS_ADD(STATS_WRITES, 1);
+	STATS_ADD(STATS_BYTES_WRITTEN, wr);
+
+	ret = 0;
+cleanup:
+	if (sizes) HeapFree(GetProcessHeap(), 0, sizes);
+	if (offsets) HeapFree(GetProcessHeap(), 0, offsets);
+	if (wad != INVALID_HANDLE_VALUE) CloseHandle(wad);
+	CloseHandle(fd);
+	return ret;
+}
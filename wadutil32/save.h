@@ -0,0 +1,34 @@
+#ifndef SAVE_HEADER
+#define SAVE_HEADER
+
+#include "dir.h"
+#include "layout.h"
+
+enum save_error {
+	SAVE_ERROR_OPEN = -208,
+	SAVE_ERROR_READ = -209,
+	SAVE_ERROR_WRITE = -210,
+	SAVE_ERROR_ALLOC = -211
+};
+
+// writes a lump of the wad itself to dest, returns the bytes written
+typedef int (*save_copy_fn)(void *ctx, void *dest, int offset, int size);
+
+struct save_options {
+	const char *wad_path; // where the lumps without a source are read from
+	const struct layout_options *layout; // 0 packs the lumps back to back
+	const char *skip; // lumps left out, may be 0
+	save_copy_fn copy; // used instead of reading wad_path when given
+	void *ctx;
+};
+
+// copies length bytes from where src is to where dest is, returns how many
+// made it
+int save_copy(void *dest, void *src, int length);
+int save_copy_file(void *dest, const char *path);
+
+// writes the lumps of dir to path, the dir itself is left alone and
+// saved[i] tells where lump i went; stats are only filled in with a layout
+int save_dir(const char *path, const struct dir *dir, const struct save_options *options, int *saved, struct layout_stats *stats);
+
+#endif // SAVE_HEADER
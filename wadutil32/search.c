@@ -0,0 +1,199 @@
+#include "search.h"
+#include "parallel.h"
+
+#define WIN32_LEAN_AND_MEAN
+#undef UNICODE
+#include <windows.h>
+#include <emmintrin.h> // SSE2
+
+struct search_chunk {
+	int span;
+	int start;
+};
+
+struct search_worker {
+	struct wad_reader reader;
+	char *buf;
+};
+
+struct search_job {
+	const struct wad_span *spans;
+	const struct search_pattern *patterns;
+	int pattern_count;
+	int overlap;
+	struct search_chunk *chunks;
+	struct search_worker workers[PARALLEL_MAX_WORKERS];
+	search_hit_fn hit;
+	void *ctx;
+	CRITICAL_SECTION lock;
+	volatile LONG hits;
+	volatile LONG error;
+};
+
+static int
+lowest_bit(unsigned mask)
+{
+	int i = 0;
+
+	while (!(mask & 1)) {
+		mask >>= 1;
+		++i;
+	}
+	return i;
+}
+
+static int
+same_bytes(const char *a, const char *b, int n)
+{
+	while (n--) {
+		if (*a++ != *b++) return 0;
+	}
+	return !0;
+}
+
+// reports every occurrence of the pattern that starts before limit
+void
+search_memory(const char *data, int length, int limit, const struct search_pattern *pattern, search_match_fn match, void *ctx)
+{
+	const char *needle = pattern->data;
+	int m = pattern->length;
+	int positions = length - m + 1;
+	int i = 0;
+
+	if (positions > limit) positions = limit;
+	if (m < 1) return;
+
+	// compare the first and the last byte at 16 positions at once, verify the rest only on candidates
+	{
+		__m128i first = _mm_set1_epi8(needle[0]);
+		__m128i last = _mm_set1_epi8(needle[m - 1]);
+
+		for (; i + 16 <= positions; i += 16) {
+			__m128i a = _mm_loadu_si128((const __m128i *)(data + i));
+			__m128i b = _mm_loadu_si128((const __m128i *)(data + i + m - 1));
+			unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+
+			while (mask) {
+				int j = i + lowest_bit(mask);
+				if ((m <= 2) || same_bytes(data + j + 1, needle + 1, m - 2)) {
+					match(ctx, j);
+				}
+				mask &= mask - 1;
+			}
+		}
+	}
+
+	for (; i < positions; ++i) {
+		if ((data[i] == needle[0]) && same_bytes(data + i + 1, needle + 1, m - 1)) {
+			match(ctx, i);
+		}
+	}
+}
+
+struct search_filter {
+	struct search_job *job;
+	int span;
+	int pattern;
+	int start;
+};
+
+static void
+search_report(void *ctx, int offset)
+{
+	struct search_filter *f = (struct search_filter *)ctx;
+	struct search_job *job = f->job;
+
+	EnterCriticalSection(&job->lock);
+	job->hit(job->ctx, f->span, f->pattern, f->start + offset);
+	LeaveCriticalSection(&job->lock);
+	InterlockedIncrement(&job->hits);
+}
+
+static void
+search_chunk(void *ctx, int worker, int index)
+{
+	struct search_job *job = (struct search_job *)ctx;
+	struct search_worker *w = job->workers + worker;
+	const struct search_chunk *c = job->chunks + index;
+	const struct wad_span *span = job->spans + c->span;
+	struct search_filter filter;
+	int limit = span->size - c->start;
+	int length;
+	int i;
+
+	if (job->error) return;
+	if (!w->buf) {
+		w->buf = (char *)HeapAlloc(GetProcessHeap(), 0, SEARCH_CHUNK_SIZE + job->overlap);
+		if (!w->buf) {
+			job->error = SEARCH_ERROR_ALLOC;
+			return;
+		}
+	}
+
+	// read a little past the chunk so matches crossing its end are found here and only here
+	if (limit > SEARCH_CHUNK_SIZE) limit = SEARCH_CHUNK_SIZE;
+	length = wad_reader_read(&w->reader, span, c->start, w->buf, limit + job->overlap);
+	if (length < 0) {
+		job->error = length;
+		return;
+	}
+
+	filter.job = job;
+	filter.span = c->span;
+	filter.start = c->start;
+	for (i = 0; i < job->pattern_count; ++i) {
+		filter.pattern = i;
+		search_memory(w->buf, length, limit, job->patterns + i, search_report, &filter);
+	}
+}
+
+int
+search_spans(const struct wad_span *spans, int span_count, const struct search_pattern *patterns, int pattern_count, search_hit_fn hit, void *ctx)
+{
+	struct search_job job;
+	int chunk_count = 0;
+	int workers;
+	int i, j, k;
+
+	ZeroMemory(&job, sizeof(job));
+	for (i = 0; i < pattern_count; ++i) {
+		if (patterns[i].length < 1) return SEARCH_ERROR_PATTERN;
+		if (job.overlap < patterns[i].length - 1) job.overlap = patterns[i].length - 1;
+	}
+	for (i = 0; i < span_count; ++i) {
+		chunk_count += (spans[i].size + SEARCH_CHUNK_SIZE - 1) / SEARCH_CHUNK_SIZE;
+	}
+	if (!chunk_count) return 0;
+
+	job.chunks = (struct search_chunk *)HeapAlloc(GetProcessHeap(), 0, sizeof(struct search_chunk) * chunk_count);
+	if (!job.chunks) return SEARCH_ERROR_ALLOC;
+	for (i = 0, k = 0; i < span_count; ++i) {
+		for (j = 0; j < spans[i].size; j += SEARCH_CHUNK_SIZE) {
+			job.chunks[k].span = i;
+			job.chunks[k].start = j;
+			++k;
+		}
+	}
+
+	job.spans = spans;
+	job.patterns = patterns;
+	job.pattern_count = pattern_count;
+	job.hit = hit;
+	job.ctx = ctx;
+	workers = parallel_workers(chunk_count);
+	for (i = 0; i < workers; ++i) {
+		wad_reader_init(&job.workers[i].reader);
+	}
+	InitializeCriticalSection(&job.lock);
+
+	parallel_for(chunk_count, search_chunk, &job);
+
+	DeleteCriticalSection(&job.lock);
+	for (i = 0; i < workers; ++i) {
+		wad_reader_close(&job.workers[i].reader);
+		if (job.workers[i].buf) HeapFree(GetProcessHeap(), 0, job.workers[i].buf);
+	}
+	HeapFree(GetProcessHeap(), 0, job.chunks);
+
+	return job.error ? job.error : job.hits;
+}
@@ -0,0 +1,26 @@
+#ifndef SEARCH_HEADER
+#define SEARCH_HEADER
+
+#include "wad.h"
+
+// spans larger than this are split between threads
+#define SEARCH_CHUNK_SIZE (1 << 20)
+
+enum search_error {
+	SEARCH_ERROR_ALLOC = -16,
+	SEARCH_ERROR_PATTERN = -17
+};
+
+struct search_pattern {
+	const char *data;
+	int length;
+};
+
+// hits arrive in no particular order, but never concurrently
+typedef void (*search_hit_fn)(void *ctx, int span, int pattern, int offset);
+typedef void (*search_match_fn)(void *ctx, int offset);
+
+void search_memory(const char *data, int length, int limit, const struct search_pattern *pattern, search_match_fn match, void *ctx);
+int search_spans(const struct wad_span *spans, int span_count, const struct search_pattern *patterns, int pattern_count, search_hit_fn hit, void *ctx);
+
+#endif // SEARCH_HEADER
@@ -0,0 +1,186 @@
+#include "stats.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#undef UNICODE
+#include <windows.h>
+#include <stdio.h> // sprintf_s
+
+#define atomic_add(p, n) InterlockedExchangeAdd64((p), (n))
+#define atomic_swap_if(p, value, old) InterlockedCompareExchange64((p), (value), (old))
+#else
+// the benchmarks collect them on linux too
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define atomic_add(p, n) __sync_fetch_and_add((p), (n))
+#define atomic_swap_if(p, value, old) __sync_val_compare_and_swap((p), (old), (value))
+#define sprintf_s snprintf
+#define ZeroMemory(p, n) memset((p), 0, (n))
+#endif
+
+struct histogram {
+	volatile long long count;
+	volatile long long total_us;
+	volatile long long max_us;
+	volatile long long buckets[STATS_BUCKETS];
+};
+
+static const char *counter_names[STATS_COUNTER_COUNT] = {
+	"opens", "reads", "writes", "seeks", "bytes_read", "bytes_written", "cache_hits", "cache_misses"
+};
+
+static const char *phase_names[STATS_PHASE_COUNT] = {
+	"directory_read", "lump_copy", "directory_write"
+};
+
+volatile long stats_enabled = 0;
+static volatile long long counters[STATS_COUNTER_COUNT];
+static struct histogram phases[STATS_PHASE_COUNT];
+static long long ticks_per_second = 1;
+
+static long long
+ticks(void)
+{
+#ifdef _WIN32
+	LARGE_INTEGER t;
+
+	QueryPerformanceCounter(&t);
+	return t.QuadPart;
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+#endif
+}
+
+void
+stats_enable(int enable)
+{
+#ifdef _WIN32
+	LARGE_INTEGER f;
+
+	QueryPerformanceFrequency(&f);
+	ticks_per_second = f.QuadPart;
+#else
+	ticks_per_second = 1000000000LL;
+#endif
+	stats_enabled = enable;
+}
+
+void
+stats_reset(void)
+{
+	int i, j;
+
+	for (i = 0; i < STATS_COUNTER_COUNT; ++i) {
+		counters[i] = 0;
+	}
+	for (i = 0; i < STATS_PHASE_COUNT; ++i) {
+		phases[i].count = 0;
+		phases[i].total_us = 0;
+		phases[i].max_us = 0;
+		for (j = 0; j < STATS_BUCKETS; ++j) {
+			phases[i].buckets[j] = 0;
+		}
+	}
+}
+
+void
+stats_add(enum stats_counter counter, long long n)
+{
+	atomic_add(&counters[counter], n);
+}
+
+long long
+stats_begin(void)
+{
+	return stats_enabled ? ticks() : 0;
+}
+
+void
+stats_end(enum stats_phase phase, long long start)
+{
+	struct histogram *h = phases + phase;
+	long long us, max;
+	int bucket = 0;
+
+	if (!start) return;
+	us = (ticks() - start) * 1000000 / ticks_per_second;
+	while ((bucket < STATS_BUCKETS - 1) && (us >> bucket)) ++bucket;
+
+	atomic_add(&h->count, 1);
+	atomic_add(&h->total_us, us);
+	atomic_add(&h->buckets[bucket], 1);
+	for (max = h->max_us; us > max; max = h->max_us) {
+		if (atomic_swap_if(&h->max_us, us, max) == max) break;
+	}
+}
+
+void
+stats_snapshot(struct stats_snapshot *snapshot)
+{
+	int i, j;
+
+	for (i = 0; i < STATS_COUNTER_COUNT; ++i) {
+		snapshot->counters[i] = counters[i];
+	}
+	for (i = 0; i < STATS_PHASE_COUNT; ++i) {
+		snapshot->phases[i].count = phases[i].count;
+		snapshot->phases[i].total_us = phases[i].total_us;
+		snapshot->phases[i].max_us = phases[i].max_us;
+		for (j = 0; j < STATS_BUCKETS; ++j) {
+			snapshot->phases[i].buckets[j] = phases[i].buckets[j];
+		}
+	}
+}
+
+// buckets are given as [below this many us, count], empty ones left out
+int
+stats_dump(char *buf, int size)
+{
+	struct stats_snapshot s;
+	int pos = 0;
+	int i, j;
+
+	// no piece is longer than this, so sprintf_s never runs out of room
+#define APPEND(...) do { \
+		int n; \
+		if (size - pos < 256) return -1; \
+		n = sprintf_s(buf + pos, size - pos, __VA_ARGS__); \
+		if (n < 0) return -1; \
+		pos += n; \
+	} while (0)
+
+	if (size <= 0) return -1;
+	ZeroMemory(buf, size);
+	stats_snapshot(&s);
+	APPEND("{\"enabled\":%d", stats_enabled ? 1 : 0);
+	for (i = 0; i < STATS_COUNTER_COUNT; ++i) {
+		APPEND(",\"%s\":%lld", counter_names[i], s.counters[i]);
+	}
+	for (i = 0; i < STATS_PHASE_COUNT; ++i) {
+		const struct stats_histogram *h = s.phases + i;
+		int first = 1;
+
+		APPEND(
+			",\"%s\":{\"count\":%lld,\"total_us\":%lld,\"max_us\":%lld,\"buckets\":[",
+			phase_names[i], h->count, h->total_us, h->max_us
+		);
+		for (j = 0; j < STATS_BUCKETS; ++j) {
+			if (!h->buckets[j]) continue;
+			if (j == STATS_BUCKETS - 1) {
+				APPEND("%s[null,%lld]", first ? "" : ",", h->buckets[j]);
+			} else {
+				APPEND("%s[%lld,%lld]", first ? "" : ",", 1LL << j, h->buckets[j]);
+			}
+			first = 0;
+		}
+		APPEND("]}");
+	}
+	APPEND("}");
+#undef APPEND
+	return pos;
+}
@@ -0,0 +1,56 @@
+#ifndef STATS_HEADER
+#define STATS_HEADER
+
+// latencies go into buckets of powers of two microseconds, the last one
+// taking everything longer
+#define STATS_BUCKETS 24
+// enough for all of stats_dump
+#define STATS_DUMP_SIZE 4096
+
+enum stats_counter {
+	STATS_OPENS,
+	STATS_READS,
+	STATS_WRITES,
+	STATS_SEEKS,
+	STATS_BYTES_READ,
+	STATS_BYTES_WRITTEN,
+	STATS_CACHE_HITS, // a directory or block that was already there
+	STATS_CACHE_MISSES,
+	STATS_COUNTER_COUNT
+};
+
+enum stats_phase {
+	STATS_DIRECTORY_READ,
+	STATS_LUMP_COPY,
+	STATS_DIRECTORY_WRITE,
+	STATS_PHASE_COUNT
+};
+
+struct stats_histogram {
+	long long count;
+	long long total_us;
+	long long max_us;
+	long long buckets[STATS_BUCKETS];
+};
+
+struct stats_snapshot {
+	long long counters[STATS_COUNTER_COUNT];
+	struct stats_histogram phases[STATS_PHASE_COUNT];
+};
+
+// while it is off a call site costs a load and a branch
+extern volatile long stats_enabled;
+
+#define STATS_ADD(counter, n) do { if (stats_enabled) stats_add((counter), (n)); } while (0)
+
+void stats_enable(int enable);
+void stats_reset(void);
+void stats_add(enum stats_counter counter, long long n);
+// gives 0 while off, which stats_end skips
+long long stats_begin(void);
+void stats_end(enum stats_phase phase, long long start);
+void stats_snapshot(struct stats_snapshot *snapshot);
+// one line of json, returns its length or -1 if it did not fit
+int stats_dump(char *buf, int size);
+
+#endif // STATS_HEADER
@@ -0,0 +1,406 @@
+#include "store.h"
+#include "parallel.h"
+
+#define WIN32_LEAN_AND_MEAN
+#undef UNICODE
+#include <windows.h>
+#include <stdio.h> // sprintf_s
+
+#define STORE_BUFFER_SIZE (64 * 1024)
+#define STORE_KEY_LENGTH (16 + 8)
+
+struct store_job {
+	const struct wad_span *spans;
+	const struct hash_lump *hashes;
+	char dir[MAX_PATH];
+	struct wad_reader readers[PARALLEL_MAX_WORKERS];
+	char *bufs[PARALLEL_MAX_WORKERS];
+	volatile LONG stored;
+	volatile LONG skipped;
+	volatile LONGLONG bytes_stored;
+	volatile LONGLONG bytes_skipped;
+	volatile LONG error;
+};
+
+static void
+to_hex(char *out, hash64 v, int digits)
+{
+	static const char hex[] = "0123456789abcdef";
+
+	while (digits--) {
+		out[digits] = hex[v & 15];
+		v >>= 4;
+	}
+}
+
+static int
+from_hex(const char *p, int digits, hash64 *v)
+{
+	*v = 0;
+	while (digits--) {
+		char ch = *p++;
+		*v <<= 4;
+		if ((ch >= '0') && (ch <= '9')) *v |= ch - '0';
+		else if ((ch >= 'a') && (ch <= 'f')) *v |= ch - 'a' + 10;
+		else return STORE_ERROR_FORMAT;
+	}
+	return 0;
+}
+
+// the directory of the manifest with a trailing separator
+static void
+store_dir(char dir[MAX_PATH], const char *manifest_path)
+{
+	int i, cut = 0;
+
+	lstrcpyn(dir, manifest_path, MAX_PATH);
+	for (i = 0; dir[i]; ++i) {
+		if ((dir[i] == '\\') || (dir[i] == '/')) cut = i + 1;
+	}
+	dir[cut] = '\0';
+}
+
+static void
+object_key(char key[STORE_KEY_LENGTH + 1], hash64 hash, int size)
+{
+	to_hex(key, hash, 16);
+	to_hex(key + 16, (unsigned)size, 8);
+	key[STORE_KEY_LENGTH] = '\0';
+}
+
+// creates the fan-out directory too when create is set
+static void
+object_path(char path[MAX_PATH], const char *dir, const char *key, int create)
+{
+	char fan[3];
+
+	fan[0] = key[0];
+	fan[1] = key[1];
+	fan[2] = '\0';
+	lstrcpy(path, dir);
+	lstrcat(path, STORE_OBJECTS);
+	if (create) CreateDirectory(path, 0);
+	lstrcat(path, "\\");
+	lstrcat(path, fan);
+	if (create) CreateDirectory(path, 0);
+	lstrcat(path, "\\");
+	lstrcat(path, key);
+}
+
+static int
+object_exists(const char *path, int size)
+{
+	WIN32_FILE_ATTRIBUTE_DATA fad;
+
+	if (!GetFileAttributesEx(path, GetFileExInfoStandard, &fad)) return 0;
+	return !fad.nFileSizeHigh && (fad.nFileSizeLow == (DWORD)size);
+}
+
+static int
+write_object(const char *path, struct wad_reader *reader, const struct wad_span *span, char *buf)
+{
+	HANDLE fd = CreateFile(path, GENERIC_WRITE, 0, 0, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, 0);
+	int pos = 0;
+	int ret = 0;
+
+	if (fd == INVALID_HANDLE_VALUE) return WAD_ERROR_FILE_OPEN;
+	while (!ret && (pos < span->size)) {
+		DWORD wr;
+		int rd = wad_reader_read(reader, span, pos, buf, STORE_BUFFER_SIZE);
+
+		if (rd <= 0) {
+			ret = rd ? rd : WAD_ERROR_FILE_READ;
+		} else if (!WriteFile(fd, buf, rd, &wr, 0) || (wr != (DWORD)rd)) {
+			ret = STORE_ERROR_WRITE;
+		}
+		pos += rd;
+	}
+	CloseHandle(fd);
+	return ret;
+}
+
+static void
+deposit_one(void *ctx, int worker, int index)
+{
+	struct store_job *job = (struct store_job *)ctx;
+	const struct wad_span *span = job->spans + index;
+	struct wad_reader *reader = &job->readers[worker];
+	char key[STORE_KEY_LENGTH + 1];
+	char path[MAX_PATH];
+	char tmp[MAX_PATH];
+	int ret;
+
+	if (job->error || !span->size) return;
+	if (!job->bufs[worker]) {
+		job->bufs[worker] = (char *)HeapAlloc(GetProcessHeap(), 0, STORE_BUFFER_SIZE);
+		if (!job->bufs[worker]) {
+			job->error = STORE_ERROR_ALLOC;
+			return;
+		}
+	}
+
+	object_key(key, job->hashes[index].xxh64, span->size);
+	object_path(path, job->dir, key, 0);
+	if (object_exists(path, span->size)) {
+		InterlockedIncrement(&job->skipped);
+		InterlockedExchangeAdd64(&job->bytes_skipped, span->size);
+		return;
+	}
+
+	// write aside and rename, so a blob is either complete or missing
+	object_path(path, job->dir, key, !0);
+	sprintf_s(tmp, sizeof(tmp), "%s.%lu-%d.tmp", path, (unsigned long)GetCurrentProcessId(), worker);
+	ret = write_object(tmp, reader, span, job->bufs[worker]);
+	if (ret) {
+		DeleteFile(tmp);
+		job->error = ret;
+		return;
+	}
+	if (!MoveFileEx(tmp, path, 0)) {
+		DeleteFile(tmp);
+		if (!object_exists(path, span->size)) {
+			job->error = STORE_ERROR_WRITE;
+			return;
+		}
+		InterlockedIncrement(&job->skipped);
+		InterlockedExchangeAdd64(&job->bytes_skipped, span->size);
+		return;
+	}
+	InterlockedIncrement(&job->stored);
+	InterlockedExchangeAdd64(&job->bytes_stored, span->size);
+}
+
+static int
+write_manifest(const char *path, enum wad_type type, const struct wad_dentry *dentries, const struct hash_lump *hashes, int count)
+{
+	HANDLE fd = CreateFile(path, GENERIC_WRITE, 0, 0, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, 0);
+	char *buf = (char *)HeapAlloc(GetProcessHeap(), 0, STORE_BUFFER_SIZE);
+	int used;
+	int ret = 0;
+	int i;
+
+	if (fd == INVALID_HANDLE_VALUE) {
+		if (buf) HeapFree(GetProcessHeap(), 0, buf);
+		return WAD_ERROR_FILE_OPEN;
+	}
+	if (!buf) {
+		CloseHandle(fd);
+		return STORE_ERROR_ALLOC;
+	}
+
+	used = sprintf_s(buf, STORE_BUFFER_SIZE, "%s\r\n%s %d\r\n", STORE_MAGIC, (type == WAD_TYPE_PWAD) ? "PWAD" : "IWAD", count);
+	for (i = 0; !ret && (i <= count); ++i) {
+		if ((i == count) || (used > STORE_BUFFER_SIZE - 64)) {
+			DWORD wr;
+			if (!WriteFile(fd, buf, used, &wr, 0) || (wr != (DWORD)used)) ret = STORE_ERROR_WRITE;
+			used = 0;
+		}
+		if (i < count) {
+			char key[STORE_KEY_LENGTH + 1];
+
+			object_key(key, dentries[i].size ? hashes[i].xxh64 : 0, dentries[i].size);
+			used += sprintf_s(buf + used, STORE_BUFFER_SIZE - used, "%s %s\r\n", key, dentries[i].name);
+		}
+	}
+
+	HeapFree(GetProcessHeap(), 0, buf);
+	CloseHandle(fd);
+	return ret;
+}
+
+int
+store_deposit(const char *manifest_path, enum wad_type type, const struct wad_dentry *dentries, const struct wad_span *spans, int count, struct store_stats *stats)
+{
+	struct store_job job;
+	struct hash_lump *hashes;
+	int workers;
+	int ret;
+	int i;
+
+	ZeroMemory(&job, sizeof(job));
+	ZeroMemory(stats, sizeof(*stats));
+	hashes = (struct hash_lump *)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(struct hash_lump) * (count + 1));
+	if (!hashes) return STORE_ERROR_ALLOC;
+	// every lump is hashed before any is written, the keys need them anyway
+	ret = hash_spans(spans, count, HASH_XXH64, hashes);
+	if (ret) {
+		HeapFree(GetProcessHeap(), 0, hashes);
+		return ret;
+	}
+	job.spans = spans;
+	job.hashes = hashes;
+	store_dir(job.dir, manifest_path);
+
+	workers = parallel_workers(count);
+	for (i = 0; i < workers; ++i) {
+		wad_reader_init(&job.readers[i]);
+	}
+	parallel_for(count, deposit_one, &job);
+	for (i = 0; i < workers; ++i) {
+		wad_reader_close(&job.readers[i]);
+		if (job.bufs[i]) HeapFree(GetProcessHeap(), 0, job.bufs[i]);
+	}
+
+	ret = job.error;
+	if (!ret) ret = write_manifest(manifest_path, type, dentries, hashes, count);
+
+	stats->lumps = count;
+	stats->stored = job.stored;
+	stats->skipped = job.skipped;
+	stats->bytes_stored = job.bytes_stored;
+	stats->bytes_skipped = job.bytes_skipped;
+
+	HeapFree(GetProcessHeap(), 0, hashes);
+	return ret;
+}
+
+static char *
+read_text(const char *path)
+{
+	HANDLE fd = CreateFile(path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, 0, 0);
+	DWORD size, rd;
+	char *text = 0;
+
+	if (fd == INVALID_HANDLE_VALUE) return 0;
+	size = GetFileSize(fd, 0);
+	if (size != INVALID_FILE_SIZE) text = (char *)HeapAlloc(GetProcessHeap(), 0, size + 1);
+	if (text) {
+		if (ReadFile(fd, text, size, &rd, 0) && (rd == size)) {
+			text[size] = '\0';
+		} else {
+			HeapFree(GetProcessHeap(), 0, text);
+			text = 0;
+		}
+	}
+	CloseHandle(fd);
+	return text;
+}
+
+// returns the start of the next line and terminates the current one
+static char *
+next_line(char *p)
+{
+	while (*p && (*p != '\r') && (*p != '\n')) ++p;
+	if (*p == '\r') *p++ = '\0';
+	if (*p == '\n') *p++ = '\0';
+	return p;
+}
+
+static int
+copy_object(HANDLE dest, const char *path, int size, char *buf)
+{
+	HANDLE src = CreateFile(path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, 0);
+	int ret = 0;
+
+	if (src == INVALID_HANDLE_VALUE) return STORE_ERROR_MISSING;
+	while (!ret && size) {
+		DWORD rd, wr;
+		int chunk = (size > STORE_BUFFER_SIZE) ? STORE_BUFFER_SIZE : size;
+
+		if (!ReadFile(src, buf, chunk, &rd, 0) || (rd != (DWORD)chunk)) {
+			ret = STORE_ERROR_MISSING;
+		} else if (!WriteFile(dest, buf, rd, &wr, 0) || (wr != rd)) {
+			ret = STORE_ERROR_WRITE;
+		}
+		size -= chunk;
+	}
+	CloseHandle(src);
+	return ret;
+}
+
+int
+store_rebuild(const char *manifest_path, const char *wad_path)
+{
+	char dir[MAX_PATH];
+	char *text = read_text(manifest_path);
+	char *line, *p;
+	char *buf = 0;
+	struct wad_dentry *dentries = 0;
+	struct wad_header hd;
+	HANDLE fd = INVALID_HANDLE_VALUE;
+	DWORD wr;
+	int offset = WAD_HEADER_SIZE;
+	int ret = STORE_ERROR_FORMAT;
+	int i;
+
+	if (!text) return WAD_ERROR_FILE_READ;
+	store_dir(dir, manifest_path);
+
+	p = next_line(line = text);
+	if (lstrcmp(line, STORE_MAGIC)) goto cleanup;
+	p = next_line(line = p);
+	if ((lstrlen(line) < 6) || (line[4] != ' ')) goto cleanup;
+	line[4] = '\0';
+	if (!lstrcmp(line, "IWAD")) hd.type = WAD_TYPE_IWAD;
+	else if (!lstrcmp(line, "PWAD")) hd.type = WAD_TYPE_PWAD;
+	else goto cleanup;
+	hd.lump_count = 0;
+	for (line += 5; (*line >= '0') && (*line <= '9'); ++line) {
+		hd.lump_count = hd.lump_count * 10 + (*line - '0');
+	}
+
+	dentries = (struct wad_dentry *)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(struct wad_dentry) * (hd.lump_count + 1));
+	buf = (char *)HeapAlloc(GetProcessHeap(), 0, STORE_BUFFER_SIZE);
+	if (!dentries || !buf) {
+		ret = STORE_ERROR_ALLOC;
+		goto cleanup;
+	}
+
+	fd = CreateFile(wad_path, GENERIC_WRITE, 0, 0, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, 0);
+	if (fd == INVALID_HANDLE_VALUE) {
+		ret = WAD_ERROR_FILE_OPEN;
+		goto cleanup;
+	}
+	hd.directory_offset = 0;
+	if (!WriteFile(fd, &hd, WAD_HEADER_SIZE, &wr, 0) || (wr != WAD_HEADER_SIZE)) {
+		ret = STORE_ERROR_WRITE;
+		goto cleanup;
+	}
+
+	for (i = 0; i < hd.lump_count; ++i) {
+		char path[MAX_PATH];
+		hash64 size;
+
+		p = next_line(line = p);
+		if ((lstrlen(line) < STORE_KEY_LENGTH + 1) || (line[STORE_KEY_LENGTH] != ' ')) {
+			ret = STORE_ERROR_FORMAT;
+			goto cleanup;
+		}
+		if (from_hex(line + 16, 8, &size)) {
+			ret = STORE_ERROR_FORMAT;
+			goto cleanup;
+		}
+		line[STORE_KEY_LENGTH] = '\0';
+		lstrcpyn(dentries[i].name, line + STORE_KEY_LENGTH + 1, sizeof(dentries[i].name));
+		dentries[i].size = (int)size;
+		dentries[i].offset = size ? offset : 0;
+
+		if (size) {
+			object_path(path, dir, line, 0);
+			ret = copy_object(fd, path, (int)size, buf);
+			if (ret) goto cleanup;
+		}
+		offset += (int)size;
+	}
+
+	hd.directory_offset = offset;
+	for (i = 0; i < hd.lump_count; ++i) {
+		if (!WriteFile(fd, dentries + i, WAD_DENTRY_SIZE, &wr, 0) || (wr != WAD_DENTRY_SIZE)) {
+			ret = STORE_ERROR_WRITE;
+			goto cleanup;
+		}
+	}
+	SetFilePointer(fd, 0, 0, FILE_BEGIN);
+	if (!WriteFile(fd, &hd, WAD_HEADER_SIZE, &wr, 0) || (wr != WAD_HEADER_SIZE)) {
+		ret = STORE_ERROR_WRITE;
+		goto cleanup;
+	}
+	ret = 0;
+
+cleanup:
+	if (fd != INVALID_HANDLE_VALUE) CloseHandle(fd);
+	if (buf) HeapFree(GetProcessHeap(), 0, buf);
+	if (dentries) HeapFree(GetProcessHeap(), 0, dentries);
+	HeapFree(GetProcessHeap(), 0, text);
+	return ret;
+}
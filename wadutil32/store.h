@@ -0,0 +1,29 @@
+#ifndef STORE_HEADER
+#define STORE_HEADER
+
+#include "wad.h"
+#include "hash.h"
+
+// blobs live next to the manifests in objects\xx\<hash><size>
+#define STORE_OBJECTS "objects"
+#define STORE_MAGIC "WADSTORE 1"
+
+enum store_error {
+	STORE_ERROR_ALLOC = -48,
+	STORE_ERROR_FORMAT = -49,
+	STORE_ERROR_WRITE = -50,
+	STORE_ERROR_MISSING = -51
+};
+
+struct store_stats {
+	int lumps;
+	int stored;
+	int skipped;
+	long long bytes_stored;
+	long long bytes_skipped;
+};
+
+int store_deposit(const char *manifest_path, enum wad_type type, const struct wad_dentry *dentries, const struct wad_span *spans, int count, struct store_stats *stats);
+int store_rebuild(const char *manifest_path, const char *wad_path);
+
+#endif // STORE_HEADER
@@ -1,10 +1,39 @@
 #include "wad.h"
+#include "stats.h"
 
+#include <stdint.h>
+
+#ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
 #undef UNICODE
 #include <windows.h>
+#else
+// just enough of win32 for the benchmarks to build this on linux
+#include <fcntl.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
 
-#include <stdint.h>
+typedef void *HANDLE;
+typedef unsigned DWORD;
+
+#define INVALID_HANDLE_VALUE ((HANDLE)-1)
+#define FILE_BEGIN SEEK_SET
+#define lstrcmp strcmp
+#define lstrcmpi strcasecmp
+
+static HANDLE
+open_read(const char *path)
+{
+	int fd = open(path, O_RDONLY);
+	return (fd < 0) ? INVALID_HANDLE_VALUE : (HANDLE)(intptr_t)fd;
+}
+
+#define CreateFile(path, access, share, security, disposition, flags, temp) open_read(path)
+#define CloseHandle(fd) close((int)(intptr_t)(fd))
+#define SetFilePointer(fd, offset, high, method) ((DWORD)lseek((int)(intptr_t)(fd), (offset), (method)))
+#define ReadFile(fd, buf, length, rd, overlapped) ((int)(*(rd) = (DWORD)read((int)(intptr_t)(fd), (buf), (length))) >= 0)
+#endif
 
 int
 wad_open(struct wad *wad, const char *path)
@@ -13,8 +42,11 @@ wad_open(struct wad *wad, const char *path)
 
 	wad->fd = CreateFile(path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, 0, 0);
 	if (wad->fd == INVALID_HANDLE_VALUE) return WAD_ERROR_FILE_OPEN;
+	STATS_ADD(STATS_OPENS, 1);
 
 	if (!ReadFile(wad->fd, &wad->hd, WAD_HEADER_SIZE, &rd, 0)) return WAD_ERROR_FILE_READ;
+	STATS_ADD(STATS_READS, 1);
+	STATS_ADD(STATS_BYTES_READ, rd);
 	if (rd != WAD_HEADER_SIZE) return WAD_ERROR_FILE_READ;
 
 	return WAD_SUCCESS;
@@ -29,6 +61,7 @@ wad_close(struct wad *wad)
 int
 wad_seek_first_dentry(const struct wad *wad)
 {
+	STATS_ADD(STATS_SEEKS, 1);
 	if (SetFilePointer(wad->fd, wad->hd.directory_offset, 0, FILE_BEGIN) != wad->hd.directory_offset) {
 		return WAD_ERROR_FILE_SEEK;
 	}
@@ -41,8 +74,133 @@ wad_read_next_dentry(const struct wad *wad, struct wad_dentry *dentry)
 	DWORD rd;
 
 	if (!ReadFile(wad->fd, dentry, WAD_DENTRY_SIZE, &rd, 0)) return WAD_ERROR_FILE_READ;
+	STATS_ADD(STATS_READS, 1);
+	STATS_ADD(STATS_BYTES_READ, rd);
 	if (rd != WAD_DENTRY_SIZE) return WAD_ERROR_FILE_READ;
 	dentry->name[8] = '\0';
 
 	return WAD_SUCCESS;
 }
+
+void
+wad_reader_init(struct wad_reader *reader)
+{
+	reader->path = 0;
+	reader->fd = INVALID_HANDLE_VALUE;
+}
+
+int
+wad_reader_read(struct wad_reader *reader, const struct wad_span *span, int pos, void *buf, int length)
+{
+	DWORD rd;
+	int offset;
+
+	if (pos >= span->size) return 0;
+	if (length > span->size - pos) length = span->size - pos;
+
+	if ((reader->fd == INVALID_HANDLE_VALUE) || (reader->path != span->path && lstrcmp(reader->path, span->path))) {
+		wad_reader_close(reader);
+		reader->fd = CreateFile(span->path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, 0, 0);
+		if (reader->fd == INVALID_HANDLE_VALUE) return WAD_ERROR_FILE_OPEN;
+		reader->path = span->path;
+		STATS_ADD(STATS_OPENS, 1);
+	}
+
+	offset = span->offset + pos;
+	if (SetFilePointer(reader->fd, offset, 0, FILE_BEGIN) != offset) return WAD_ERROR_FILE_SEEK;
+	if (!ReadFile(reader->fd, buf, length, &rd, 0)) return WAD_ERROR_FILE_READ;
+	STATS_ADD(STATS_SEEKS, 1);
+	STATS_ADD(STATS_READS, 1);
+	STATS_ADD(STATS_BYTES_READ, rd);
+
+	return rd;
+}
+
+void
+wad_reader_close(struct wad_reader *reader)
+{
+	if (reader->fd != INVALID_HANDLE_VALUE) {
+		CloseHandle(reader->fd);
+		reader->fd = INVALID_HANDLE_VALUE;
+	}
+	reader->path = 0;
+}
+
+void
+wad_short_name(char short_name[8 + 1], const char *long_name)
+{
+	int i = 0, j = 0;
+
+	while (i < 8) {
+		char ch = long_name[j];
+		if (ch) {
+			++j;
+			if ((ch >= 'a') && (ch <= 'z')) {
+				ch -= 'a' - 'A';
+			} else if ((ch >= 'A') && (ch <= 'Z')) {
+			} else if ((ch >= '0') && (ch <= '9')) {
+			} else if ((ch == '[') || (ch == ']')) {
+			} else if ((ch == '-') || (ch == '_')) {
+			} else continue;
+		}
+		short_name[i++] = ch;
+	}
+	short_name[i] = '\0';
+}
+
+static const struct {
+	const char *folder;
+	const char *start;
+	const char *end;
+	const char *alias_start;
+	const char *alias_end;
+} namespaces[WAD_NAMESPACE_COUNT] = {
+	{ 0, 0, 0, 0, 0 },
+	{ "flats", "F_START", "F_END", "FF_START", "FF_END" },
+	{ "sprites", "S_START", "S_END", "SS_START", "SS_END" },
+	{ "patches", "P_START", "P_END", "PP_START", "PP_END" },
+	{ "colormaps", "C_START", "C_END", 0, 0 },
+	{ "acs", "A_START", "A_END", 0, 0 },
+	{ "textures", "TX_START", "TX_END", 0, 0 },
+	{ "hires", "HI_START", "HI_END", 0, 0 }
+};
+
+const char *
+wad_namespace_folder(int ns)
+{
+	return namespaces[ns].folder;
+}
+
+const char *
+wad_namespace_marker(int ns, int end)
+{
+	return end ? namespaces[ns].end : namespaces[ns].start;
+}
+
+int
+wad_namespace_of_folder(const char *folder)
+{
+	int i;
+
+	for (i = 1; i < WAD_NAMESPACE_COUNT; ++i) {
+		if (!lstrcmpi(folder, namespaces[i].folder)) return i;
+	}
+	return 0;
+}
+
+int
+wad_namespace_of_marker(const char *name, int *end)
+{
+	int i;
+
+	for (i = 1; i < WAD_NAMESPACE_COUNT; ++i) {
+		*end = 0;
+		if (!lstrcmpi(name, namespaces[i].start)) return i;
+		if (namespaces[i].alias_start && !lstrcmpi(name, namespaces[i].alias_start)) return i;
+		*end = 1;
+		if (!lstrcmpi(name, namespaces[i].end)) return i;
+		if (namespaces[i].alias_end && !lstrcmpi(name, namespaces[i].alias_end)) return i;
+	}
+	*end = 0;
+	return 0;
+}
@@ -40,11 +40,40 @@ struct wad_dentry {
 	char name[8 + 1];
 };
 
+// a byte range of a file holding the payload of one lump
+struct wad_span {
+	const char *path;
+	int offset;
+	int size;
+};
+
+// reads spans, keeping the last file open between calls
+struct wad_reader {
+	const char *path;
+	void *fd;
+};
+
 int wad_open(struct wad *wad, const char *path);
 void wad_close(struct wad *wad);
 
 int wad_seek_first_dentry(const struct wad *wad);
 int wad_read_next_dentry(const struct wad *wad, struct wad_dentry *dentry);
 
+void wad_reader_init(struct wad_reader *reader);
+int wad_reader_read(struct wad_reader *reader, const struct wad_span *span, int pos, void *buf, int length);
+void wad_reader_close(struct wad_reader *reader);
+
+// keeps the characters a lump name may hold, uppercased
+void wad_short_name(char short_name[8 + 1], const char *long_name);
+
+// lumps between a pair of markers, folders of the same name in a pk3;
+// namespace 0 stands for being outside of all of them
+#define WAD_NAMESPACE_COUNT 8
+
+const char *wad_namespace_folder(int ns);
+const char *wad_namespace_marker(int ns, int end);
+int wad_namespace_of_folder(const char *folder);
+int wad_namespace_of_marker(const char *name, int *end);
+
 
 #endif // WAD_HEADER
@@ -1,11 +1,28 @@
 #include "wad.h"
+#include "cache.h"
+#include "diff.h"
+#include "dir.h"
+#include "hash.h"
+#include "import.h"
+#include "layout.h"
+#include "refs.h"
+#include "save.h"
+#include "search.h"
+#include "stats.h"
+#include "store.h"
+#include "watch.h"
+#include "zip.h"
+#include "zwad.h"
 
 #define WIN32_LEAN_AND_MEAN
 #undef UNICODE
 #include <windows.h>
 #include <commctrl.h> // toolbar
 #include <commdlg.h> // file open dialog
+#include <shlobj.h> // folder dialog
+#include <ole2.h> // OleInitialize for it
 #include <stdio.h> // snprintf
+#include <stdlib.h> // qsort
 
 #define TITLE "WAD util"
 
@@ -13,59 +30,75 @@
 
 enum defaults {
 	WINDOW_WIDTH = 640,
-	WINDOW_HEIGHT = 480
+	WINDOW_HEIGHT = 480,
+	NAME_BOX_WIDTH = 60, // dialog units, the search box takes the rest
+	SEARCH_LENGTH = 255,
+	SEARCH_MAX_PATTERNS = 16,
+	RELOAD_DELAY = 250, // ms, lets the other program finish writing
+	ALIGN_BOUNDARY = 4096
+};
+
+enum message {
+	WM_WAD_CHANGED = WM_APP
+};
+
+enum timer {
+	TIMER_RELOAD = 1
 };
 
 enum command {
 	CMD_NEW = 4096,
 	CMD_OPEN,
 	CMD_SAVE,
+	CMD_SAVE_ALIGNED,
+	CMD_SAVE_PRUNED,
 	CMD_LISTBOX,
 	CMD_DELETE,
 	CMD_CLEAR,
 	CMD_MOVE_UP,
 	CMD_MOVE_DOWN,
 	CMD_COPY,
+	CMD_IMPORT,
 	CMD_EDIT,
+	CMD_SEARCH,
 	CMD_RENAME,
+	CMD_FIND,
+	CMD_SELECT,
+	CMD_UNUSED,
+	CMD_DIFF,
+	CMD_PATCH,
+	CMD_DEPOSIT,
+	CMD_REBUILD,
+	CMD_EXPORT_PK3,
+	CMD_IMPORT_PK3,
+	CMD_COMPRESS_ZWAD,
+	CMD_EXTRACT_ZWAD,
+	CMD_VERIFY,
+	CMD_STATS,
+	CMD_STATS_DUMP,
 	CMD_ABOUT
 };
 
 static HINSTANCE inst;
-static HWND hToolbar, hStatus, hList, hEdit;
+static HWND hToolbar, hStatus, hList, hEdit, hSearch;
 
-struct item {
-	struct wad_dentry dentry;
-	char *source;
-};
-
-static int item_count = 0;
-static int item_capacity = 0;
-static struct item *items = 0;
+static struct dir items; // zeroed, the same as dir_init
+static struct dir wad_base; // the directory of the wad as last loaded, items.lumps points into it
+static enum wad_type wad_base_type = WAD_TYPE_PWAD; // a list without a wad may lack anything
 static char wad_path[MAX_PATH];
 static int list_bottom;
+static int verify_save = 0;
+static struct watch wad_watch;
+static struct cache wad_cache;
+static WIN32_FILE_ATTRIBUTE_DATA wad_stamp;
 
 static int
-resize_items(int new_capacity)
+reserve_items(int capacity)
 {
-	int size = sizeof(struct item) * new_capacity;
-
-	if (items) {
-		struct item *p = (struct item *)HeapReAlloc(GetProcessHeap(), 0, items, size);
-		if (!p) {
-			MessageBox(0, "realloc", 0, MB_ICONERROR | MB_OK);
-			return -1;
-		}
-		items = p;
-	} else {
-		items = (struct item *)HeapAlloc(GetProcessHeap(), 0, size);
-		if (!items) {
-			MessageBox(0, "alloc", 0, MB_ICONERROR | MB_OK);
-			return -2;
-		}
+	if (dir_reserve(&items, capacity)) {
+		MessageBox(0, "alloc", 0, MB_ICONERROR | MB_OK);
+		return -1;
 	}
-
-	item_capacity = new_capacity;
 	return 0;
 }
 
@@ -74,14 +107,20 @@ free_items(void)
 {
 	int i;
 
-	for (i = 0; i < item_count; ++i) {
-		if (items[i].source) {
-			HeapFree(GetProcessHeap(), 0, items[i].source);
-			items[i].source = 0;
-		}
+	for (i = 0; i < items.count; ++i) {
+		if (items.sources[i]) HeapFree(GetProcessHeap(), 0, items.sources[i]);
 	}
-	item_count = 0;
-	SendMessage(hList, LB_SETCOUNT, item_count, 0);
+	items.count = 0;
+	SendMessage(hList, LB_SETCOUNT, items.count, 0);
+}
+
+static char *
+dup_string(const char *s)
+{
+	char *p = (char *)HeapAlloc(GetProcessHeap(), 0, lstrlen(s) + 1);
+
+	if (p) lstrcpy(p, s);
+	return p;
 }
 
 static void
@@ -94,6 +133,22 @@ createMenus(HWND hWnd)
 
 		AppendMenu(hMenu, MF_STRING, CMD_OPEN, "&Open\tCtrl+O");
 		AppendMenu(hMenu, MF_STRING, CMD_SAVE, "&Save As\tCtrl+S");
+		AppendMenu(hMenu, MF_STRING, CMD_SAVE_ALIGNED, "Save A&ligned");
+		AppendMenu(hMenu, MF_STRING, CMD_SAVE_PRUNED, "Save Pru&ned");
+		AppendMenu(hMenu, MF_STRING, CMD_VERIFY, "&Verify after Save");
+		AppendMenu(hMenu, MF_STRING, CMD_STATS, "Collect I/O Stat&istics");
+		AppendMenu(hMenu, MF_STRING, CMD_STATS_DUMP, "D&ump Statistics");
+		AppendMenu(hMenu, MF_SEPARATOR, 0, 0);
+		AppendMenu(hMenu, MF_STRING, CMD_DIFF, "&Make Patch");
+		AppendMenu(hMenu, MF_STRING, CMD_PATCH, "&Apply Patch");
+		AppendMenu(hMenu, MF_SEPARATOR, 0, 0);
+		AppendMenu(hMenu, MF_STRING, CMD_DEPOSIT, "&Deposit to Store");
+		AppendMenu(hMenu, MF_STRING, CMD_REBUILD, "&Rebuild from Store");
+		AppendMenu(hMenu, MF_SEPARATOR, 0, 0);
+		AppendMenu(hMenu, MF_STRING, CMD_EXPORT_PK3, "E&xport PK3");
+		AppendMenu(hMenu, MF_STRING, CMD_IMPORT_PK3, "Convert PK3 to &WAD");
+		AppendMenu(hMenu, MF_STRING, CMD_COMPRESS_ZWAD, "Com&press to ZWAD");
+		AppendMenu(hMenu, MF_STRING, CMD_EXTRACT_ZWAD, "Convert ZWAD &to WAD");
 		AppendMenu(hMenu, MF_SEPARATOR, 0, 0);
 		AppendMenu(hMenu, MF_STRING, CMD_CLEAR, "&Clear");
 		AppendMenu(hMenu, MF_SEPARATOR, 0, 0);
@@ -106,8 +161,12 @@ createMenus(HWND hWnd)
 		HMENU hMenu = CreateMenu();
 
 		AppendMenu(hMenu, MF_STRING, CMD_NEW, "&New\tInsert");
+		AppendMenu(hMenu, MF_STRING, CMD_IMPORT, "&Import Folder");
 		AppendMenu(hMenu, MF_STRING, CMD_DELETE, "&Delete\tDelete");
 		AppendMenu(hMenu, MF_STRING, CMD_COPY, "&Copy to file");
+		AppendMenu(hMenu, MF_STRING, CMD_FIND, "&Find contents\tCtrl+F");
+		AppendMenu(hMenu, MF_STRING, CMD_SELECT, "&Select Matching\tCtrl+M");
+		AppendMenu(hMenu, MF_STRING, CMD_UNUSED, "Select Un&referenced");
 		AppendMenu(hMenu, MF_SEPARATOR, 0, 0);
 		AppendMenu(hMenu, MF_STRING, CMD_MOVE_UP, "Move &Up\tCtrl+Up");
 		AppendMenu(hMenu, MF_STRING, CMD_MOVE_DOWN, "Move D&own\tCtrl+Down");
@@ -132,6 +191,7 @@ createToolbar(HWND hWnd)
 		{ CMD_NEW, STD_FILENEW },
 		{ CMD_DELETE, STD_DELETE },
 		{ CMD_COPY, STD_COPY },
+		{ CMD_FIND, STD_FIND },
 		{ CMD_MOVE_UP, STD_UNDO },
 		{ CMD_MOVE_DOWN, STD_REDOW },
 	};
@@ -193,6 +253,9 @@ createClient(HWND hWnd)
 	orig_list_wndproc = (WNDPROC)SetWindowLong(hList, GWL_WNDPROC, (long)new_list_wndproc);
 	hEdit = CreateWindow("edit", 0, WS_CHILD | WS_TABSTOP | WS_VISIBLE | ES_UPPERCASE, 0, 0, 0, 0, hWnd, (HMENU)CMD_EDIT, inst, 0);
 	SendMessage(hEdit, EM_LIMITTEXT, 8, 0);
+	// free text, unlike the name box
+	hSearch = CreateWindow("edit", 0, WS_CHILD | WS_TABSTOP | WS_VISIBLE | ES_AUTOHSCROLL, 0, 0, 0, 0, hWnd, (HMENU)CMD_SEARCH, inst, 0);
+	SendMessage(hSearch, EM_LIMITTEXT, SEARCH_LENGTH, 0);
 //	hRename = CreateWindow("button", "rename", WS_CHILD | WS_TABSTOP | WS_VISIBLE | BS_DEFPUSHBUTTON, 0, 0, 0, 0, hWnd, (HMENU)CMD_RENAME, inst, 0);
 //	SendMessage(hList, LB_SETTABSTOPS, ARRAY_LENGTH(tabstops), (LPARAM)tabstops);
 //	hDetails = CreateWindow("static", 0, WS_CHILD | WS_VISIBLE, 0, 0, 0, 0, hWnd, 0, inst, 0);
@@ -223,109 +286,338 @@ openWad(HWND hWnd)
 	ofn.lpstrDefExt = "wad";
 
 	if (GetOpenFileName(&ofn)) {
-		struct wad w;
-		int ret;
+		struct cache cache;
 		int i;
 
-		ret = wad_open(&w, filename);
-		if (ret != WAD_SUCCESS) {
+		// the wad open now stays as it is when this one fails
+		if (cache_open(&cache, filename)) {
 			MessageBox(hWnd, filename, 0, MB_ICONERROR | MB_OK);
 			return;
 		}
+		cache_close(&wad_cache);
+		wad_cache = cache;
 		free_items();
-		resize_items(w.hd.lump_count);
-		wad_seek_first_dentry(&w);
-		for (i = w.hd.lump_count; i; --i) {
-			char buf[128];
-
-			wad_read_next_dentry(&w, &items[item_count].dentry);
-			items[item_count].source = 0;
-			sprintf_s(
-				buf, sizeof(buf),
-				"%s\t%d\t%d",
-				items[item_count].dentry.name,
-				items[item_count].dentry.offset,
-				items[item_count].dentry.size
-			);
-			++item_count;
+		wad_base.count = 0;
+		wad_base_type = wad_cache.hd->type;
+		if (reserve_items(wad_cache.hd->lump_count) || dir_reserve(&wad_base, wad_cache.hd->lump_count)) return;
+		for (i = 0; i < wad_cache.hd->lump_count; ++i) {
+			struct wad_dentry d;
+
+			cache_dentry(&wad_cache, i, &d);
+			dir_append(&items, &d, 0, i);
+			dir_append(&wad_base, &d, 0, i);
 		}
-		SendMessage(hList, LB_SETCOUNT, item_count, 0);
+		SendMessage(hList, LB_SETCOUNT, items.count, 0);
 	    SendMessage(hStatus, SB_SETTEXT, 1, (LPARAM)filename);
 		lstrcpy(wad_path, filename);
+		GetFileAttributesEx(wad_path, GetFileExInfoStandard, &wad_stamp);
+		watch_start(&wad_watch, hWnd, WM_WAD_CHANGED, wad_path);
+	}
+}
+
+static int
+wad_changed(void)
+{
+	WIN32_FILE_ATTRIBUTE_DATA fad;
+
+	// a file being replaced may be missing for a moment, the next event catches it
+	if (!GetFileAttributesEx(wad_path, GetFileExInfoStandard, &fad)) return 0;
+	return (fad.nFileSizeLow != wad_stamp.nFileSizeLow) ||
+		(fad.nFileSizeHigh != wad_stamp.nFileSizeHigh) ||
+		(fad.ftLastWriteTime.dwLowDateTime != wad_stamp.ftLastWriteTime.dwLowDateTime) ||
+		(fad.ftLastWriteTime.dwHighDateTime != wad_stamp.ftLastWriteTime.dwHighDateTime);
+}
+
+struct reload_key {
+	int offset;
+	int size;
+	char name[8 + 1];
+	int index;
+};
+
+static int
+compare_by_place(const void *a, const void *b)
+{
+	const struct reload_key *ka = (const struct reload_key *)a;
+	const struct reload_key *kb = (const struct reload_key *)b;
+
+	if (ka->offset != kb->offset) return (ka->offset < kb->offset) ? -1 : 1;
+	if (ka->size != kb->size) return (ka->size < kb->size) ? -1 : 1;
+	return ka->index - kb->index;
+}
+
+static int
+compare_by_name(const void *a, const void *b)
+{
+	const struct reload_key *ka = (const struct reload_key *)a;
+	const struct reload_key *kb = (const struct reload_key *)b;
+	int ret = lstrcmp(ka->name, kb->name);
+
+	return ret ? ret : (ka->index - kb->index);
+}
+
+static int
+lower_bound(const struct reload_key *keys, int n, const struct reload_key *key, int (*compare)(const void *, const void *))
+{
+	int lo = 0, hi = n;
+
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (compare(keys + mid, key) < 0) lo = mid + 1; else hi = mid;
+	}
+	return lo;
+}
+
+// pairs the old lump with an unused new one: same place and name, same name, then same place
+static int
+find_reloaded(const struct wad_dentry *d, int pass, const struct reload_key *by_place, const struct reload_key *by_name, int n, const int *new_match)
+{
+	struct reload_key key;
+	int k;
+
+	key.offset = d->offset;
+	key.size = d->size;
+	lstrcpy(key.name, d->name);
+	key.index = -1;
+
+	if (pass == 1) {
+		for (k = lower_bound(by_name, n, &key, compare_by_name); (k < n) && !lstrcmp(by_name[k].name, key.name); ++k) {
+			if (new_match[by_name[k].index] < 0) return by_name[k].index;
+		}
+		return -1;
+	}
+
+	for (k = lower_bound(by_place, n, &key, compare_by_place); k < n; ++k) {
+		if ((by_place[k].offset != key.offset) || (by_place[k].size != key.size)) break;
+		if (new_match[by_place[k].index] >= 0) continue;
+		if (!pass && lstrcmp(by_place[k].name, key.name)) continue;
+		return by_place[k].index;
+	}
+	return -1;
+}
+
+// re-reads the directory only and merges it into the list, keeping added
+// lumps, renames, order and selection: what changed between the wad as last
+// loaded and the wad on disk is applied to the list, so a lump deleted here
+// stays deleted unless it changed on disk too
+static void
+reload_wad(HWND hWnd)
+{
+	struct wad w;
+	struct wad_dentry *nd = 0;
+	struct reload_key *by_place = 0, *by_name = 0;
+	struct dir merged, base;
+	int *base_match = 0, *new_match = 0, *local = 0;
+	char *inserted = 0, *new_sel = 0;
+	int patched = 0, added = 0, removed = 0;
+	int top = (int)SendMessage(hList, LB_GETTOPINDEX, 0, 0);
+	int n, i, j, b, pass;
+	char buf[64];
+
+	dir_init(&merged);
+	dir_init(&base);
+	if (wad_open(&w, wad_path) != WAD_SUCCESS) return;
+	n = w.hd.lump_count;
+	wad_base_type = w.hd.type;
+	nd = (struct wad_dentry *)HeapAlloc(GetProcessHeap(), 0, sizeof(struct wad_dentry) * (n + 1));
+	if (!nd || (wad_seek_first_dentry(&w) != WAD_SUCCESS)) {
 		wad_close(&w);
+		goto cleanup;
+	}
+	for (j = 0; j < n; ++j) {
+		if (wad_read_next_dentry(&w, nd + j) != WAD_SUCCESS) break;
 	}
+	wad_close(&w);
+	if (j < n) goto cleanup; // caught in the middle of a write, the next event retries
+
+	by_place = (struct reload_key *)HeapAlloc(GetProcessHeap(), 0, sizeof(struct reload_key) * (n + 1));
+	by_name = (struct reload_key *)HeapAlloc(GetProcessHeap(), 0, sizeof(struct reload_key) * (n + 1));
+	new_match = (int *)HeapAlloc(GetProcessHeap(), 0, sizeof(int) * (n + 1));
+	inserted = (char *)HeapAlloc(GetProcessHeap(), 0, n + 1);
+	base_match = (int *)HeapAlloc(GetProcessHeap(), 0, sizeof(int) * (wad_base.count + 1));
+	local = (int *)HeapAlloc(GetProcessHeap(), 0, sizeof(int) * (wad_base.count + 1));
+	new_sel = (char *)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, items.count + n + 1);
+	if (!by_place || !by_name || !new_match || !inserted || !base_match || !local || !new_sel) goto cleanup;
+	if (dir_reserve(&merged, items.count + n + 1) || dir_reserve(&base, n + 1)) goto cleanup;
+
+	for (j = 0; j < n; ++j) {
+		by_place[j].offset = nd[j].offset;
+		by_place[j].size = nd[j].size;
+		lstrcpy(by_place[j].name, nd[j].name);
+		by_place[j].index = j;
+		new_match[j] = -1;
+	}
+	CopyMemory(by_name, by_place, sizeof(struct reload_key) * n);
+	qsort(by_place, n, sizeof(struct reload_key), compare_by_place);
+	qsort(by_name, n, sizeof(struct reload_key), compare_by_name);
+
+	// the wad as last loaded against the wad on disk, renames here don't count
+	for (b = 0; b < wad_base.count; ++b) {
+		base_match[b] = -1;
+		local[b] = -1;
+	}
+	for (pass = 0; pass < 3; ++pass) {
+		for (b = 0; b < wad_base.count; ++b) {
+			struct wad_dentry d;
+
+			if (base_match[b] >= 0) continue;
+			dir_dentry(&wad_base, b, &d);
+			j = find_reloaded(&d, pass, by_place, by_name, n, new_match);
+			if (j >= 0) {
+				base_match[b] = j;
+				new_match[j] = b;
+			}
+		}
+	}
+	for (i = 0; i < items.count; ++i) {
+		if (items.lumps[i] >= 0) local[items.lumps[i]] = i;
+	}
+
+	// new lumps, and those deleted here but grown or shrunk on disk, go in
+	// behind the lump they follow on disk; the directory can't tell a rewrite
+	// of the same size, so such a lump stays deleted
+	for (j = 0; j < n; ++j) {
+		b = new_match[j];
+		inserted[j] = (b < 0) || ((local[b] < 0) && (nd[j].size != wad_base.sizes[b]));
+	}
+	for (j = 0; (j < n) && ((new_match[j] < 0) || (local[new_match[j]] < 0)); ++j) {
+		if (!inserted[j]) continue;
+		dir_append(&merged, nd + j, 0, j);
+		++added;
+	}
+	for (i = 0; i < items.count; ++i) {
+		struct wad_dentry d;
+
+		dir_dentry(&items, i, &d);
+		if (items.lumps[i] < 0) {
+			new_sel[merged.count] = SendMessage(hList, LB_GETSEL, i, 0) > 0;
+			dir_append(&merged, &d, items.sources[i], -1);
+			continue;
+		}
+		j = base_match[items.lumps[i]];
+		if (j < 0) {
+			++removed;
+			continue;
+		}
+		if ((nd[j].offset != d.offset) || (nd[j].size != d.size)) ++patched;
+		d.offset = nd[j].offset;
+		d.size = nd[j].size;
+		new_sel[merged.count] = SendMessage(hList, LB_GETSEL, i, 0) > 0;
+		dir_append(&merged, &d, 0, j);
+		for (++j; (j < n) && ((new_match[j] < 0) || (local[new_match[j]] < 0)); ++j) {
+			if (!inserted[j]) continue;
+			dir_append(&merged, nd + j, 0, j);
+			++added;
+		}
+	}
+	for (j = 0; j < n; ++j) {
+		dir_append(&base, nd + j, 0, j);
+	}
+
+	// the sources went along to the merged list
+	dir_free(&items);
+	items = merged;
+	dir_init(&merged);
+	dir_free(&wad_base);
+	wad_base = base;
+	dir_init(&base);
+
+	SendMessage(hList, LB_SETCOUNT, items.count, 0);
+	for (i = 0; i < items.count; ++i) {
+		if (new_sel[i]) SendMessage(hList, LB_SETSEL, TRUE, i);
+	}
+	if (top >= items.count) top = items.count - 1;
+	SendMessage(hList, LB_SETTOPINDEX, top, 0);
+
+	// the old views would show the replaced file
+	cache_close(&wad_cache);
+	GetFileAttributesEx(wad_path, GetFileExInfoStandard, &wad_stamp);
+	if (cache_open(&wad_cache, wad_path)) {
+		sprintf_s(buf, sizeof(buf), "+%d -%d ~%d, lumps read from the file", added, removed, patched);
+	} else {
+		sprintf_s(buf, sizeof(buf), "+%d -%d ~%d", added, removed, patched);
+	}
+	SendMessage(hStatus, SB_SETTEXT, 0, (LPARAM)buf);
+
+cleanup:
+	if (nd) HeapFree(GetProcessHeap(), 0, nd);
+	if (by_place) HeapFree(GetProcessHeap(), 0, by_place);
+	if (by_name) HeapFree(GetProcessHeap(), 0, by_name);
+	if (new_match) HeapFree(GetProcessHeap(), 0, new_match);
+	if (inserted) HeapFree(GetProcessHeap(), 0, inserted);
+	if (base_match) HeapFree(GetProcessHeap(), 0, base_match);
+	if (local) HeapFree(GetProcessHeap(), 0, local);
+	if (new_sel) HeapFree(GetProcessHeap(), 0, new_sel);
+	dir_free(&merged);
+	dir_free(&base);
 }
 
 static void
 list_select()
 {
 	unsigned sel = (unsigned)SendMessage(hList, LB_GETCURSEL, 0, 0);
-	if (sel < (unsigned)item_count) {
+	if (sel < (unsigned)items.count) {
 		char buf[32];
-		struct wad_dentry *d = &items[sel].dentry;
-		SetWindowText(hEdit, d->name);
-		sprintf_s(buf, sizeof(buf), "%d/%d", sel + 1, item_count);
+		struct wad_dentry d;
+		dir_dentry(&items, sel, &d);
+		SetWindowText(hEdit, d.name);
+		sprintf_s(buf, sizeof(buf), "%d/%d", sel + 1, items.count);
 	    SendMessage(hStatus, SB_SETTEXT, 0, (LPARAM)buf);
 	}
 }
 
-static void
-list_delete()
+// the selected lines as a flag each, 0 when out of memory
+static char *
+selected_items(void)
 {
+	char *selected = (char *)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, items.count + 1);
 	int count = (int)SendMessage(hList, LB_GETSELCOUNT, 0, 0);
+	int *sels;
+	int i;
 
-	if ((count == LB_ERR) || (count < 0)) return;
-
-	while (count > 0) {
-		int sels[8];
-		int j;
-		int ret = (int)SendMessage(hList, LB_GETSELITEMS, ARRAY_LENGTH(sels), (LPARAM)sels);
-
-		if (ret == LB_ERR) break;
-		for (j = ret - 1; j >= 0; --j) {
-			int sel = sels[j];
-			int i;
-
-			if (items[sel].source) {
-				HeapFree(GetProcessHeap(), 0, items[sel].source);
-			}
-//			SetWindowText(hDetails, "");
-			for (i = sel; i < item_count - 1; ++i) {
-				items[i] = items[i + 1];
-			}
-			--item_count;
-			--count;
-		}
+	if (!selected || (count <= 0)) return selected;
+	sels = (int *)HeapAlloc(GetProcessHeap(), 0, sizeof(int) * count);
+	if (!sels) {
+		HeapFree(GetProcessHeap(), 0, selected);
+		return 0;
 	}
+	count = (int)SendMessage(hList, LB_GETSELITEMS, count, (LPARAM)sels);
+	for (i = 0; i < count; ++i) {
+		if ((unsigned)sels[i] < (unsigned)items.count) selected[sels[i]] = 1;
+	}
+	HeapFree(GetProcessHeap(), 0, sels);
+	return selected;
+}
 
-	{
-		int top = SendMessage(hList, LB_GETTOPINDEX, 0, 0);
-		SendMessage(hList, LB_SETCOUNT, item_count, 0);
-		if (top >= item_count) top = item_count - 1;
-		SendMessage(hList, LB_SETTOPINDEX, top, 0);
+static void
+show_selected(const char *selected)
+{
+	int i;
+
+	SendMessage(hList, LB_SETSEL, FALSE, -1);
+	for (i = 0; i < items.count; ++i) {
+		if (selected[i]) SendMessage(hList, LB_SETSEL, TRUE, i);
 	}
 }
 
 static void
-gen_short_name(char short_name[8 + 1], const char *long_name)
+list_delete()
 {
-	int i = 0, j = 0;
+	char *marked = selected_items();
+	int top;
+	int i;
 
-	while (i < 8) {
-		char ch = long_name[j];
-		if (ch) {
-			++j;
-			if ((ch >= 'a') && (ch <= 'z')) {
-				ch -= 'a' - 'A';
-			} else if ((ch >= 'A') && (ch <= 'Z')) {
-			} else if ((ch >= '0') && (ch <= '9')) {
-			} else if ((ch == '[') || (ch == ']')) {
-			} else if ((ch == '-') || (ch == '_')) {
-			} else continue;
-		}
-		short_name[i++] = ch;
+	if (!marked) return;
+	for (i = 0; i < items.count; ++i) {
+		if (marked[i] && items.sources[i]) HeapFree(GetProcessHeap(), 0, items.sources[i]);
 	}
-	short_name[i] = '\0';
+	dir_remove(&items, marked);
+	HeapFree(GetProcessHeap(), 0, marked);
+
+	top = SendMessage(hList, LB_GETTOPINDEX, 0, 0);
+	SendMessage(hList, LB_SETCOUNT, items.count, 0);
+	if (top >= items.count) top = items.count - 1;
+	SendMessage(hList, LB_SETTOPINDEX, top, 0);
 }
 
 static void
@@ -348,150 +640,348 @@ list_add(HWND hWnd)
 
 	if (GetOpenFileName(&ofn)) {
 		HANDLE fd = CreateFile(path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, 0, 0);
+		struct wad_dentry d;
+		char *source;
 
 		if (fd == INVALID_HANDLE_VALUE) {
 			MessageBox(hWnd, "Failed to open file", 0, MB_ICONERROR | MB_OK);
 			return;
 		}
-		if (item_capacity == item_count) {
-			resize_items(item_capacity ? (item_capacity * 2) : 8);
-		}
 		// TODO: insert it before selection
-		items[item_count].dentry.size = GetFileSize(fd, 0);
+		d.size = GetFileSize(fd, 0);
 		CloseHandle(fd);
-		items[item_count].dentry.offset = 0;
-		gen_short_name(items[item_count].dentry.name, filename);
-		items[item_count].source = (char *)HeapAlloc(GetProcessHeap(), 0, lstrlen(path));
-		lstrcpy(items[item_count].source, path);
-		++item_count;
-		SendMessage(hList, LB_SETCOUNT, item_count, 0);
+		d.offset = 0;
+		wad_short_name(d.name, filename);
+		source = dup_string(path);
+		if (!source || (dir_append(&items, &d, source, -1) < 0)) {
+			if (source) HeapFree(GetProcessHeap(), 0, source);
+			MessageBox(hWnd, "alloc", 0, MB_ICONERROR | MB_OK);
+			return;
+		}
+		SendMessage(hList, LB_SETCOUNT, items.count, 0);
 	}
 }
 
-static int
-copy_between_fds(HANDLE dest, HANDLE src, size_t length)
+// the room is reserved beforehand
+static void
+add_marker(const char *name)
 {
-	char buf[BUFSIZ];
-	DWORD rd, wr;
-	int count = 0;
+	struct wad_dentry d;
 
-	while (length) {
-		size_t chunk_size = sizeof(buf);
-		if (chunk_size > length) chunk_size = length;
-		if (!ReadFile(src, buf, chunk_size, &rd, 0)) break;
-		if (!WriteFile(dest, buf, rd, &wr, 0)) break;
-		count += wr;
-		length -= wr;
-		if (wr != rd) break;
+	lstrcpy(d.name, name);
+	d.offset = 0;
+	d.size = 0;
+	dir_append(&items, &d, 0, -1);
+}
+
+static void
+import_folder(HWND hWnd)
+{
+	BROWSEINFO bi;
+	LPITEMIDLIST pidl;
+	struct import_list list;
+	char path[MAX_PATH];
+	char buf[128];
+	int ns = 0;
+	int ok;
+	int i;
+
+	ZeroMemory(&bi, sizeof(bi));
+	bi.hwndOwner = hWnd;
+	bi.lpszTitle = "Import every file below this folder";
+	bi.ulFlags = BIF_RETURNONLYFSDIRS | BIF_NEWDIALOGSTYLE;
+	pidl = SHBrowseForFolder(&bi);
+	if (!pidl) return;
+	ok = SHGetPathFromIDList(pidl, path);
+	CoTaskMemFree(pidl);
+	if (!ok) return;
+
+	if (import_scan(path, &list)) {
+		MessageBox(hWnd, "Failed to read folder.", 0, MB_ICONERROR | MB_OK);
+		return;
+	}
+	if (reserve_items(items.count + list.count + list.markers)) {
+		import_free(&list);
+		return;
+	}
+	for (i = 0; i < list.count; ++i) {
+		struct import_file *f = list.files + i;
+		struct wad_dentry d;
+
+		if (f->ns != ns) {
+			if (ns) add_marker(wad_namespace_marker(ns, !0));
+			ns = f->ns;
+			add_marker(wad_namespace_marker(ns, 0));
+		}
+		lstrcpy(d.name, f->name);
+		d.offset = 0;
+		d.size = f->size;
+		dir_append(&items, &d, f->path, -1);
+		f->path = 0;
 	}
-	return count;
+	if (ns) add_marker(wad_namespace_marker(ns, !0));
+	sprintf_s(buf, sizeof(buf), "%d files imported, %d too big", list.count, list.skipped);
+	import_free(&list);
+
+	SendMessage(hList, LB_SETCOUNT, items.count, 0);
+	SendMessage(hStatus, SB_SETTEXT, 0, (LPARAM)buf);
 }
 
+// writes a lump of the open wad straight from its mapping
 static int
-copy_from_file(HANDLE dest, const char *filename)
+copy_from_cache(void *ctx, void *dest, int offset, int size)
 {
-	HANDLE src = CreateFile(filename, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, 0, 0);
+	struct cache_view view;
+	DWORD wr;
 	int ret = -1;
 
-	if (src) {
-		size_t size = GetFileSize(src, 0);
-		ret = copy_between_fds(dest, src, size);
-		if ((ret > 0) && (ret != size)) ret = -1;
-		CloseHandle(src);
-	}
+	if (!size) return 0;
+	if (cache_map((struct cache *)ctx, offset, size, &view)) return -1;
+	if (WriteFile(dest, view.data, size, &wr, 0) && (wr == (DWORD)size)) ret = wr;
+	cache_unmap(&view);
+	STATS_ADD(STATS_WRITES, 1);
+	STATS_ADD(STATS_BYTES_WRITTEN, wr);
 	return ret;
 }
 
-static int
-save_wad_to(const char *path)
+static void
+item_span(int i, struct wad_span *span)
 {
-	HANDLE fd = CreateFile(path, GENERIC_WRITE, 0, 0, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, 0);
-	HANDLE wfd = 0;
-	DWORD wr;
-	struct wad_header hd;
-	int ret;
+	if (items.sources[i]) {
+		span->path = items.sources[i];
+		span->offset = 0;
+	} else {
+		span->path = wad_path;
+		span->offset = items.offsets[i];
+	}
+	span->size = items.sizes[i];
+}
+
+// lumps are read from path at the offsets they were saved at when it is
+// given, the skipped ones are not in it and hash as empty
+static struct hash_lump *
+hash_items(const char *path, const char *skip, const int *offsets)
+{
+	struct wad_span *spans = (struct wad_span *)HeapAlloc(GetProcessHeap(), 0, sizeof(struct wad_span) * (items.count + 1));
+	struct hash_lump *hashes = (struct hash_lump *)HeapAlloc(GetProcessHeap(), 0, sizeof(struct hash_lump) * (items.count + 1));
 	int i;
 
-	if (!fd) return -1;
+	if (spans && hashes) {
+		for (i = 0; i < items.count; ++i) {
+			item_span(i, spans + i);
+			if (path) {
+				spans[i].path = path;
+				spans[i].offset = offsets[i];
+				if (skip && skip[i]) spans[i].size = 0;
+			}
+		}
+		if (hash_spans(spans, items.count, HASH_CRC32C | HASH_XXH64, hashes)) {
+			HeapFree(GetProcessHeap(), 0, hashes);
+			hashes = 0;
+		}
+	} else if (hashes) {
+		HeapFree(GetProcessHeap(), 0, hashes);
+		hashes = 0;
+	}
+	if (spans) HeapFree(GetProcessHeap(), 0, spans);
+	return hashes;
+}
 
-	if (wad_path[0]) {
-		wfd = CreateFile(wad_path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, 0, 0);
+// returns the number of lumps that differ from the expected hashes
+static int
+verify_saved(const char *path, const struct hash_lump *expected, const char *skip, const int *offsets)
+{
+	struct hash_lump *actual = hash_items(path, skip, offsets);
+	int bad = 0;
+	int i;
+
+	if (!actual) return -1;
+	for (i = 0; i < items.count; ++i) {
+		if (skip && skip[i]) continue;
+		if ((actual[i].crc32c != expected[i].crc32c) || (actual[i].xxh64 != expected[i].xxh64)) ++bad;
 	}
+	HeapFree(GetProcessHeap(), 0, actual);
+	return bad;
+}
 
-	ret = -1;
+// packs the lumps back to back unless a layout is given, leaving out the
+// ones marked in skip; the list keeps naming the open wad, where each lump
+// went in the new file is left in saved
+static int
+save_wad_to(const char *path, const struct layout_options *layout, struct layout_stats *stats, const char *skip, int *saved)
+{
+	struct save_options options;
+
+	options.wad_path = wad_path[0] ? wad_path : 0;
+	options.layout = layout;
+	options.skip = skip;
+	options.copy = wad_cache.lumps ? copy_from_cache : 0;
+	options.ctx = &wad_cache;
+	return save_dir(path, &items, &options, saved, stats);
+}
 
-	hd.type = WAD_TYPE_IWAD;
-	hd.lump_count = item_count;
-	hd.directory_offset = 0; // we don't know yet
-	if (!WriteFile(fd, &hd, WAD_HEADER_SIZE, &wr, 0)) goto cleanup;
-	if (wr != WAD_HEADER_SIZE) goto cleanup;
+static void
+report_layout(HWND hWnd, const char *title, const struct layout_options *layout, const struct layout_stats *stats)
+{
+	char buf[256];
+	int packed = WAD_HEADER_SIZE + WAD_DENTRY_SIZE * items.count;
+	int permille;
+	int i;
 
-	for (i = 0; i < item_count; ++i) {
-		struct item *it = items + i;
-		int final_offset = SetFilePointer(fd, 0, 0, FILE_CURRENT);
+	for (i = 0; i < items.count; ++i) {
+		packed += items.sizes[i];
+	}
+	permille = MulDiv(stats->padding, 1000, packed);
+	sprintf_s(
+		buf, sizeof(buf),
+		"%d lumps aligned to %d bytes, %d packed into the padding\n"
+		"%d bytes of padding (%d.%d%%)\n"
+		"%d blocks to read the aligned lumps instead of %d",
+		stats->aligned, layout->alignment, stats->packed,
+		stats->padding, permille / 10, permille % 10,
+		stats->pages_after, stats->pages_before
+	);
+	MessageBox(hWnd, buf, title, MB_ICONINFORMATION | MB_OK);
+}
 
-		if (it->source) {
-			ret = copy_from_file(fd, it->source);
-		} else {
-			if (SetFilePointer(wfd, it->dentry.offset, 0, FILE_BEGIN) != it->dentry.offset) {
-				ret = -1;
-				goto cleanup;
-			}
-			ret = copy_between_fds(fd, wfd, it->dentry.size);
-			if ((ret > 0) && (ret != it->dentry.size)) ret = -1;
-		}
-		if (ret < 0) goto cleanup;
-		it->dentry.offset = it->dentry.size ? final_offset : 0;
+// the reference graph of the lumps in the list
+static int
+build_refs(HWND hWnd, struct refs *refs)
+{
+	struct wad_dentry *dentries;
+	struct wad_span *spans;
+	int ret = -1;
+	int i;
+
+	dentries = (struct wad_dentry *)HeapAlloc(GetProcessHeap(), 0, sizeof(struct wad_dentry) * (items.count + 1));
+	spans = (struct wad_span *)HeapAlloc(GetProcessHeap(), 0, sizeof(struct wad_span) * (items.count + 1));
+	if (!dentries || !spans) {
+		MessageBox(hWnd, "alloc", 0, MB_ICONERROR | MB_OK);
+		goto cleanup;
+	}
+	for (i = 0; i < items.count; ++i) {
+		dir_dentry(&items, i, dentries + i);
+		item_span(i, spans + i);
 	}
-	hd.directory_offset = SetFilePointer(fd, 0, 0, FILE_CURRENT);
-	for (i = 0; i < item_count; ++i) {
-		struct item *it = items + i;
-		if (!WriteFile(fd, &it->dentry, WAD_DENTRY_SIZE, &wr, 0)) goto cleanup;
-		if (wr != WAD_DENTRY_SIZE) goto cleanup;
+
+	ret = refs_build(refs, wad_base_type, dentries, spans, items.count);
+	if (ret == REFS_ERROR_FORMAT) {
+		MessageBox(hWnd, "PNAMES or a TEXTURE lump is damaged.", 0, MB_ICONERROR | MB_OK);
+	} else if (ret) {
+		MessageBox(hWnd, "Failed to read lumps.", 0, MB_ICONERROR | MB_OK);
 	}
-	SetFilePointer(fd, 0, 0, FILE_BEGIN);
-	if (!WriteFile(fd, &hd, WAD_HEADER_SIZE, &wr, 0)) goto cleanup;
-	if (wr != WAD_HEADER_SIZE) goto cleanup;
 
-	ret = 0;
 cleanup:
-	if (wfd) CloseHandle(wfd);
-	CloseHandle(fd);
+	if (dentries) HeapFree(GetProcessHeap(), 0, dentries);
+	if (spans) HeapFree(GetProcessHeap(), 0, spans);
 	return ret;
 }
 
 static void
-save_wad(HWND hWnd)
+report_saved(HWND hWnd, const char *what, const struct refs *pruned)
+{
+	char buf[160];
+
+	if (pruned) {
+		sprintf_s(
+			buf, sizeof(buf), "%s, %d unused patches and %d unused flats (%d bytes) left out.",
+			what, pruned->unused_patches, pruned->unused_flats, pruned->unused_size
+		);
+	} else {
+		sprintf_s(buf, sizeof(buf), "%s.", what);
+	}
+	MessageBox(hWnd, buf, "Report", MB_ICONINFORMATION | MB_OK);
+}
+
+// prune leaves out the patches and flats nothing refers to
+static void
+save_wad(HWND hWnd, int aligned, int prune)
 {
 	OPENFILENAME ofn;
 	char path[MAX_PATH] = "";
-
+	char buf[64];
+	struct layout_options options, *layout = 0;
+	struct layout_stats stats;
+	struct refs refs;
+	struct hash_lump *expected = 0;
+	int *saved = 0;
+	int bad = 0;
+
+	ZeroMemory(&refs, sizeof(refs));
 	ZeroMemory(&ofn, sizeof(ofn));
 	ofn.lStructSize = sizeof(ofn);
 	ofn.hwndOwner = hWnd;
 	ofn.hInstance = inst;
-	ofn.lpstrFilter = "WAD Files\0*.wad\0";
+	ofn.lpstrFilter = aligned
+		? "WAD, 4 KiB Pages\0*.wad\0WAD, 64 KiB Granules\0*.wad\0WAD, 512 Byte Sectors\0*.wad\0"
+		: "WAD Files\0*.wad\0";
 	ofn.lpstrFile = path;
 	ofn.nMaxFile = sizeof(path);
 	ofn.Flags = 0;
 
-	if (GetSaveFileName(&ofn)) {
-		DWORD attr = GetFileAttributes(path);
-		if (attr != 0xffffffff) {
-			if (!lstrcmp(path, wad_path)) {
-				MessageBox(hWnd, "Cannot move a file to itself.", 0, MB_ICONERROR | MB_OK);
-				return;
-			}
-			if (MessageBox(hWnd, "Overwrite?", "File exists", MB_YESNO | MB_ICONQUESTION) != IDYES) {
-				return;
-			}
+	if (!GetSaveFileName(&ofn)) return;
+	if (GetFileAttributes(path) != 0xffffffff) {
+		if (!lstrcmp(path, wad_path)) {
+			MessageBox(hWnd, "Cannot move a file to itself.", 0, MB_ICONERROR | MB_OK);
+			return;
 		}
-		if (save_wad_to(path)) {
-			MessageBox(hWnd, "Failed to save wad file.", 0, MB_ICONERROR | MB_OK);
-		} else {
-			MessageBox(hWnd, "File saved.", "Report", MB_ICONINFORMATION | MB_OK);
+		if (MessageBox(hWnd, "Overwrite?", "File exists", MB_YESNO | MB_ICONQUESTION) != IDYES) {
+			return;
+		}
+	}
+	if (aligned) {
+		switch (ofn.nFilterIndex) {
+		case 2: options.alignment = 65536; break;
+		case 3: options.alignment = 512; break;
+		default: options.alignment = ALIGN_BOUNDARY; break;
+		}
+		// anything smaller costs less to pack than to pad
+		options.threshold = options.alignment;
+		layout = &options;
+	}
+	if (prune && build_refs(hWnd, &refs)) return;
+	if (prune && !(refs.checked & (REFS_PATCHES | REFS_FLATS))) {
+		if (MessageBox(
+			hWnd,
+			(wad_base_type == WAD_TYPE_IWAD)
+				? "There is nothing to check the patches and flats against, nothing will be left out. Save anyway?"
+				: "The maps and textures of the IWAD may use the patches and flats of a PWAD, nothing will be left out. Save anyway?",
+			"Save Pruned", MB_YESNO | MB_ICONQUESTION
+		) != IDYES) {
+			refs_free(&refs);
+			return;
+		}
+	}
+	saved = (int *)HeapAlloc(GetProcessHeap(), 0, sizeof(int) * (items.count + 1));
+	if (!saved) {
+		MessageBox(hWnd, "alloc", 0, MB_ICONERROR | MB_OK);
+		goto cleanup;
+	}
+	if (verify_save) {
+		expected = hash_items(0, 0, 0);
+		if (!expected) {
+			MessageBox(hWnd, "Failed to read lumps.", 0, MB_ICONERROR | MB_OK);
+			goto cleanup;
 		}
 	}
+
+	if (save_wad_to(path, layout, &stats, refs.unused, saved)) {
+		MessageBox(hWnd, "Failed to save wad file.", 0, MB_ICONERROR | MB_OK);
+	} else if (expected && ((bad = verify_saved(path, expected, refs.unused, saved)) < 0)) {
+		MessageBox(hWnd, "Failed to read back wad file.", 0, MB_ICONERROR | MB_OK);
+	} else if (bad) {
+		sprintf_s(buf, sizeof(buf), "%d lumps differ in the saved file.", bad);
+		MessageBox(hWnd, buf, 0, MB_ICONERROR | MB_OK);
+	} else if (layout) {
+		report_layout(hWnd, expected ? "Saved and verified" : "Report", layout, &stats);
+	} else {
+		report_saved(hWnd, expected ? "File saved and verified" : "File saved", prune ? &refs : 0);
+	}
+
+cleanup:
+	if (expected) HeapFree(GetProcessHeap(), 0, expected);
+	if (saved) HeapFree(GetProcessHeap(), 0, saved);
+	refs_free(&refs);
 }
 
 static void
@@ -501,7 +991,7 @@ validate_edit(void)
 	char buf2[8 + 1];
 
 	GetWindowText(hEdit, buf, sizeof(buf));
-	gen_short_name(buf2, buf);
+	wad_short_name(buf2, buf);
 	if (lstrcmp(buf2, buf)) {
 		SetWindowText(hEdit, buf2);
 	}
@@ -511,55 +1001,23 @@ static void
 rename_selected(void)
 {
 	unsigned sel = (unsigned)SendMessage(hList, LB_GETCURSEL, 0, 0);
-	if (sel < (unsigned)item_count) {
-		struct wad_dentry *d = &items[sel].dentry;
-		GetWindowText(hEdit, d->name, sizeof(d->name));
+	if (sel < (unsigned)items.count) {
+		char name[8 + 1];
+		GetWindowText(hEdit, name, sizeof(name));
+		dir_rename(&items, sel, name);
 //		RedrawWindow(hList, 0, 0, RDW_INVALIDATE);
 		SetFocus(hList);
 	}
 }
 
 static void
-move(int k)
+move(int down)
 {
-	if (k) {
-		int i;
+	char *selected = selected_items();
 
-		for (i = item_count - 1; i >= 0; --i) {
-			if (SendMessage(hList, LB_GETSEL, i, 0) > 0) {
-				struct item tmp = items[i];
-				if (i + 1 >= item_count) break;
-				items[i] = items[i + 1];
-				items[i + 1] = tmp;
-				SendMessage(hList, LB_SETSEL, FALSE, i);
-				SendMessage(hList, LB_SETSEL, TRUE, i + 1);
-			}
-		}
-	} else {
-		int i;
-
-		for (i = 0; i < item_count; ++i) {
-			if (SendMessage(hList, LB_GETSEL, i, 0) > 0) {
-				struct item tmp = items[i];
-				if (!i) break;
-				items[i] = items[i - 1];
-				items[i - 1] = tmp;
-				SendMessage(hList, LB_SETSEL, FALSE, i);
-				SendMessage(hList, LB_SETSEL, TRUE, i - 1);
-			}
-		}
-	}
-/*	unsigned sel = (unsigned)SendMessage(hList, LB_GETCURSEL, 0, 0);
-	unsigned other = sel + k;
-	if ((sel < (unsigned)item_count) && (other < (unsigned)item_count)) {
-		struct item tmp = items[sel];
-		items[sel] = items[other];
-		items[other] = tmp;
-
-		SendMessage(hList, LB_SETSEL, FALSE, sel);
-		SendMessage(hList, LB_SETSEL, TRUE, other);
-		RedrawWindow(hList, 0, 0, RDW_INVALIDATE);
-	}*/
+	if (!selected) return;
+	if (dir_move(&items, selected, down)) show_selected(selected);
+	HeapFree(GetProcessHeap(), 0, selected);
 }
 
 static int
@@ -568,24 +1026,30 @@ save_lump_to(int lump, const char *path)
 	HANDLE fd = CreateFile(path, GENERIC_WRITE, 0, 0, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, 0);
 	HANDLE wfd = 0;
 	int ret = -1;
-	struct item *item = items + lump;
+	struct wad_dentry d;
+	long long start = stats_begin();
 
 	if (!fd) return -1;
 
-	if (!item->source) {
+	dir_dentry(&items, lump, &d);
+	if (!items.sources[lump] && wad_cache.lumps) {
+		ret = copy_from_cache(&wad_cache, fd, d.offset, d.size);
+	} else if (!items.sources[lump]) {
 		wfd = CreateFile(wad_path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, 0, 0);
+		STATS_ADD(STATS_OPENS, 1);
 
-		if (SetFilePointer(wfd, item->dentry.offset, 0, FILE_BEGIN) != item->dentry.offset) {
+		if (SetFilePointer(wfd, d.offset, 0, FILE_BEGIN) != d.offset) {
 			ret = -1;
 			goto cleanup;
 		}
-		ret = copy_between_fds(fd, wfd, item->dentry.size);
-		if ((ret > 0) && (ret != item->dentry.size)) ret = -1;
+		STATS_ADD(STATS_SEEKS, 1);
+		ret = save_copy(fd, wfd, d.size);
+		if (ret != d.size) ret = -1;
 	} else {
-		ret = copy_from_file(fd, item->source);
+		ret = save_copy_file(fd, items.sources[lump]);
 	}
-
-	ret = 0;
+	stats_end(STATS_LUMP_COPY, start);
+	if (ret >= 0) ret = 0;
 cleanup:
 	if (wfd) CloseHandle(wfd);
 	CloseHandle(fd);
@@ -596,7 +1060,7 @@ static void
 save_lump(HWND hWnd)
 {
 	unsigned sel = (unsigned)SendMessage(hList, LB_GETCURSEL, 0, 0);
-	if (sel < (unsigned)item_count) {
+	if (sel < (unsigned)items.count) {
 		OPENFILENAME ofn;
 		char path[MAX_PATH] = "";
 
@@ -625,6 +1089,477 @@ save_lump(HWND hWnd)
 	}
 }
 
+// returns the chosen filter index, 0 if cancelled
+static int
+ask_path(HWND hWnd, char path[MAX_PATH], const char *filter, int save)
+{
+	OPENFILENAME ofn;
+
+	path[0] = '\0';
+	ZeroMemory(&ofn, sizeof(ofn));
+	ofn.lStructSize = sizeof(ofn);
+	ofn.hwndOwner = hWnd;
+	ofn.hInstance = inst;
+	ofn.lpstrFilter = filter;
+	ofn.lpstrFile = path;
+	ofn.nMaxFile = MAX_PATH;
+	ofn.Flags = save ? OFN_OVERWRITEPROMPT : OFN_FILEMUSTEXIST;
+
+	if (!(save ? GetSaveFileName(&ofn) : GetOpenFileName(&ofn))) return 0;
+	return ofn.nFilterIndex ? ofn.nFilterIndex : 1;
+}
+
+static void
+make_patch(HWND hWnd)
+{
+	char new_path[MAX_PATH];
+	char patch_path[MAX_PATH];
+	char buf[128];
+	struct diff_stats stats;
+	int kind;
+	int ret;
+
+	if (!wad_path[0]) {
+		MessageBox(hWnd, "Open the old wad first.", 0, MB_ICONERROR | MB_OK);
+		return;
+	}
+	if (!ask_path(hWnd, new_path, "WAD Files\0*.wad\0", 0)) return;
+	kind = ask_path(hWnd, patch_path, "Delta Patch\0*.wdp\0Minimal PWAD\0*.wad\0", !0);
+	if (!kind) return;
+
+	if (kind == 1) {
+		ret = diff_make_patch(wad_path, new_path, patch_path, &stats);
+	} else {
+		ret = diff_make_pwad(wad_path, new_path, patch_path, &stats);
+	}
+	if (ret) {
+		MessageBox(hWnd, "Failed to make patch.", 0, MB_ICONERROR | MB_OK);
+		return;
+	}
+	sprintf_s(
+		buf, sizeof(buf),
+		"%d same, %d changed, %d added, %d removed\n%d bytes of new data",
+		stats.same, stats.delta, stats.added, stats.removed, stats.literal_bytes
+	);
+	MessageBox(hWnd, buf, "Report", MB_ICONINFORMATION | MB_OK);
+}
+
+static void
+apply_patch(HWND hWnd)
+{
+	char patch_path[MAX_PATH];
+	char out_path[MAX_PATH];
+	int ret;
+
+	if (!wad_path[0]) {
+		MessageBox(hWnd, "Open the old wad first.", 0, MB_ICONERROR | MB_OK);
+		return;
+	}
+	if (!ask_path(hWnd, patch_path, "Delta Patch\0*.wdp\0", 0)) return;
+	if (!ask_path(hWnd, out_path, "WAD Files\0*.wad\0", !0)) return;
+	if (!lstrcmp(out_path, wad_path)) {
+		MessageBox(hWnd, "Cannot patch a file in place.", 0, MB_ICONERROR | MB_OK);
+		return;
+	}
+
+	ret = diff_apply(wad_path, patch_path, out_path);
+	if (ret == DIFF_ERROR_BASE) {
+		MessageBox(hWnd, "The patch was made for another wad.", 0, MB_ICONERROR | MB_OK);
+	} else if (ret) {
+		MessageBox(hWnd, "Failed to apply patch.", 0, MB_ICONERROR | MB_OK);
+	} else {
+		MessageBox(hWnd, "File saved.", "Report", MB_ICONINFORMATION | MB_OK);
+	}
+}
+
+static void
+mark_hit(void *ctx, int span, int pattern, int offset)
+{
+	((char *)ctx)[span] = 1;
+}
+
+static void
+deposit_to_store(HWND hWnd)
+{
+	char manifest_path[MAX_PATH];
+	char buf[128];
+	struct wad_dentry *dentries;
+	struct wad_span *spans;
+	struct store_stats stats;
+	int ret;
+	int i;
+
+	if (!items.count) return;
+	if (!ask_path(hWnd, manifest_path, "Store Manifest\0*.wdm\0", !0)) return;
+
+	dentries = (struct wad_dentry *)HeapAlloc(GetProcessHeap(), 0, sizeof(struct wad_dentry) * items.count);
+	spans = (struct wad_span *)HeapAlloc(GetProcessHeap(), 0, sizeof(struct wad_span) * items.count);
+	if (!dentries || !spans) {
+		MessageBox(hWnd, "alloc", 0, MB_ICONERROR | MB_OK);
+		goto cleanup;
+	}
+	for (i = 0; i < items.count; ++i) {
+		dir_dentry(&items, i, dentries + i);
+		item_span(i, spans + i);
+	}
+
+	ret = store_deposit(manifest_path, WAD_TYPE_IWAD, dentries, spans, items.count, &stats);
+	if (ret) {
+		MessageBox(hWnd, "Failed to deposit lumps.", 0, MB_ICONERROR | MB_OK);
+		goto cleanup;
+	}
+	sprintf_s(
+		buf, sizeof(buf),
+		"%d lumps\n%d stored (%lld bytes)\n%d already in store (%lld bytes)",
+		stats.lumps, stats.stored, stats.bytes_stored, stats.skipped, stats.bytes_skipped
+	);
+	MessageBox(hWnd, buf, "Report", MB_ICONINFORMATION | MB_OK);
+
+cleanup:
+	if (dentries) HeapFree(GetProcessHeap(), 0, dentries);
+	if (spans) HeapFree(GetProcessHeap(), 0, spans);
+}
+
+static void
+rebuild_from_store(HWND hWnd)
+{
+	char manifest_path[MAX_PATH];
+	char path[MAX_PATH];
+	int ret;
+
+	if (!ask_path(hWnd, manifest_path, "Store Manifest\0*.wdm\0", 0)) return;
+	if (!ask_path(hWnd, path, "WAD Files\0*.wad\0", !0)) return;
+	if (!lstrcmp(path, wad_path)) {
+		MessageBox(hWnd, "Cannot move a file to itself.", 0, MB_ICONERROR | MB_OK);
+		return;
+	}
+
+	ret = store_rebuild(manifest_path, path);
+	if (ret == STORE_ERROR_MISSING) {
+		MessageBox(hWnd, "A lump is missing from the store.", 0, MB_ICONERROR | MB_OK);
+	} else if (ret) {
+		MessageBox(hWnd, "Failed to rebuild wad file.", 0, MB_ICONERROR | MB_OK);
+	} else {
+		MessageBox(hWnd, "File saved.", "Report", MB_ICONINFORMATION | MB_OK);
+	}
+}
+
+static void
+export_pk3(HWND hWnd)
+{
+	char path[MAX_PATH];
+	char buf[160];
+	struct wad_dentry *dentries;
+	struct wad_span *spans;
+	struct zip_stats stats;
+	int ret;
+	int i;
+
+	if (!items.count) return;
+	if (!ask_path(hWnd, path, "PK3 Files\0*.pk3\0ZIP Files\0*.zip\0", !0)) return;
+
+	dentries = (struct wad_dentry *)HeapAlloc(GetProcessHeap(), 0, sizeof(struct wad_dentry) * items.count);
+	spans = (struct wad_span *)HeapAlloc(GetProcessHeap(), 0, sizeof(struct wad_span) * items.count);
+	if (!dentries || !spans) {
+		MessageBox(hWnd, "alloc", 0, MB_ICONERROR | MB_OK);
+		goto cleanup;
+	}
+	for (i = 0; i < items.count; ++i) {
+		dir_dentry(&items, i, dentries + i);
+		item_span(i, spans + i);
+	}
+
+	ret = zip_export(path, dentries, spans, items.count, &stats);
+	if (ret == ZIP_ERROR_LIMIT) {
+		MessageBox(hWnd, "Too many lumps or too much data for a zip file.", 0, MB_ICONERROR | MB_OK);
+		goto cleanup;
+	} else if (ret) {
+		MessageBox(hWnd, "Failed to export pk3 file.", 0, MB_ICONERROR | MB_OK);
+		goto cleanup;
+	}
+	sprintf_s(
+		buf, sizeof(buf),
+		"%d entries, %d of them maps, %d stored, %d renamed with a ~N suffix\n%u bytes packed into %u",
+		stats.entries, stats.maps, stats.stored, stats.renamed, stats.raw_bytes, stats.packed_bytes
+	);
+	MessageBox(hWnd, buf, "Report", MB_ICONINFORMATION | MB_OK);
+
+cleanup:
+	if (dentries) HeapFree(GetProcessHeap(), 0, dentries);
+	if (spans) HeapFree(GetProcessHeap(), 0, spans);
+}
+
+static void
+import_pk3(HWND hWnd)
+{
+	char zip_path[MAX_PATH];
+	char path[MAX_PATH];
+	char buf[128];
+	struct zip_stats stats;
+	int ret;
+
+	if (!ask_path(hWnd, zip_path, "PK3 Files\0*.pk3\0ZIP Files\0*.zip\0", 0)) return;
+	if (!ask_path(hWnd, path, "WAD Files\0*.wad\0", !0)) return;
+	if (!lstrcmp(path, wad_path)) {
+		MessageBox(hWnd, "Cannot move a file to itself.", 0, MB_ICONERROR | MB_OK);
+		return;
+	}
+
+	ret = zip_import(zip_path, path, &stats);
+	if (ret == ZIP_ERROR_UNSUPPORTED) {
+		MessageBox(hWnd, "The archive is encrypted, zip64 or uses an unknown compression method.", 0, MB_ICONERROR | MB_OK);
+	} else if ((ret == ZIP_ERROR_CRC) || (ret == ZIP_ERROR_FORMAT)) {
+		MessageBox(hWnd, "The archive is damaged.", 0, MB_ICONERROR | MB_OK);
+	} else if (ret) {
+		MessageBox(hWnd, "Failed to convert pk3 file.", 0, MB_ICONERROR | MB_OK);
+	} else {
+		sprintf_s(
+			buf, sizeof(buf),
+			"%d entries, %d of them maps\n%u bytes unpacked from %u",
+			stats.entries, stats.maps, stats.raw_bytes, stats.packed_bytes
+		);
+		MessageBox(hWnd, buf, "Report", MB_ICONINFORMATION | MB_OK);
+	}
+}
+
+static void
+compress_zwad(HWND hWnd)
+{
+	char path[MAX_PATH];
+	char buf[128];
+	struct wad_dentry *dentries;
+	struct wad_span *spans;
+	struct zwad_stats stats;
+	int ret;
+	int i;
+
+	if (!items.count) return;
+	if (!ask_path(hWnd, path, "Compressed WAD Files\0*.zwad\0", !0)) return;
+
+	dentries = (struct wad_dentry *)HeapAlloc(GetProcessHeap(), 0, sizeof(struct wad_dentry) * items.count);
+	spans = (struct wad_span *)HeapAlloc(GetProcessHeap(), 0, sizeof(struct wad_span) * items.count);
+	if (!dentries || !spans) {
+		MessageBox(hWnd, "alloc", 0, MB_ICONERROR | MB_OK);
+		goto cleanup;
+	}
+	for (i = 0; i < items.count; ++i) {
+		dir_dentry(&items, i, dentries + i);
+		item_span(i, spans + i);
+	}
+
+	ret = zwad_compress(path, WAD_TYPE_IWAD, dentries, spans, items.count, &stats);
+	if (ret == ZWAD_ERROR_LIMIT) {
+		MessageBox(hWnd, "Too much data for a compressed wad.", 0, MB_ICONERROR | MB_OK);
+		goto cleanup;
+	} else if (ret) {
+		MessageBox(hWnd, "Failed to compress wad file.", 0, MB_ICONERROR | MB_OK);
+		goto cleanup;
+	}
+	sprintf_s(
+		buf, sizeof(buf),
+		"%d lumps in %d blocks, %d stored\n%u bytes packed into %u",
+		stats.lumps, stats.blocks, stats.stored, stats.raw_bytes, stats.packed_bytes
+	);
+	MessageBox(hWnd, buf, "Report", MB_ICONINFORMATION | MB_OK);
+
+cleanup:
+	if (dentries) HeapFree(GetProcessHeap(), 0, dentries);
+	if (spans) HeapFree(GetProcessHeap(), 0, spans);
+}
+
+static void
+extract_zwad(HWND hWnd)
+{
+	char zwad_path[MAX_PATH];
+	char path[MAX_PATH];
+	char buf[128];
+	struct zwad_stats stats;
+	int ret;
+
+	if (!ask_path(hWnd, zwad_path, "Compressed WAD Files\0*.zwad\0", 0)) return;
+	if (!ask_path(hWnd, path, "WAD Files\0*.wad\0", !0)) return;
+	if (!lstrcmp(path, wad_path)) {
+		MessageBox(hWnd, "Cannot move a file to itself.", 0, MB_ICONERROR | MB_OK);
+		return;
+	}
+
+	ret = zwad_extract(zwad_path, path, &stats);
+	if ((ret == ZWAD_ERROR_DATA) || (ret == ZWAD_ERROR_FORMAT) || (ret == WAD_ERROR_FILE_READ)) {
+		MessageBox(hWnd, "The compressed wad is damaged.", 0, MB_ICONERROR | MB_OK);
+	} else if (ret) {
+		MessageBox(hWnd, "Failed to convert compressed wad file.", 0, MB_ICONERROR | MB_OK);
+	} else {
+		sprintf_s(
+			buf, sizeof(buf),
+			"%d lumps in %d blocks\n%u bytes unpacked from %u",
+			stats.lumps, stats.blocks, stats.raw_bytes, stats.packed_bytes
+		);
+		MessageBox(hWnd, buf, "Report", MB_ICONINFORMATION | MB_OK);
+	}
+}
+
+static void
+dump_stats(HWND hWnd)
+{
+	char path[MAX_PATH];
+	char buf[STATS_DUMP_SIZE];
+	HANDLE fd;
+	DWORD wr;
+	int length;
+
+	length = stats_dump(buf, sizeof(buf) - 2);
+	if (length < 0) return;
+	if (!ask_path(hWnd, path, "JSON Files\0*.json\0", !0)) return;
+	buf[length++] = '\r';
+	buf[length++] = '\n';
+
+	fd = CreateFile(path, GENERIC_WRITE, 0, 0, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, 0);
+	if ((fd == INVALID_HANDLE_VALUE) || !WriteFile(fd, buf, length, &wr, 0) || (wr != (DWORD)length)) {
+		MessageBox(hWnd, "Failed to write statistics.", 0, MB_ICONERROR | MB_OK);
+	}
+	if (fd != INVALID_HANDLE_VALUE) CloseHandle(fd);
+}
+
+// the search box holds the text to look for, | between alternatives
+static void
+find_in_lumps(HWND hWnd)
+{
+	struct search_pattern patterns[SEARCH_MAX_PATTERNS];
+	struct wad_span *spans;
+	char *found;
+	char text[SEARCH_LENGTH + 1];
+	char buf[32];
+	char *p;
+	int pattern_count = 0;
+	int lumps = 0;
+	int ret;
+	int i;
+
+	if (!GetWindowText(hSearch, text, sizeof(text)) || !items.count) return;
+	for (p = text; *p && (pattern_count < SEARCH_MAX_PATTERNS); ) {
+		char *end = p;
+
+		while (*end && (*end != '|')) ++end;
+		if (end > p) {
+			patterns[pattern_count].data = p;
+			patterns[pattern_count++].length = (int)(end - p);
+		}
+		p = *end ? (end + 1) : end;
+	}
+	if (!pattern_count) return;
+
+	spans = (struct wad_span *)HeapAlloc(GetProcessHeap(), 0, sizeof(struct wad_span) * items.count);
+	found = (char *)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, items.count);
+	if (!spans || !found) {
+		MessageBox(hWnd, "alloc", 0, MB_ICONERROR | MB_OK);
+		goto cleanup;
+	}
+	for (i = 0; i < items.count; ++i) {
+		item_span(i, spans + i);
+	}
+
+	ret = search_spans(spans, items.count, patterns, pattern_count, mark_hit, found);
+	if (ret < 0) {
+		MessageBox(hWnd, "Failed to search lumps.", 0, MB_ICONERROR | MB_OK);
+		goto cleanup;
+	}
+
+	SendMessage(hList, LB_SETSEL, FALSE, -1);
+	for (i = 0; i < items.count; ++i) {
+		if (found[i]) {
+			SendMessage(hList, LB_SETSEL, TRUE, i);
+			++lumps;
+		}
+	}
+	sprintf_s(buf, sizeof(buf), "%d hits/%d", ret, lumps);
+	SendMessage(hStatus, SB_SETTEXT, 0, (LPARAM)buf);
+
+cleanup:
+	if (spans) HeapFree(GetProcessHeap(), 0, spans);
+	if (found) HeapFree(GetProcessHeap(), 0, found);
+}
+
+// the search box holds the pattern, ? and * being wildcards; the name box
+// would strip those
+static void
+select_matching(HWND hWnd)
+{
+	struct dir_pattern pattern;
+	char *matched;
+	char text[SEARCH_LENGTH + 1];
+	char buf[32];
+	int count;
+
+	if (!GetWindowText(hSearch, text, sizeof(text)) || !items.count) return;
+	if (dir_compile(&pattern, text)) {
+		SendMessage(hStatus, SB_SETTEXT, 0, (LPARAM)"bad pattern");
+		return;
+	}
+
+	matched = (char *)HeapAlloc(GetProcessHeap(), 0, items.count);
+	if (!matched) {
+		MessageBox(hWnd, "alloc", 0, MB_ICONERROR | MB_OK);
+		return;
+	}
+	count = dir_match(&items, 0, items.count, &pattern, matched);
+	show_selected(matched);
+	sprintf_s(buf, sizeof(buf), "%d matching", count);
+	SendMessage(hStatus, SB_SETTEXT, 0, (LPARAM)buf);
+	HeapFree(GetProcessHeap(), 0, matched);
+}
+
+// selects the patches and flats no map reaches and lists the textures
+// none of them uses
+static void
+select_unreferenced(HWND hWnd)
+{
+	struct refs refs;
+	char buf[1024];
+	char name[8 + 1];
+	int n;
+	int i;
+
+	if (!items.count || build_refs(hWnd, &refs)) return;
+
+	SendMessage(hList, LB_SETSEL, FALSE, -1);
+	for (i = 0; i < items.count; ++i) {
+		if (refs.unused[i]) SendMessage(hList, LB_SETSEL, TRUE, i);
+	}
+	sprintf_s(buf, sizeof(buf), "%d unreferenced", refs.unused_patches + refs.unused_flats);
+	SendMessage(hStatus, SB_SETTEXT, 0, (LPARAM)buf);
+
+	n = sprintf_s(
+		buf, sizeof(buf),
+		"%d maps, %d textures\n"
+		"%d unused patches and %d unused flats, %d bytes\n"
+		"%d patches only named by unused textures",
+		refs.maps, refs.textures,
+		refs.unused_patches, refs.unused_flats, refs.unused_size,
+		refs.orphaned_patches
+	);
+	if (wad_base_type != WAD_TYPE_IWAD) {
+		n += sprintf_s(buf + n, sizeof(buf) - n, "\nNothing checked, the maps and textures of the IWAD may use the lumps of a PWAD.");
+	} else if (!(refs.checked & REFS_PATCHES)) {
+		n += sprintf_s(buf + n, sizeof(buf) - n, "\nPatches not checked, PNAMES, TEXTURE1 or P_START is missing.");
+	}
+	if ((wad_base_type == WAD_TYPE_IWAD) && !(refs.checked & REFS_FLATS)) {
+		n += sprintf_s(buf + n, sizeof(buf) - n, "\nFlats and textures not checked, there are no maps.");
+	}
+	if (refs.checked & REFS_TEXTURES) {
+		n += sprintf_s(buf + n, sizeof(buf) - n, "\n%d unused textures:", refs.unused_texture_count);
+		for (i = 0; i < refs.unused_texture_count; ++i) {
+			if (n > (int)sizeof(buf) - 16) {
+				n += sprintf_s(buf + n, sizeof(buf) - n, " ...");
+				break;
+			}
+			dir_unpack_name(refs.unused_textures[i], name);
+			n += sprintf_s(buf + n, sizeof(buf) - n, " %s", name);
+		}
+	}
+	MessageBox(hWnd, buf, "Report", MB_ICONINFORMATION | MB_OK);
+	refs_free(&refs);
+}
+
 static void
 processCommand(HWND hWnd, enum command cmd, WORD param)
 {
@@ -645,13 +1580,22 @@ processCommand(HWND hWnd, enum command cmd, WORD param)
 		break;
 	case CMD_CLEAR:
 //		SetWindowText(hDetails, "");
+		watch_stop(&wad_watch);
+		cache_close(&wad_cache);
 		free_items();
-		resize_items(8);
+		wad_base.count = 0;
+		wad_base_type = WAD_TYPE_PWAD;
 		wad_path[0] = '\0';
 		SendMessage(hStatus, SB_SETTEXT, 1, (LPARAM)"");
 		break;
 	case CMD_SAVE:
-		save_wad(hWnd);
+		save_wad(hWnd, 0, 0);
+		break;
+	case CMD_SAVE_ALIGNED:
+		save_wad(hWnd, !0, 0);
+		break;
+	case CMD_SAVE_PRUNED:
+		save_wad(hWnd, 0, !0);
 		break;
 	case CMD_EDIT:
 		if (param == EN_CHANGE) validate_edit();
@@ -659,6 +1603,8 @@ processCommand(HWND hWnd, enum command cmd, WORD param)
 	case IDOK:
 		if (GetFocus() == hEdit) {
 			rename_selected();
+		} else if (GetFocus() == hSearch) {
+			find_in_lumps(hWnd);
 		} else if (GetFocus() == hList) {
 			SetFocus(hEdit);
 			SendMessage(hEdit, EM_SETSEL, 8, 8);
@@ -674,6 +1620,55 @@ processCommand(HWND hWnd, enum command cmd, WORD param)
 //		MessageBox(hWnd, "Not implemented yet :(", 0, MB_ICONEXCLAMATION | MB_OK);
 		save_lump(hWnd);
 		break;
+	case CMD_IMPORT:
+		import_folder(hWnd);
+		break;
+	case CMD_FIND:
+		find_in_lumps(hWnd);
+		break;
+	case CMD_SELECT:
+		select_matching(hWnd);
+		break;
+	case CMD_UNUSED:
+		select_unreferenced(hWnd);
+		break;
+	case CMD_DIFF:
+		make_patch(hWnd);
+		break;
+	case CMD_PATCH:
+		apply_patch(hWnd);
+		break;
+	case CMD_DEPOSIT:
+		deposit_to_store(hWnd);
+		break;
+	case CMD_EXPORT_PK3:
+		export_pk3(hWnd);
+		break;
+	case CMD_IMPORT_PK3:
+		import_pk3(hWnd);
+		break;
+	case CMD_COMPRESS_ZWAD:
+		compress_zwad(hWnd);
+		break;
+	case CMD_EXTRACT_ZWAD:
+		extract_zwad(hWnd);
+		break;
+	case CMD_REBUILD:
+		rebuild_from_store(hWnd);
+		break;
+	case CMD_VERIFY:
+		verify_save = !verify_save;
+		CheckMenuItem(GetMenu(hWnd), CMD_VERIFY, MF_BYCOMMAND | (verify_save ? MF_CHECKED : MF_UNCHECKED));
+		break;
+	case CMD_STATS:
+		// a fresh run every time it is switched on
+		if (!stats_enabled) stats_reset();
+		stats_enable(!stats_enabled);
+		CheckMenuItem(GetMenu(hWnd), CMD_STATS, MF_BYCOMMAND | (stats_enabled ? MF_CHECKED : MF_UNCHECKED));
+		break;
+	case CMD_STATS_DUMP:
+		dump_stats(hWnd);
+		break;
 	case IDCANCEL:
 		sureQuit(hWnd);
 		break;
@@ -706,7 +1701,7 @@ resizeMainWindow(HWND hWnd)
 {
 	RECT toolbar_rect, statusbar_rect, client_rect;
 	RECT edit_rect;
-	int toolbar_height, statusbar_height, client_height;
+	int toolbar_height, statusbar_height, client_height, client_width;
 
 	SendMessage(hToolbar, TB_AUTOSIZE, 0, 0);
 
@@ -721,12 +1716,17 @@ resizeMainWindow(HWND hWnd)
 	GetClientRect(hWnd, &client_rect);
 	client_height = client_rect.bottom - toolbar_height - statusbar_height;
 
+	ZeroMemory(&edit_rect, sizeof(edit_rect));
 	edit_rect.top = 18; // http://msdn.microsoft.com/en-us/library/aa511279.aspx#sizingspacing
+	edit_rect.left = NAME_BOX_WIDTH;
 	MapDialogRect(hWnd, &edit_rect);
+	client_width = client_rect.right - client_rect.left;
+	if (edit_rect.left > client_width / 2) edit_rect.left = client_width / 2;
 	list_bottom = client_rect.bottom - statusbar_height - edit_rect.top;
 
-	SetWindowPos(hList, 0, client_rect.left, toolbar_height, client_rect.right - client_rect.left, client_height - edit_rect.top, SWP_NOZORDER);
-	SetWindowPos(hEdit, 0, client_rect.left, list_bottom, client_rect.right - client_rect.left, edit_rect.top, SWP_NOZORDER);
+	SetWindowPos(hList, 0, client_rect.left, toolbar_height, client_width, client_height - edit_rect.top, SWP_NOZORDER);
+	SetWindowPos(hEdit, 0, client_rect.left, list_bottom, edit_rect.left, edit_rect.top, SWP_NOZORDER);
+	SetWindowPos(hSearch, 0, client_rect.left + edit_rect.left, list_bottom, client_width - edit_rect.left, edit_rect.top, SWP_NOZORDER);
 }
 
 static int
@@ -755,7 +1755,7 @@ draw_item(HWND hWnd, WPARAM id, LPARAM lp)
 	DRAWITEMSTRUCT *dis = (DRAWITEMSTRUCT *)lp;
 	unsigned i = dis->itemID;
 
-	if ((id == CMD_LISTBOX) && (i < (unsigned)item_count)) {
+	if ((id == CMD_LISTBOX) && (i < (unsigned)items.count)) {
 		static int tabstops[] = { 100, 200 };
 		COLORREF color_old_text;
 		COLORREF color_old_background;
@@ -764,21 +1764,23 @@ draw_item(HWND hWnd, WPARAM id, LPARAM lp)
 		RECT rc;
 		HBRUSH brush;
 		char buf[128];
+		struct wad_dentry d;
 
-		if (items[i].source) {
+		dir_dentry(&items, i, &d);
+		if (items.sources[i]) {
 			sprintf_s(
 				buf, sizeof(buf),
 				"%s\t%s",
-				items[i].dentry.name,
-				items[i].source
+				d.name,
+				items.sources[i]
 			);
 		} else {
 			sprintf_s(
 				buf, sizeof(buf),
 				"%s\t%d\t%d",
-				items[i].dentry.name,
-				items[i].dentry.offset,
-				items[i].dentry.size
+				d.name,
+				items.offsets[i],
+				items.sizes[i]
 			);
 		}
 
@@ -802,7 +1804,7 @@ draw_item(HWND hWnd, WPARAM id, LPARAM lp)
 			SetBkColor(dis->hDC, color_old_background);
 		}
 
-		if (i == item_count - 1) {
+		if (i == items.count - 1) {
 			brush = CreateSolidBrush(GetBkColor(dis->hDC));
 			rc = dis->rcItem;
 			rc.top = rc.bottom;
@@ -844,7 +1846,21 @@ winProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam)
 			return TRUE;
 		}
 		break;
+	case WM_WAD_CHANGED:
+		// whoever is writing it may need to truncate it
+		cache_unmap_file(&wad_cache);
+		SetTimer(hWnd, TIMER_RELOAD, RELOAD_DELAY, 0);
+		return 0;
+	case WM_TIMER:
+		if (wParam == TIMER_RELOAD) {
+			KillTimer(hWnd, TIMER_RELOAD);
+			if (wad_path[0] && wad_changed()) reload_wad(hWnd);
+			else cache_map_file(&wad_cache);
+		}
+		return 0;
 	case WM_DESTROY:
+		watch_stop(&wad_watch);
+		cache_close(&wad_cache);
 		PostQuitMessage(0);
 		return 0;
 	}
@@ -856,6 +1872,8 @@ WinMainCRTStartup()
 {
 	inst = GetModuleHandle(0);
 	InitCommonControls();
+	// the folder dialog with BIF_NEWDIALOGSTYLE is an OLE control
+	OleInitialize(0);
 
 	{
 		WNDCLASS wc = { 0 };
@@ -873,6 +1891,8 @@ WinMainCRTStartup()
 		ACCEL acc_table[] = {
 			{ FCONTROL | FVIRTKEY, 0x4f, CMD_OPEN },
 			{ FCONTROL | FVIRTKEY, 0x53, CMD_SAVE },
+			{ FCONTROL | FVIRTKEY, 0x46, CMD_FIND },
+			{ FCONTROL | FVIRTKEY, 0x4d, CMD_SELECT },
 			{ FVIRTKEY, VK_INSERT, CMD_NEW },
 			{ FVIRTKEY, VK_DELETE, CMD_DELETE },
 			{ FCONTROL | FVIRTKEY, VK_UP, CMD_MOVE_UP },
@@ -894,6 +1914,7 @@ WinMainCRTStartup()
 		}
 
 //		DestroyWindow(hWnd);
+		OleUninitialize();
 		ExitProcess(msg.wParam);
 	}
 }
@@ -0,0 +1,72 @@
+#include "watch.h"
+
+#define WIN32_LEAN_AND_MEAN
+#undef UNICODE
+#include <windows.h>
+
+static DWORD WINAPI
+watch_thread(LPVOID param)
+{
+	struct watch *watch = (struct watch *)param;
+	HANDLE handles[2];
+
+	handles[0] = watch->stop;
+	handles[1] = watch->change;
+	while (WaitForMultipleObjects(2, handles, FALSE, INFINITE) == WAIT_OBJECT_0 + 1) {
+		PostMessage((HWND)watch->window, watch->msg, 0, 0);
+		if (!FindNextChangeNotification(watch->change)) break;
+	}
+	return 0;
+}
+
+int
+watch_start(struct watch *watch, void *window, unsigned msg, const char *path)
+{
+	char dir[MAX_PATH];
+	int i, cut = 0;
+
+	watch_stop(watch);
+
+	lstrcpyn(dir, path, MAX_PATH);
+	for (i = 0; dir[i]; ++i) {
+		if ((dir[i] == '\\') || (dir[i] == '/')) cut = i;
+	}
+	if (!cut && (dir[0] != '\\') && (dir[0] != '/')) return -1;
+	// a root keeps its separator, C: alone is the current directory of C:
+	if (!cut || (dir[cut - 1] == ':')) ++cut;
+	dir[cut] = '\0';
+
+	watch->window = window;
+	watch->msg = msg;
+	watch->change = FindFirstChangeNotification(dir, FALSE, FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE);
+	if (watch->change == INVALID_HANDLE_VALUE) {
+		watch->change = 0;
+		return -1;
+	}
+	watch->stop = CreateEvent(0, TRUE, FALSE, 0);
+	if (watch->stop) watch->thread = CreateThread(0, 0, watch_thread, watch, 0, 0);
+	if (!watch->thread) {
+		watch_stop(watch);
+		return -1;
+	}
+	return 0;
+}
+
+void
+watch_stop(struct watch *watch)
+{
+	if (watch->thread) {
+		SetEvent(watch->stop);
+		WaitForSingleObject(watch->thread, INFINITE);
+		CloseHandle(watch->thread);
+		watch->thread = 0;
+	}
+	if (watch->stop) {
+		CloseHandle(watch->stop);
+		watch->stop = 0;
+	}
+	if (watch->change) {
+		FindCloseChangeNotification(watch->change);
+		watch->change = 0;
+	}
+}
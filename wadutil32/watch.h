@@ -0,0 +1,16 @@
+#ifndef WATCH_HEADER
+#define WATCH_HEADER
+
+// posts msg to window whenever something changes in the directory of a file
+struct watch {
+	void *window;
+	unsigned msg;
+	void *thread;
+	void *stop;
+	void *change;
+};
+
+int watch_start(struct watch *watch, void *window, unsigned msg, const char *path);
+void watch_stop(struct watch *watch);
+
+#endif // WATCH_HEADER
@@ -0,0 +1,846 @@
+#include "zip.h"
+#include "deflate.h"
+#include "hash.h"
+#include "parallel.h"
+
+#define WIN32_LEAN_AND_MEAN
+#undef UNICODE
+#include <windows.h>
+#include <stdio.h> // sprintf_s
+#include <stdlib.h> // qsort
+
+#define ZIP_LOCAL_SIZE 30
+#define ZIP_CENTRAL_SIZE 46
+#define ZIP_END_SIZE 22
+#define ZIP_MAX_COMMENT 65535
+#define ZIP_MAX_ENTRIES 65535
+#define ZIP_DOS_DATE 0x21 // 1980-01-01, so that a wad always gives the same archive
+
+enum zip_magic {
+	ZIP_LOCAL = LE_FOURCC('P', 'K', 3, 4),
+	ZIP_CENTRAL = LE_FOURCC('P', 'K', 1, 2),
+	ZIP_END = LE_FOURCC('P', 'K', 5, 6)
+};
+
+enum zip_method {
+	ZIP_STORED = 0,
+	ZIP_DEFLATED = 8
+};
+
+static const char *map_lumps[] = {
+	"THINGS", "LINEDEFS", "SIDEDEFS", "VERTEXES", "SEGS", "SSECTORS",
+	"NODES", "SECTORS", "REJECT", "BLOCKMAP", "BEHAVIOR", "SCRIPTS", 0
+};
+
+static void
+put16(unsigned char *p, unsigned v)
+{
+	p[0] = (unsigned char)v;
+	p[1] = (unsigned char)(v >> 8);
+}
+
+static void
+put32(unsigned char *p, unsigned v)
+{
+	put16(p, v);
+	put16(p + 2, v >> 16);
+}
+
+static unsigned
+get16(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static unsigned
+get32(const unsigned char *p)
+{
+	return get16(p) | (get16(p + 2) << 16);
+}
+
+static int
+write_all(HANDLE fd, const void *data, int length)
+{
+	DWORD wr;
+
+	if (!length) return 0;
+	if (!WriteFile(fd, data, length, &wr, 0) || (wr != (DWORD)length)) return ZIP_ERROR_WRITE;
+	return 0;
+}
+
+static int
+read_all(struct wad_reader *reader, const struct wad_span *span, void *buf)
+{
+	int pos = 0;
+
+	while (pos < span->size) {
+		int rd = wad_reader_read(reader, span, pos, (char *)buf + pos, span->size - pos);
+		if (rd <= 0) return rd ? rd : WAD_ERROR_FILE_READ;
+		pos += rd;
+	}
+	return 0;
+}
+
+static int
+is_map_name(const char *name)
+{
+	if ((name[0] == 'E') && (name[1] >= '0') && (name[1] <= '9') && (name[2] == 'M') && (name[3] >= '0') && (name[3] <= '9') && !name[4]) return !0;
+	return (name[0] == 'M') && (name[1] == 'A') && (name[2] == 'P') && (name[3] >= '0') && (name[3] <= '9') && (name[4] >= '0') && (name[4] <= '9') && !name[5];
+}
+
+static int
+is_map_lump(const char *name)
+{
+	int i;
+
+	for (i = 0; map_lumps[i]; ++i) {
+		if (!lstrcmp(name, map_lumps[i])) return !0;
+	}
+	return 0;
+}
+
+// sub-namespace markers like P1_START only matter in a wad
+static int
+is_marker(const struct wad_dentry *d)
+{
+	int n = lstrlen(d->name);
+
+	if (d->size) return 0;
+	if ((n > 6) && !lstrcmp(d->name + n - 6, "_START")) return !0;
+	return (n > 4) && !lstrcmp(d->name + n - 4, "_END");
+}
+
+struct zip_entry {
+	char name[32];
+	int first; // dentry
+	int count; // lumps, all of a map go into one entry
+	int raw_size;
+	int packed_size;
+	int method;
+	unsigned crc;
+	unsigned offset;
+	char *data; // while being written
+};
+
+struct zip_export_job {
+	const struct wad_dentry *dentries;
+	const struct wad_span *spans;
+	struct zip_entry *entries;
+	int base;
+	struct wad_reader readers[PARALLEL_MAX_WORKERS];
+	volatile LONG error;
+};
+
+static void
+entry_name(struct zip_entry *e, const char *folder, const char *lump, const char *ext)
+{
+	char name[8 + 1];
+	int i;
+
+	lstrcpy(name, lump);
+	for (i = 0; name[i]; ++i) {
+		if ((name[i] >= 'A') && (name[i] <= 'Z')) name[i] += 'a' - 'A';
+		if (name[i] == '\\') name[i] = '^';
+	}
+	if (folder) {
+		sprintf_s(e->name, sizeof(e->name), "%s/%s.%s", folder, name, ext);
+	} else {
+		sprintf_s(e->name, sizeof(e->name), "%s.%s", name, ext);
+	}
+}
+
+static int
+plan_entries(const struct wad_dentry *dentries, int count, struct zip_entry *entries)
+{
+	int ns = 0;
+	int n = 0;
+	int i = 0;
+
+	while (i < count) {
+		const struct wad_dentry *d = dentries + i;
+		struct zip_entry *e = entries + n;
+		int marker_ns, end;
+
+		marker_ns = wad_namespace_of_marker(d->name, &end);
+		if (marker_ns && !d->size) {
+			ns = end ? 0 : marker_ns;
+			++i;
+			continue;
+		}
+		if (ns && is_marker(d)) {
+			++i;
+			continue;
+		}
+
+		ZeroMemory(e, sizeof(*e));
+		e->first = i;
+		e->count = 1;
+		if (!ns && is_map_name(d->name) && (i + 1 < count) && (is_map_lump(d[1].name) || !lstrcmp(d[1].name, "TEXTMAP"))) {
+			int j = i + 1;
+
+			if (!lstrcmp(d[1].name, "TEXTMAP")) {
+				while ((j < count) && lstrcmp(dentries[j].name, "ENDMAP")) ++j;
+				if (j < count) ++j;
+			} else {
+				while ((j < count) && is_map_lump(dentries[j].name)) ++j;
+			}
+			e->count = j - i;
+			e->raw_size = WAD_HEADER_SIZE + WAD_DENTRY_SIZE * e->count;
+			for (j = i; j < i + e->count; ++j) {
+				e->raw_size += dentries[j].size;
+			}
+			entry_name(e, "maps", d->name, "wad");
+		} else {
+			e->raw_size = d->size;
+			entry_name(e, wad_namespace_folder(ns), d->name, "lmp");
+		}
+		i += e->count;
+		++n;
+	}
+	return n;
+}
+
+// open addressing, returns the slot holding the name or the empty one it would go to
+static unsigned
+entry_slot(const struct zip_entry *entries, const int *table, unsigned mask, const char *name)
+{
+	unsigned i = (unsigned)hash_xxh64(name, lstrlen(name), 0) & mask;
+
+	while (table[i] >= 0) {
+		if (!lstrcmp(entries[table[i]].name, name)) break;
+		i = (i + 1) & mask;
+	}
+	return i;
+}
+
+// most tools keep only one of several members with the same path; the last
+// lump of a name is the one the engine uses, so it keeps the name and the
+// ones before it get a ~N suffix the way import_scan hands them out
+static int
+unique_names(struct zip_entry *entries, int n)
+{
+	unsigned size = 2;
+	int *table, *suffixes;
+	int renamed = 0;
+	int i;
+
+	while (size < (unsigned)n * 2) size *= 2;
+	table = (int *)HeapAlloc(GetProcessHeap(), 0, sizeof(int) * size);
+	// the last suffix handed out for each name, so long runs of one name stay linear
+	suffixes = (int *)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(int) * (n + 1));
+	if (!table || !suffixes) {
+		if (table) HeapFree(GetProcessHeap(), 0, table);
+		if (suffixes) HeapFree(GetProcessHeap(), 0, suffixes);
+		return ZIP_ERROR_ALLOC;
+	}
+	for (i = 0; i < (int)size; ++i) {
+		table[i] = -1;
+	}
+
+	for (i = n - 1; i >= 0; --i) {
+		struct zip_entry *e = entries + i;
+		unsigned slot = entry_slot(entries, table, size - 1, e->name);
+		int owner = table[slot];
+
+		if (owner >= 0) ++renamed;
+		while (table[slot] >= 0) {
+			const char *stem = e->name, *ext = 0, *p;
+			char suffix[16];
+			char name[sizeof(e->name)];
+			int length;
+
+			for (p = e->name; *p; ++p) {
+				if (*p == '/') stem = p + 1;
+				if (*p == '.') ext = p;
+			}
+			if (!ext || (ext < stem)) ext = p;
+			sprintf_s(suffix, sizeof(suffix), "~%d", ++suffixes[owner]);
+			length = (int)(ext - stem);
+			if (length > 8 - lstrlen(suffix)) length = 8 - lstrlen(suffix);
+			sprintf_s(name, sizeof(name), "%.*s%.*s%s%s", (int)(stem - e->name), e->name, length, stem, suffix, ext);
+			slot = entry_slot(entries, table, size - 1, name);
+			if (table[slot] < 0) lstrcpy(e->name, name);
+		}
+		table[slot] = i;
+	}
+
+	HeapFree(GetProcessHeap(), 0, table);
+	HeapFree(GetProcessHeap(), 0, suffixes);
+	return renamed;
+}
+
+// a map goes out as a small pwad of its own
+static int
+read_entry(struct wad_reader *reader, const struct wad_dentry *dentries, const struct wad_span *spans, const struct zip_entry *e, char *raw)
+{
+	struct wad_header hd;
+	int pos = WAD_HEADER_SIZE;
+	int ret;
+	int i;
+
+	if (e->count == 1) return read_all(reader, spans + e->first, raw);
+
+	hd.type = WAD_TYPE_PWAD;
+	hd.lump_count = e->count;
+	hd.directory_offset = e->raw_size - WAD_DENTRY_SIZE * e->count;
+	CopyMemory(raw, &hd, WAD_HEADER_SIZE);
+	for (i = 0; i < e->count; ++i) {
+		struct wad_dentry d = dentries[e->first + i];
+		char *entry = raw + hd.directory_offset + WAD_DENTRY_SIZE * i;
+
+		ret = read_all(reader, spans + e->first + i, raw + pos);
+		if (ret) return ret;
+		d.offset = d.size ? pos : 0;
+		CopyMemory(entry, &d, 8);
+		ZeroMemory(entry + 8, 8);
+		CopyMemory(entry + 8, d.name, lstrlen(d.name));
+		pos += d.size;
+	}
+	return 0;
+}
+
+static void
+compress_entry(void *ctx, int worker, int index)
+{
+	struct zip_export_job *job = (struct zip_export_job *)ctx;
+	struct zip_entry *e = job->entries + job->base + index;
+	char *raw, *packed;
+	int ret;
+
+	if (job->error) return;
+	raw = (char *)HeapAlloc(GetProcessHeap(), 0, e->raw_size + 1);
+	if (!raw) {
+		job->error = ZIP_ERROR_ALLOC;
+		return;
+	}
+	ret = read_entry(&job->readers[worker], job->dentries, job->spans, e, raw);
+	if (ret) {
+		HeapFree(GetProcessHeap(), 0, raw);
+		job->error = ret;
+		return;
+	}
+	e->crc = hash_crc32(0, raw, e->raw_size);
+
+	// only kept when it got smaller
+	packed = e->raw_size ? (char *)HeapAlloc(GetProcessHeap(), 0, e->raw_size) : 0;
+	ret = packed ? deflate_compress(raw, e->raw_size, packed, e->raw_size - 1) : -1;
+	if (ret >= 0) {
+		HeapFree(GetProcessHeap(), 0, raw);
+		e->data = packed;
+		e->method = ZIP_DEFLATED;
+		e->packed_size = ret;
+	} else {
+		if (packed) HeapFree(GetProcessHeap(), 0, packed);
+		if (ret == DEFLATE_ERROR_ALLOC) job->error = ZIP_ERROR_ALLOC;
+		e->data = raw;
+		e->method = ZIP_STORED;
+		e->packed_size = e->raw_size;
+	}
+}
+
+static void
+fill_header(unsigned char *p, const struct zip_entry *e)
+{
+	put16(p + 4, 20); // version needed: deflate
+	put16(p + 6, 0);
+	put16(p + 8, e->method);
+	put16(p + 10, 0);
+	put16(p + 12, ZIP_DOS_DATE);
+	put32(p + 14, e->crc);
+	put32(p + 18, e->packed_size);
+	put32(p + 22, e->raw_size);
+	put16(p + 26, lstrlen(e->name));
+	put16(p + 28, 0);
+}
+
+int
+zip_export(const char *path, const struct wad_dentry *dentries, const struct wad_span *spans, int count, struct zip_stats *stats)
+{
+	struct zip_export_job *job;
+	struct zip_entry *entries;
+	unsigned char hd[ZIP_CENTRAL_SIZE];
+	unsigned long long pos = 0, directory;
+	HANDLE fd = INVALID_HANDLE_VALUE;
+	int n, i, end;
+	int ret = ZIP_ERROR_ALLOC;
+
+	ZeroMemory(stats, sizeof(*stats));
+	job = (struct zip_export_job *)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(struct zip_export_job));
+	entries = (struct zip_entry *)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(struct zip_entry) * (count + 1));
+	if (!job || !entries) goto cleanup;
+	for (i = 0; i < PARALLEL_MAX_WORKERS; ++i) {
+		wad_reader_init(&job->readers[i]);
+	}
+	job->dentries = dentries;
+	job->spans = spans;
+	job->entries = entries;
+
+	n = plan_entries(dentries, count, entries);
+	ret = unique_names(entries, n);
+	if (ret < 0) goto cleanup;
+	stats->renamed = ret;
+	ret = ZIP_ERROR_LIMIT;
+	if (n > ZIP_MAX_ENTRIES) goto cleanup;
+	ret = WAD_ERROR_FILE_OPEN;
+	fd = CreateFile(path, GENERIC_WRITE, 0, 0, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, 0);
+	if (fd == INVALID_HANDLE_VALUE) goto cleanup;
+	hash_crc32(0, 0, 0); // builds the table before the workers race for it
+
+	// only a batch is ever in memory, written out in order once it is done
+	for (i = 0; i < n; i = end) {
+		int batch = 0;
+
+		for (end = i; (end < n) && ((end == i) || (batch + entries[end].raw_size <= ZIP_BATCH_SIZE)); ++end) {
+			batch += entries[end].raw_size;
+		}
+		job->base = i;
+		parallel_for(end - i, compress_entry, job);
+		ret = job->error;
+
+		for (; !ret && (i < end); ++i) {
+			struct zip_entry *e = entries + i;
+			int length = lstrlen(e->name);
+
+			if (pos + ZIP_LOCAL_SIZE + length + e->packed_size > 0xffffffff) {
+				ret = ZIP_ERROR_LIMIT;
+				break;
+			}
+			e->offset = (unsigned)pos;
+			put32(hd, ZIP_LOCAL);
+			fill_header(hd, e);
+			ret = write_all(fd, hd, ZIP_LOCAL_SIZE);
+			if (!ret) ret = write_all(fd, e->name, length);
+			if (!ret) ret = write_all(fd, e->data, e->packed_size);
+			pos += ZIP_LOCAL_SIZE + length + e->packed_size;
+
+			++stats->entries;
+			if (e->count > 1) ++stats->maps;
+			if (e->method == ZIP_STORED) ++stats->stored;
+			stats->raw_bytes += e->raw_size;
+			stats->packed_bytes += e->packed_size;
+		}
+		for (i = job->base; i < end; ++i) {
+			if (entries[i].data) HeapFree(GetProcessHeap(), 0, entries[i].data);
+			entries[i].data = 0;
+		}
+		if (ret) goto cleanup;
+	}
+
+	directory = pos;
+	for (i = 0; i < n; ++i) {
+		const struct zip_entry *e = entries + i;
+		int length = lstrlen(e->name);
+
+		ZeroMemory(hd, sizeof(hd));
+		put32(hd, ZIP_CENTRAL);
+		fill_header(hd + 2, e); // same fields, shifted by the version made by
+		put16(hd + 4, 20);
+		put32(hd + 42, e->offset);
+		ret = write_all(fd, hd, ZIP_CENTRAL_SIZE);
+		if (!ret) ret = write_all(fd, e->name, length);
+		if (ret) goto cleanup;
+		pos += ZIP_CENTRAL_SIZE + length;
+	}
+	ret = ZIP_ERROR_LIMIT;
+	if (pos > 0xffffffff) goto cleanup;
+
+	ZeroMemory(hd, sizeof(hd));
+	put32(hd, ZIP_END);
+	put16(hd + 8, n);
+	put16(hd + 10, n);
+	put32(hd + 12, (unsigned)(pos - directory));
+	put32(hd + 16, (unsigned)directory);
+	ret = write_all(fd, hd, ZIP_END_SIZE);
+
+cleanup:
+	if (fd != INVALID_HANDLE_VALUE) CloseHandle(fd);
+	if (job) {
+		for (i = 0; i < PARALLEL_MAX_WORKERS; ++i) {
+			wad_reader_close(&job->readers[i]);
+		}
+		HeapFree(GetProcessHeap(), 0, job);
+	}
+	if (entries) HeapFree(GetProcessHeap(), 0, entries);
+	return ret;
+}
+
+struct zip_member {
+	char lump[8 + 1];
+	int ns;
+	int is_map;
+	int order;
+	int method;
+	unsigned crc;
+	int packed_size;
+	int raw_size;
+	unsigned offset; // of the local header
+	char *data; // while being written
+};
+
+struct zip_import_job {
+	const char *path;
+	struct zip_member *members;
+	int base;
+	struct wad_reader readers[PARALLEL_MAX_WORKERS];
+	volatile LONG error;
+};
+
+static int
+compare_members(const void *a, const void *b)
+{
+	const struct zip_member *ma = (const struct zip_member *)a;
+	const struct zip_member *mb = (const struct zip_member *)b;
+
+	if (ma->ns != mb->ns) return ma->ns - mb->ns;
+	return ma->order - mb->order;
+}
+
+// wad_short_name for a member title, where ^ stands for the \ that file
+// names cannot hold (VILE^1 and friends)
+static void
+lump_name(char lump[8 + 1], const char *title)
+{
+	char part[8 + 1], buf[256];
+	int n = 0;
+	int i, j;
+
+	for (;;) {
+		for (i = 0; title[i] && (title[i] != '^') && (i < (int)sizeof(buf) - 1); ++i) buf[i] = title[i];
+		buf[i] = '\0';
+		wad_short_name(part, buf);
+		for (j = 0; part[j] && (n < 8); ++j) lump[n++] = part[j];
+		if ((title[i] != '^') || (n >= 8)) break;
+		lump[n++] = '\\';
+		title += i + 1;
+	}
+	while (n <= 8) lump[n++] = '\0';
+}
+
+// folders below the namespace ones and unknown folders only add to the path
+static void
+classify(struct zip_member *m, const char *name, int length)
+{
+	char path[256];
+	char *title = path, *slash = 0, *dot = 0;
+	int i;
+
+	if (length >= (int)sizeof(path)) length = sizeof(path) - 1;
+	CopyMemory(path, name, length);
+	path[length] = '\0';
+	for (i = 0; path[i]; ++i) {
+		if (path[i] == '/') {
+			if (!slash) slash = path + i;
+			title = path + i + 1;
+		}
+	}
+	for (i = 0; title[i]; ++i) {
+		if (title[i] == '.') dot = title + i;
+	}
+	if (slash) {
+		*slash = '\0';
+		m->ns = wad_namespace_of_folder(path);
+		m->is_map = !lstrcmpi(path, "maps") && (title == slash + 1) && dot && !lstrcmpi(dot, ".wad");
+	}
+	if (dot) *dot = '\0';
+	lump_name(m->lump, title);
+}
+
+static int
+read_directory(HANDLE fd, struct zip_member **members, int *count)
+{
+	unsigned char tail[ZIP_END_SIZE + ZIP_MAX_COMMENT];
+	unsigned char *cd = 0, *p;
+	DWORD size = GetFileSize(fd, 0);
+	DWORD rd;
+	int length = (size < sizeof(tail)) ? size : sizeof(tail);
+	unsigned cd_size, cd_offset;
+	int total, n = 0;
+	int ret = ZIP_ERROR_FORMAT;
+	int i;
+
+	*members = 0;
+	if ((size == INVALID_FILE_SIZE) || (length < ZIP_END_SIZE)) return ZIP_ERROR_FORMAT;
+	if (SetFilePointer(fd, size - length, 0, FILE_BEGIN) != size - length) return WAD_ERROR_FILE_SEEK;
+	if (!ReadFile(fd, tail, length, &rd, 0) || (rd != (DWORD)length)) return WAD_ERROR_FILE_READ;
+	for (i = length - ZIP_END_SIZE; i >= 0; --i) {
+		if ((get32(tail + i) == ZIP_END) && (i + ZIP_END_SIZE + (int)get16(tail + i + 20) == length)) break;
+	}
+	if (i < 0) return ZIP_ERROR_FORMAT;
+	total = get16(tail + i + 10);
+	cd_size = get32(tail + i + 12);
+	cd_offset = get32(tail + i + 16);
+	if ((total == 0xffff) || (cd_offset == 0xffffffff)) return ZIP_ERROR_UNSUPPORTED; // zip64
+	if ((cd_offset > size) || (cd_size > size - cd_offset)) return ZIP_ERROR_FORMAT;
+
+	cd = (unsigned char *)HeapAlloc(GetProcessHeap(), 0, cd_size + 1);
+	*members = (struct zip_member *)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(struct zip_member) * (total + 1));
+	if (!cd || !*members) {
+		ret = ZIP_ERROR_ALLOC;
+		goto cleanup;
+	}
+	if ((SetFilePointer(fd, cd_offset, 0, FILE_BEGIN) != cd_offset) || !ReadFile(fd, cd, cd_size, &rd, 0) || (rd != cd_size)) {
+		ret = WAD_ERROR_FILE_READ;
+		goto cleanup;
+	}
+
+	for (p = cd, i = 0; i < total; ++i) {
+		struct zip_member *m = *members + n;
+		int name_length, skip;
+
+		if ((p + ZIP_CENTRAL_SIZE > cd + cd_size) || (get32(p) != ZIP_CENTRAL)) goto cleanup;
+		name_length = get16(p + 28);
+		skip = ZIP_CENTRAL_SIZE + name_length + get16(p + 30) + get16(p + 32);
+		if (p + skip > cd + cd_size) goto cleanup;
+
+		m->method = get16(p + 10);
+		m->crc = get32(p + 16);
+		m->packed_size = get32(p + 20);
+		m->raw_size = get32(p + 24);
+		m->offset = get32(p + 42);
+		m->order = n;
+		if (get16(p + 8) & 1) {
+			ret = ZIP_ERROR_UNSUPPORTED; // encrypted
+			goto cleanup;
+		}
+		if ((m->packed_size < 0) || (m->raw_size < 0)) {
+			ret = ZIP_ERROR_UNSUPPORTED;
+			goto cleanup;
+		}
+		// folders have entries of their own in some archives
+		if (name_length && (p[ZIP_CENTRAL_SIZE + name_length - 1] != '/')) {
+			classify(m, (const char *)p + ZIP_CENTRAL_SIZE, name_length);
+			++n;
+		}
+		p += skip;
+	}
+	*count = n;
+	ret = 0;
+
+cleanup:
+	if (cd) HeapFree(GetProcessHeap(), 0, cd);
+	if (ret && *members) {
+		HeapFree(GetProcessHeap(), 0, *members);
+		*members = 0;
+	}
+	return ret;
+}
+
+static void
+inflate_member(void *ctx, int worker, int index)
+{
+	struct zip_import_job *job = (struct zip_import_job *)ctx;
+	struct zip_member *m = job->members + job->base + index;
+	struct wad_reader *reader = &job->readers[worker];
+	unsigned char hd[ZIP_LOCAL_SIZE];
+	struct wad_span span;
+	char *packed = 0, *raw = 0;
+	int ret;
+
+	if (job->error) return;
+	span.path = job->path;
+	span.offset = m->offset;
+	span.size = ZIP_LOCAL_SIZE;
+	ret = read_all(reader, &span, hd);
+	if (ret) goto fail;
+	ret = ZIP_ERROR_FORMAT;
+	if (get32(hd) != ZIP_LOCAL) goto fail;
+	ret = ZIP_ERROR_UNSUPPORTED;
+	if ((m->method != ZIP_STORED) && (m->method != ZIP_DEFLATED)) goto fail;
+	if ((m->method == ZIP_STORED) && (m->packed_size != m->raw_size)) goto fail;
+
+	ret = ZIP_ERROR_ALLOC;
+	packed = (char *)HeapAlloc(GetProcessHeap(), 0, m->packed_size + 1);
+	if (!packed) goto fail;
+	// the local header may carry other extra data than the central one
+	span.offset = m->offset + ZIP_LOCAL_SIZE + get16(hd + 26) + get16(hd + 28);
+	span.size = m->packed_size;
+	ret = read_all(reader, &span, packed);
+	if (ret) goto fail;
+
+	if (m->method == ZIP_DEFLATED) {
+		raw = (char *)HeapAlloc(GetProcessHeap(), 0, m->raw_size + 1);
+		ret = ZIP_ERROR_ALLOC;
+		if (!raw) goto fail;
+		ret = deflate_inflate(packed, m->packed_size, raw, m->raw_size);
+		if (ret != m->raw_size) {
+			ret = ZIP_ERROR_FORMAT;
+			goto fail;
+		}
+		HeapFree(GetProcessHeap(), 0, packed);
+		packed = 0;
+	} else {
+		raw = packed;
+		packed = 0;
+	}
+	if (hash_crc32(0, raw, m->raw_size) != m->crc) {
+		ret = ZIP_ERROR_CRC;
+		goto fail;
+	}
+	m->data = raw;
+	return;
+
+fail:
+	if (packed) HeapFree(GetProcessHeap(), 0, packed);
+	if (raw) HeapFree(GetProcessHeap(), 0, raw);
+	job->error = ret;
+}
+
+struct zip_directory {
+	struct wad_dentry *dentries;
+	int count;
+	int capacity;
+};
+
+static int
+add_dentry(struct zip_directory *dir, const char *name, int offset, int size)
+{
+	struct wad_dentry *d;
+
+	if (dir->count == dir->capacity) {
+		int capacity = dir->capacity ? (dir->capacity * 2) : 256;
+		struct wad_dentry *p = dir->dentries
+			? (struct wad_dentry *)HeapReAlloc(GetProcessHeap(), 0, dir->dentries, sizeof(struct wad_dentry) * capacity)
+			: (struct wad_dentry *)HeapAlloc(GetProcessHeap(), 0, sizeof(struct wad_dentry) * capacity);
+		if (!p) return ZIP_ERROR_ALLOC;
+		dir->dentries = p;
+		dir->capacity = capacity;
+	}
+	d = dir->dentries + dir->count++;
+	ZeroMemory(d, sizeof(*d));
+	lstrcpyn(d->name, name, sizeof(d->name));
+	d->offset = size ? offset : 0;
+	d->size = size;
+	return 0;
+}
+
+// the lumps of a map archive go in as they are, header lump included
+static int
+write_map(HANDLE fd, struct zip_directory *dir, int *pos, const struct zip_member *m)
+{
+	const struct wad_header *hd = (const struct wad_header *)m->data;
+	int i;
+
+	if ((m->raw_size < WAD_HEADER_SIZE) || (hd->lump_count < 0) || (hd->directory_offset < 0)) return ZIP_ERROR_FORMAT;
+	if ((hd->directory_offset > m->raw_size) || (hd->lump_count > (m->raw_size - hd->directory_offset) / WAD_DENTRY_SIZE)) return ZIP_ERROR_FORMAT;
+	for (i = 0; i < hd->lump_count; ++i) {
+		const char *entry = m->data + hd->directory_offset + WAD_DENTRY_SIZE * i;
+		struct wad_dentry d;
+		int ret;
+
+		CopyMemory(&d, entry, 8);
+		CopyMemory(d.name, entry + 8, 8);
+		d.name[8] = '\0';
+		if ((d.offset < 0) || (d.size < 0) || (d.size > m->raw_size) || (d.offset > m->raw_size - d.size)) return ZIP_ERROR_FORMAT;
+		ret = write_all(fd, m->data + d.offset, d.size);
+		if (!ret) ret = add_dentry(dir, d.name, *pos, d.size);
+		if (ret) return ret;
+		*pos += d.size;
+	}
+	return 0;
+}
+
+int
+zip_import(const char *zip_path, const char *wad_path, struct zip_stats *stats)
+{
+	struct zip_import_job *job = 0;
+	struct zip_member *members = 0;
+	struct zip_directory dir;
+	struct wad_header hd;
+	HANDLE zfd, fd = INVALID_HANDLE_VALUE;
+	int pos = WAD_HEADER_SIZE;
+	int count = 0, ns = 0;
+	int i, end;
+	int ret;
+
+	ZeroMemory(stats, sizeof(*stats));
+	ZeroMemory(&dir, sizeof(dir));
+	zfd = CreateFile(zip_path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, 0, 0);
+	if (zfd == INVALID_HANDLE_VALUE) return WAD_ERROR_FILE_OPEN;
+	ret = read_directory(zfd, &members, &count);
+	CloseHandle(zfd);
+	if (ret) return ret;
+	qsort(members, count, sizeof(struct zip_member), compare_members);
+
+	ret = ZIP_ERROR_ALLOC;
+	job = (struct zip_import_job *)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(struct zip_import_job));
+	if (!job) goto cleanup;
+	for (i = 0; i < PARALLEL_MAX_WORKERS; ++i) {
+		wad_reader_init(&job->readers[i]);
+	}
+	job->path = zip_path;
+	job->members = members;
+
+	ret = WAD_ERROR_FILE_OPEN;
+	fd = CreateFile(wad_path, GENERIC_WRITE, 0, 0, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, 0);
+	if (fd == INVALID_HANDLE_VALUE) goto cleanup;
+	hd.type = WAD_TYPE_PWAD;
+	hd.lump_count = 0;
+	hd.directory_offset = 0; // we don't know yet
+	ret = write_all(fd, &hd, WAD_HEADER_SIZE);
+	if (ret) goto cleanup;
+	hash_crc32(0, 0, 0);
+
+	for (i = 0; i < count; i = end) {
+		int batch = 0;
+
+		for (end = i; (end < count) && ((end == i) || (batch + members[end].raw_size <= ZIP_BATCH_SIZE)); ++end) {
+			batch += members[end].raw_size;
+		}
+		job->base = i;
+		parallel_for(end - i, inflate_member, job);
+		ret = job->error;
+
+		for (; !ret && (i < end); ++i) {
+			const struct zip_member *m = members + i;
+
+			if (m->ns != ns) {
+				if (ns) ret = add_dentry(&dir, wad_namespace_marker(ns, !0), 0, 0);
+				ns = m->ns;
+				if (!ret) ret = add_dentry(&dir, wad_namespace_marker(ns, 0), 0, 0);
+				if (ret) break;
+			}
+			if (m->is_map) {
+				ret = write_map(fd, &dir, &pos, m);
+				++stats->maps;
+			} else {
+				ret = write_all(fd, m->data, m->raw_size);
+				if (!ret) ret = add_dentry(&dir, m->lump, pos, m->raw_size);
+				pos += m->raw_size;
+			}
+			++stats->entries;
+			stats->raw_bytes += m->raw_size;
+			stats->packed_bytes += m->packed_size;
+			if (m->method == ZIP_STORED) ++stats->stored;
+		}
+		for (i = job->base; i < end; ++i) {
+			if (members[i].data) HeapFree(GetProcessHeap(), 0, members[i].data);
+			members[i].data = 0;
+		}
+		if (ret) goto cleanup;
+	}
+	if (ns) {
+		ret = add_dentry(&dir, wad_namespace_marker(ns, !0), 0, 0);
+		if (ret) goto cleanup;
+	}
+
+	hd.lump_count = dir.count;
+	hd.directory_offset = pos;
+	for (i = 0; !ret && (i < dir.count); ++i) {
+		ret = write_all(fd, dir.dentries + i, WAD_DENTRY_SIZE);
+	}
+	if (ret) goto cleanup;
+	SetFilePointer(fd, 0, 0, FILE_BEGIN);
+	ret = write_all(fd, &hd, WAD_HEADER_SIZE);
+
+cleanup:
+	if (fd != INVALID_HANDLE_VALUE) CloseHandle(fd);
+	if (job) {
+		for (i = 0; i < PARALLEL_MAX_WORKERS; ++i) {
+			wad_reader_close(&job->readers[i]);
+		}
+		HeapFree(GetProcessHeap(), 0, job);
+	}
+	if (members) HeapFree(GetProcessHeap(), 0, members);
+	if (dir.dentries) HeapFree(GetProcessHeap(), 0, dir.dentries);
+	return ret;
+}
@@ -0,0 +1,33 @@
+#ifndef ZIP_HEADER
+#define ZIP_HEADER
+
+#include "wad.h"
+
+// raw bytes being compressed or inflated at once
+#define ZIP_BATCH_SIZE (64 * 1024 * 1024)
+
+enum zip_error {
+	ZIP_ERROR_ALLOC = -128,
+	ZIP_ERROR_WRITE = -129,
+	ZIP_ERROR_FORMAT = -130,
+	ZIP_ERROR_UNSUPPORTED = -131,
+	ZIP_ERROR_CRC = -132,
+	ZIP_ERROR_LIMIT = -133
+};
+
+struct zip_stats {
+	int entries;
+	int maps;
+	int stored; // entries that did not get smaller
+	int renamed; // lumps sharing a name and folder, given a ~N suffix
+	unsigned raw_bytes;
+	unsigned packed_bytes;
+};
+
+// namespaces become folders, maps become maps/<name>.wad, everything
+// else goes to the root
+int zip_export(const char *path, const struct wad_dentry *dentries, const struct wad_span *spans, int count, struct zip_stats *stats);
+// and the other way around, writing a pwad
+int zip_import(const char *zip_path, const char *wad_path, struct zip_stats *stats);
+
+#endif // ZIP_HEADER
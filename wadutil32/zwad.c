@@ -0,0 +1,414 @@
+#include "zwad.h"
+#include "deflate.h"
+#include "hash.h"
+#include "parallel.h"
+#include "stats.h"
+
+#define WIN32_LEAN_AND_MEAN
+#undef UNICODE
+#include <windows.h>
+
+#define ZWAD_MAX_OFFSET 0x7fffffff
+
+struct zwad_job {
+	const struct wad_span *spans;
+	const struct wad_dentry *table; // offsets are first blocks already
+	const int *block_lumps;
+	struct zwad_block *blocks;
+	char *out; // a batch of blocks, ZWAD_BLOCK_SIZE apart
+	char *scratch; // a block for each worker
+	int base;
+	struct wad_reader readers[PARALLEL_MAX_WORKERS];
+	volatile LONG error;
+};
+
+static int
+block_count(int size)
+{
+	return (size + ZWAD_BLOCK_SIZE - 1) / ZWAD_BLOCK_SIZE;
+}
+
+static int
+block_size(const struct wad_dentry *d, int block)
+{
+	int pos = (block - d->offset) * ZWAD_BLOCK_SIZE;
+
+	return (d->size - pos < ZWAD_BLOCK_SIZE) ? d->size - pos : ZWAD_BLOCK_SIZE;
+}
+
+static int
+write_all(HANDLE fd, const void *data, int length)
+{
+	DWORD wr;
+
+	if (!length) return 0;
+	if (!WriteFile(fd, data, length, &wr, 0) || (wr != (DWORD)length)) return ZWAD_ERROR_WRITE;
+	return 0;
+}
+
+static int
+write_directory(HANDLE fd, const struct wad_dentry *dentries, int count)
+{
+	char entry[WAD_DENTRY_SIZE];
+	int ret;
+	int i;
+
+	for (i = 0; i < count; ++i) {
+		CopyMemory(entry, dentries + i, 8);
+		ZeroMemory(entry + 8, 8);
+		CopyMemory(entry + 8, dentries[i].name, lstrlen(dentries[i].name));
+		ret = write_all(fd, entry, WAD_DENTRY_SIZE);
+		if (ret) return ret;
+	}
+	return 0;
+}
+
+static int
+rewrite_header(HANDLE fd, const void *hd, int length)
+{
+	if (SetFilePointer(fd, 0, 0, FILE_BEGIN) != 0) return WAD_ERROR_FILE_SEEK;
+	return write_all(fd, hd, length);
+}
+
+static void
+compress_block(void *ctx, int worker, int index)
+{
+	struct zwad_job *job = (struct zwad_job *)ctx;
+	int block = job->base + index;
+	const struct wad_dentry *d = job->table + job->block_lumps[block];
+	struct zwad_block *b = job->blocks + block;
+	char *raw = job->scratch + worker * ZWAD_BLOCK_SIZE;
+	char *out = job->out + index * ZWAD_BLOCK_SIZE;
+	int size = block_size(d, block);
+	int pos = 0;
+	int ret;
+
+	if (job->error) return;
+	while (pos < size) {
+		ret = wad_reader_read(&job->readers[worker], job->spans + job->block_lumps[block], (block - d->offset) * ZWAD_BLOCK_SIZE + pos, raw + pos, size - pos);
+		if (ret <= 0) {
+			job->error = ret ? ret : WAD_ERROR_FILE_READ;
+			return;
+		}
+		pos += ret;
+	}
+	b->crc = hash_crc32c(0, raw, size);
+
+	// only kept when it got smaller
+	ret = deflate_compress(raw, size, out, size - 1);
+	if (ret >= 0) {
+		b->packed_size = ret;
+	} else {
+		if (ret == DEFLATE_ERROR_ALLOC) job->error = ZWAD_ERROR_ALLOC;
+		CopyMemory(out, raw, size);
+		b->packed_size = size;
+	}
+}
+
+int
+zwad_compress(const char *path, enum wad_type type, const struct wad_dentry *dentries, const struct wad_span *spans, int count, struct zwad_stats *stats)
+{
+	struct zwad_header hd;
+	struct zwad_job *job;
+	struct wad_dentry *table;
+	struct zwad_block *blocks = 0;
+	int *block_lumps = 0;
+	HANDLE fd = INVALID_HANDLE_VALUE;
+	unsigned pos = ZWAD_HEADER_SIZE;
+	int blocks_total = 0;
+	int i, j, end;
+	int ret = ZWAD_ERROR_ALLOC;
+
+	ZeroMemory(stats, sizeof(*stats));
+	job = (struct zwad_job *)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(struct zwad_job));
+	table = (struct wad_dentry *)HeapAlloc(GetProcessHeap(), 0, sizeof(struct wad_dentry) * (count + 1));
+	if (!job || !table) goto cleanup;
+	for (i = 0; i < PARALLEL_MAX_WORKERS; ++i) {
+		wad_reader_init(&job->readers[i]);
+	}
+
+	for (i = 0; i < count; ++i) {
+		table[i] = dentries[i];
+		table[i].offset = blocks_total;
+		blocks_total += block_count(dentries[i].size);
+	}
+	blocks = (struct zwad_block *)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(struct zwad_block) * (blocks_total + 1));
+	block_lumps = (int *)HeapAlloc(GetProcessHeap(), 0, sizeof(int) * (blocks_total + 1));
+	job->out = (char *)HeapAlloc(GetProcessHeap(), 0, ZWAD_BATCH_BLOCKS * ZWAD_BLOCK_SIZE);
+	job->scratch = (char *)HeapAlloc(GetProcessHeap(), 0, PARALLEL_MAX_WORKERS * ZWAD_BLOCK_SIZE);
+	if (!blocks || !block_lumps || !job->out || !job->scratch) goto cleanup;
+	for (i = 0; i < count; ++i) {
+		for (j = 0; j < block_count(table[i].size); ++j) {
+			block_lumps[table[i].offset + j] = i;
+		}
+	}
+	job->spans = spans;
+	job->table = table;
+	job->block_lumps = block_lumps;
+	job->blocks = blocks;
+
+	ret = WAD_ERROR_FILE_OPEN;
+	fd = CreateFile(path, GENERIC_WRITE, 0, 0, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, 0);
+	if (fd == INVALID_HANDLE_VALUE) goto cleanup;
+
+	hd.magic = ZWAD_MAGIC;
+	hd.type = type;
+	hd.lump_count = count;
+	hd.block_count = blocks_total;
+	hd.table_offset = 0; // we don't know yet
+	ret = write_all(fd, &hd, ZWAD_HEADER_SIZE);
+	if (ret) goto cleanup;
+	hash_crc32c(0, 0, 0); // builds the table before the workers race for it
+
+	// only a batch is ever in memory, written out in order once it is done
+	for (i = 0; i < blocks_total; i = end) {
+		end = (blocks_total - i < ZWAD_BATCH_BLOCKS) ? blocks_total : i + ZWAD_BATCH_BLOCKS;
+		job->base = i;
+		parallel_for(end - i, compress_block, job);
+		ret = job->error;
+		if (ret) goto cleanup;
+
+		for (j = i; j < end; ++j) {
+			ret = ZWAD_ERROR_LIMIT;
+			if (pos > ZWAD_MAX_OFFSET - blocks[j].packed_size) goto cleanup;
+			blocks[j].offset = pos;
+			ret = write_all(fd, job->out + (j - i) * ZWAD_BLOCK_SIZE, blocks[j].packed_size);
+			if (ret) goto cleanup;
+			pos += blocks[j].packed_size;
+
+			if (blocks[j].packed_size == block_size(table + block_lumps[j], j)) ++stats->stored;
+			stats->raw_bytes += block_size(table + block_lumps[j], j);
+			stats->packed_bytes += blocks[j].packed_size;
+		}
+	}
+
+	ret = ZWAD_ERROR_LIMIT;
+	if (pos > ZWAD_MAX_OFFSET - (unsigned)(WAD_DENTRY_SIZE * count + ZWAD_BLOCK_ENTRY_SIZE * blocks_total)) goto cleanup;
+	hd.table_offset = pos;
+	ret = write_directory(fd, table, count);
+	if (!ret) ret = write_all(fd, blocks, ZWAD_BLOCK_ENTRY_SIZE * blocks_total);
+	if (!ret) ret = rewrite_header(fd, &hd, ZWAD_HEADER_SIZE);
+	stats->lumps = count;
+	stats->blocks = blocks_total;
+
+cleanup:
+	if (fd != INVALID_HANDLE_VALUE) CloseHandle(fd);
+	if (job) {
+		for (i = 0; i < PARALLEL_MAX_WORKERS; ++i) {
+			wad_reader_close(&job->readers[i]);
+		}
+		if (job->out) HeapFree(GetProcessHeap(), 0, job->out);
+		if (job->scratch) HeapFree(GetProcessHeap(), 0, job->scratch);
+		HeapFree(GetProcessHeap(), 0, job);
+	}
+	if (table) HeapFree(GetProcessHeap(), 0, table);
+	if (blocks) HeapFree(GetProcessHeap(), 0, blocks);
+	if (block_lumps) HeapFree(GetProcessHeap(), 0, block_lumps);
+	return ret;
+}
+
+static int
+read_at(HANDLE fd, int offset, void *buf, int length)
+{
+	DWORD rd;
+
+	if (SetFilePointer(fd, offset, 0, FILE_BEGIN) != (DWORD)offset) return WAD_ERROR_FILE_SEEK;
+	if (!ReadFile(fd, buf, length, &rd, 0) || (rd != (DWORD)length)) return WAD_ERROR_FILE_READ;
+	STATS_ADD(STATS_SEEKS, 1);
+	STATS_ADD(STATS_READS, 1);
+	STATS_ADD(STATS_BYTES_READ, rd);
+	return 0;
+}
+
+int
+zwad_open(struct zwad *zwad, const char *path)
+{
+	char *directory = 0;
+	int i;
+	int ret = ZWAD_ERROR_FORMAT;
+
+	ZeroMemory(zwad, sizeof(*zwad));
+	zwad->raw_block = -1;
+	zwad->fd = CreateFile(path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, 0, 0);
+	if (zwad->fd == INVALID_HANDLE_VALUE) return WAD_ERROR_FILE_OPEN;
+
+	ret = read_at(zwad->fd, 0, &zwad->hd, ZWAD_HEADER_SIZE);
+	if (ret) goto cleanup;
+	ret = ZWAD_ERROR_FORMAT;
+	if (zwad->hd.magic != ZWAD_MAGIC) goto cleanup;
+	if ((zwad->hd.lump_count < 0) || (zwad->hd.block_count < 0) || (zwad->hd.table_offset < ZWAD_HEADER_SIZE)) goto cleanup;
+	if (zwad->hd.lump_count > (ZWAD_MAX_OFFSET - zwad->hd.table_offset) / WAD_DENTRY_SIZE) goto cleanup;
+	if (zwad->hd.block_count > (ZWAD_MAX_OFFSET - zwad->hd.table_offset - WAD_DENTRY_SIZE * zwad->hd.lump_count) / ZWAD_BLOCK_ENTRY_SIZE) goto cleanup;
+
+	ret = ZWAD_ERROR_ALLOC;
+	directory = (char *)HeapAlloc(GetProcessHeap(), 0, WAD_DENTRY_SIZE * zwad->hd.lump_count + 1);
+	zwad->dentries = (struct wad_dentry *)HeapAlloc(GetProcessHeap(), 0, sizeof(struct wad_dentry) * (zwad->hd.lump_count + 1));
+	zwad->blocks = (struct zwad_block *)HeapAlloc(GetProcessHeap(), 0, sizeof(struct zwad_block) * (zwad->hd.block_count + 1));
+	zwad->packed = (char *)HeapAlloc(GetProcessHeap(), 0, ZWAD_BLOCK_SIZE);
+	zwad->raw = (char *)HeapAlloc(GetProcessHeap(), 0, ZWAD_BLOCK_SIZE);
+	if (!directory || !zwad->dentries || !zwad->blocks || !zwad->packed || !zwad->raw) goto cleanup;
+
+	ret = read_at(zwad->fd, zwad->hd.table_offset, directory, WAD_DENTRY_SIZE * zwad->hd.lump_count);
+	if (!ret) ret = read_at(zwad->fd, zwad->hd.table_offset + WAD_DENTRY_SIZE * zwad->hd.lump_count, zwad->blocks, ZWAD_BLOCK_ENTRY_SIZE * zwad->hd.block_count);
+	if (ret) goto cleanup;
+
+	ret = ZWAD_ERROR_FORMAT;
+	for (i = 0; i < zwad->hd.lump_count; ++i) {
+		struct wad_dentry *d = zwad->dentries + i;
+
+		CopyMemory(d, directory + WAD_DENTRY_SIZE * i, WAD_DENTRY_SIZE);
+		d->name[8] = '\0';
+		if ((d->size < 0) || (d->offset < 0) || (d->offset > zwad->hd.block_count - block_count(d->size))) goto cleanup;
+	}
+	for (i = 0; i < zwad->hd.block_count; ++i) {
+		const struct zwad_block *b = zwad->blocks + i;
+
+		if ((b->packed_size < 0) || (b->packed_size > ZWAD_BLOCK_SIZE)) goto cleanup;
+		if ((b->offset < ZWAD_HEADER_SIZE) || (b->offset > zwad->hd.table_offset - b->packed_size)) goto cleanup;
+	}
+	ret = WAD_SUCCESS;
+
+cleanup:
+	if (directory) HeapFree(GetProcessHeap(), 0, directory);
+	if (ret) zwad_close(zwad);
+	return ret;
+}
+
+void
+zwad_close(struct zwad *zwad)
+{
+	if (zwad->fd != INVALID_HANDLE_VALUE) CloseHandle(zwad->fd);
+	if (zwad->dentries) HeapFree(GetProcessHeap(), 0, zwad->dentries);
+	if (zwad->blocks) HeapFree(GetProcessHeap(), 0, zwad->blocks);
+	if (zwad->packed) HeapFree(GetProcessHeap(), 0, zwad->packed);
+	if (zwad->raw) HeapFree(GetProcessHeap(), 0, zwad->raw);
+	ZeroMemory(zwad, sizeof(*zwad));
+	zwad->fd = INVALID_HANDLE_VALUE;
+	zwad->raw_block = -1;
+}
+
+// stored blocks are read straight into dst
+static int
+load_block(struct zwad *zwad, int block, int size, char *dst)
+{
+	const struct zwad_block *b = zwad->blocks + block;
+	char *src = (b->packed_size == size) ? dst : zwad->packed;
+	int ret;
+
+	ret = read_at(zwad->fd, b->offset, src, b->packed_size);
+	if (ret) return ret;
+	if ((src != dst) && (deflate_inflate(src, b->packed_size, dst, size) != size)) return ZWAD_ERROR_DATA;
+	if (hash_crc32c(0, dst, size) != b->crc) return ZWAD_ERROR_DATA;
+	return 0;
+}
+
+int
+zwad_read(struct zwad *zwad, int lump, int pos, void *buf, int length)
+{
+	const struct wad_dentry *d;
+	char *out = (char *)buf;
+	int done = 0;
+	int ret;
+
+	if ((lump < 0) || (lump >= zwad->hd.lump_count)) return ZWAD_ERROR_FORMAT;
+	d = zwad->dentries + lump;
+	if ((pos < 0) || (pos >= d->size) || (length <= 0)) return 0;
+	if (length > d->size - pos) length = d->size - pos;
+
+	while (done < length) {
+		int block = d->offset + (pos + done) / ZWAD_BLOCK_SIZE;
+		int start = (pos + done) % ZWAD_BLOCK_SIZE;
+		int size = block_size(d, block);
+		int n = (size - start < length - done) ? size - start : length - done;
+
+		if (!start && (n == size)) {
+			ret = load_block(zwad, block, size, out + done);
+			if (ret) return ret;
+		} else {
+			if (zwad->raw_block == block) {
+				STATS_ADD(STATS_CACHE_HITS, 1);
+			} else {
+				STATS_ADD(STATS_CACHE_MISSES, 1);
+				zwad->raw_block = -1;
+				ret = load_block(zwad, block, size, zwad->raw);
+				if (ret) return ret;
+				zwad->raw_block = block;
+			}
+			CopyMemory(out + done, zwad->raw + start, n);
+		}
+		done += n;
+	}
+	return done;
+}
+
+int
+zwad_extract(const char *zwad_path, const char *wad_path, struct zwad_stats *stats)
+{
+	struct zwad zwad;
+	struct wad_header hd;
+	struct wad_dentry *directory = 0;
+	HANDLE fd = INVALID_HANDLE_VALUE;
+	char *buf = 0;
+	int pos = WAD_HEADER_SIZE;
+	int i;
+	int ret;
+
+	ZeroMemory(stats, sizeof(*stats));
+	ret = zwad_open(&zwad, zwad_path);
+	if (ret) return ret;
+
+	ret = ZWAD_ERROR_ALLOC;
+	directory = (struct wad_dentry *)HeapAlloc(GetProcessHeap(), 0, sizeof(struct wad_dentry) * (zwad.hd.lump_count + 1));
+	buf = (char *)HeapAlloc(GetProcessHeap(), 0, ZWAD_BLOCK_SIZE);
+	if (!directory || !buf) goto cleanup;
+
+	ret = WAD_ERROR_FILE_OPEN;
+	fd = CreateFile(wad_path, GENERIC_WRITE, 0, 0, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, 0);
+	if (fd == INVALID_HANDLE_VALUE) goto cleanup;
+
+	hd.type = zwad.hd.type;
+	hd.lump_count = zwad.hd.lump_count;
+	hd.directory_offset = 0; // we don't know yet
+	ret = write_all(fd, &hd, WAD_HEADER_SIZE);
+	if (ret) goto cleanup;
+
+	for (i = 0; i < zwad.hd.lump_count; ++i) {
+		const struct wad_dentry *d = zwad.dentries + i;
+		int done = 0;
+
+		ret = ZWAD_ERROR_LIMIT;
+		if (pos > ZWAD_MAX_OFFSET - d->size) goto cleanup;
+		directory[i] = *d;
+		directory[i].offset = d->size ? pos : 0;
+		while (done < d->size) {
+			ret = zwad_read(&zwad, i, done, buf, ZWAD_BLOCK_SIZE);
+			if (ret <= 0) {
+				if (!ret) ret = ZWAD_ERROR_FORMAT;
+				goto cleanup;
+			}
+			done += ret;
+			ret = write_all(fd, buf, ret);
+			if (ret) goto cleanup;
+		}
+		pos += d->size;
+		stats->raw_bytes += d->size;
+	}
+	for (i = 0; i < zwad.hd.block_count; ++i) {
+		stats->packed_bytes += zwad.blocks[i].packed_size;
+	}
+	stats->lumps = zwad.hd.lump_count;
+	stats->blocks = zwad.hd.block_count;
+
+	ret = ZWAD_ERROR_LIMIT;
+	if (pos > ZWAD_MAX_OFFSET - WAD_DENTRY_SIZE * zwad.hd.lump_count) goto cleanup;
+	hd.directory_offset = pos;
+	ret = write_directory(fd, directory, zwad.hd.lump_count);
+	if (!ret) ret = rewrite_header(fd, &hd, WAD_HEADER_SIZE);
+
+cleanup:
+	if (fd != INVALID_HANDLE_VALUE) CloseHandle(fd);
+	if (directory) HeapFree(GetProcessHeap(), 0, directory);
+	if (buf) HeapFree(GetProcessHeap(), 0, buf);
+	zwad_close(&zwad);
+	return ret;
+}
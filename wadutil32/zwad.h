@@ -0,0 +1,70 @@
+#ifndef ZWAD_HEADER
+#define ZWAD_HEADER
+
+#include "wad.h"
+
+// every lump is cut into blocks of this size, each deflated on its own,
+// so a read only ever inflates the blocks it touches
+#define ZWAD_BLOCK_SIZE (64 * 1024)
+// blocks being compressed at once
+#define ZWAD_BATCH_BLOCKS 256
+
+#define ZWAD_HEADER_SIZE (4 + 4 + 4 + 4 + 4)
+#define ZWAD_BLOCK_ENTRY_SIZE (4 + 4 + 4)
+
+enum zwad_error {
+	ZWAD_ERROR_ALLOC = -160,
+	ZWAD_ERROR_WRITE = -161,
+	ZWAD_ERROR_FORMAT = -162,
+	ZWAD_ERROR_DATA = -163, // a block failed to inflate or its checksum is off
+	ZWAD_ERROR_LIMIT = -164
+};
+
+enum zwad_magic {
+	ZWAD_MAGIC = LE_FOURCC('Z', 'W', 'A', 'D')
+};
+
+// the directory is written like that of a wad, the offset being the
+// first block of the lump, followed by the block table
+struct zwad_header {
+	enum zwad_magic magic;
+	enum wad_type type; // of the wad it came from
+	int lump_count;
+	int block_count;
+	int table_offset;
+};
+
+struct zwad_block {
+	int offset;
+	int packed_size; // the same as the unpacked size when stored
+	unsigned crc; // crc32c of the unpacked data
+};
+
+struct zwad_stats {
+	int lumps;
+	int blocks;
+	int stored; // blocks that did not get smaller
+	unsigned raw_bytes;
+	unsigned packed_bytes;
+};
+
+// not to be shared between threads, open one for each instead
+struct zwad {
+	void *fd;
+	struct zwad_header hd;
+	struct wad_dentry *dentries;
+	struct zwad_block *blocks;
+	char *packed;
+	char *raw; // the last block read partially, kept for the next read
+	int raw_block;
+};
+
+int zwad_compress(const char *path, enum wad_type type, const struct wad_dentry *dentries, const struct wad_span *spans, int count, struct zwad_stats *stats);
+int zwad_extract(const char *zwad_path, const char *wad_path, struct zwad_stats *stats);
+
+int zwad_open(struct zwad *zwad, const char *path);
+void zwad_close(struct zwad *zwad);
+// returns the number of bytes read, 0 at the end of the lump
+int zwad_read(struct zwad *zwad, int lump, int pos, void *buf, int length);
+
+#endif // ZWAD_HEADER